@@ -0,0 +1,416 @@
+#include "async_reader.h"
+
+#include <string>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MB_HAVE_IO_URING 1
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+/**
+ * @brief The file being read into one of the buffers.
+ */
+struct AsyncReader::Slot {
+    Request request{};
+    std::string path{}; ///< The path of the request spelled out for the open, reused by every request
+    int fd = -1;        ///< Set once the open completed
+    int64_t size = 0;   ///< Size of the file when it was opened
+};
+
+#ifdef MB_HAVE_IO_URING
+namespace {
+constexpr unsigned kRingEntries = 2 * AsyncReader::kBufferCount; ///< Every file in flight needs at most one entry
+constexpr size_t kPageSize = 4096;
+constexpr auto kBackoff = std::chrono::milliseconds{1}; ///< Pause before retrying a ring short of resources
+
+int io_uring_setup(const unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(const int fd, const unsigned opcode, const void* arg, const unsigned count) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+unsigned load_acquire(unsigned* value) { return std::atomic_ref<unsigned>{*value}.load(std::memory_order_acquire); }
+
+void store_release(unsigned* value, const unsigned to) {
+    std::atomic_ref<unsigned>{*value}.store(to, std::memory_order_release);
+}
+} // namespace
+
+/**
+ * @brief The io_uring instance, its mapped rings and the registered buffers.
+ */
+struct AsyncReader::Ring {
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    ~Ring() {
+        if (sqes != nullptr) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ring != nullptr && cq_ring != sq_ring) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != nullptr) {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (buffers != nullptr) {
+            ::operator delete(buffers, std::align_val_t{kPageSize});
+        }
+    }
+
+    /**
+     * @brief Sets up the ring.
+     * @return false if io_uring or one of the operations used is not available.
+     */
+    bool init() {
+        io_uring_params params{};
+        fd = io_uring_setup(kRingEntries, &params);
+        if (fd < 0) {
+            return false;
+        }
+        if (!supports({IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED})) {
+            return false;
+        }
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+        if (sq_ring == nullptr || cq_ring == nullptr || sqes == nullptr) {
+            return false;
+        }
+        auto* sq = static_cast<char*>(sq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqe_tail = *sq_tail;
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto* cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        buffers = static_cast<char*>(::operator new(kBufferSize * kBufferCount, std::align_val_t{kPageSize}));
+        iovec iovecs[kBufferCount];
+        for (size_t i = 0; i < kBufferCount; ++i) {
+            iovecs[i] = {buffers + i * kBufferSize, kBufferSize};
+        }
+        // Registering pins the buffers, which the memlock limit may not allow; plain reads
+        // into the same buffers work either way.
+        fixed = io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs, kBufferCount) == 0;
+        return true;
+    }
+
+    char* buffer(const size_t index) const { return buffers + index * kBufferSize; }
+
+    /**
+     * @brief Returns the next free submission entry, cleared; there always is one since
+     *        every file in flight uses at most one.
+     */
+    io_uring_sqe& next_sqe() {
+        const unsigned index = sqe_tail & sq_mask;
+        sq_array[index] = index;
+        ++sqe_tail;
+        sqes[index] = io_uring_sqe{};
+        return sqes[index];
+    }
+
+    /**
+     * @brief Submits the prepared entries and waits for the given number of completions.
+     *
+     * Entries the kernel does not take stay between the head and the tail of the ring and
+     * are submitted by the next call.
+     *
+     * @return 0, or the error of io_uring_enter().
+     */
+    int enter(const unsigned wait_for) {
+        store_release(sq_tail, sqe_tail);
+        while (true) {
+            const unsigned to_submit = sqe_tail - load_acquire(sq_head);
+            if (io_uring_enter(fd, to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0) >= 0) {
+                return 0;
+            }
+            if (errno != EINTR) {
+                return errno;
+            }
+        }
+    }
+
+    /**
+     * @brief Takes back the entries the kernel has not taken, calling `on_entry(buffer)` for each.
+     */
+    template <typename F>
+    void drop_unsubmitted(F&& on_entry) {
+        const unsigned head = load_acquire(sq_head);
+        for (unsigned tail = head; tail != sqe_tail; ++tail) {
+            on_entry(static_cast<size_t>(sqes[sq_array[tail & sq_mask]].user_data));
+        }
+        sqe_tail = head;
+        store_release(sq_tail, head);
+    }
+
+    /**
+     * @return The number of completions handled.
+     */
+    template <typename F>
+    unsigned for_each_completion(F&& on_completion) {
+        const unsigned first = *cq_head;
+        unsigned head = first;
+        for (const unsigned tail = load_acquire(cq_tail); head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cq_mask];
+            on_completion(static_cast<size_t>(cqe.user_data), cqe.res);
+        }
+        store_release(cq_head, head);
+        return head - first;
+    }
+
+    int fd = -1;
+    bool fixed = false; ///< The buffers are registered, so reads can use READ_FIXED
+    char* buffers = nullptr;
+
+private:
+    void* map(const size_t size, const uint64_t offset) const {
+        void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                               static_cast<off_t>(offset));
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
+
+    bool supports(const std::initializer_list<unsigned> opcodes) const {
+        constexpr unsigned kOps = 256;
+        constexpr size_t kProbeSize = sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op);
+        auto* probe = static_cast<io_uring_probe*>(::operator new(kProbeSize));
+        std::memset(probe, 0, kProbeSize);
+        bool supported = io_uring_register(fd, IORING_REGISTER_PROBE, probe, kOps) == 0;
+        for (const unsigned opcode : opcodes) {
+            supported =
+                supported && opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+        ::operator delete(probe);
+        return supported;
+    }
+
+    void* sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void* cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sqe_tail = 0; ///< Tail including the entries prepared since the last submission
+    unsigned sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+std::unique_ptr<AsyncReader> AsyncReader::create(ThreadPool& pool, Callback on_read) {
+    auto ring = std::make_unique<Ring>();
+    if (!ring->init()) {
+        return nullptr;
+    }
+    return std::unique_ptr<AsyncReader>{new AsyncReader(pool, std::move(on_read), std::move(ring))};
+}
+
+AsyncReader::AsyncReader(ThreadPool& pool, Callback on_read, std::unique_ptr<Ring> ring)
+    : pool_(pool), on_read_(std::move(on_read)), ring_(std::move(ring)), slots_(kBufferCount) {
+    free_buffers_.reserve(kBufferCount);
+    for (size_t i = kBufferCount; i-- > 0;) {
+        free_buffers_.push_back(i);
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+AsyncReader::~AsyncReader() {
+    {
+        std::unique_lock lock{mutex_};
+        // The pool tasks still use their buffers until they give them back.
+        idle_.wait(lock, [this] { return queue_.empty() && in_flight_ == 0 && free_buffers_.size() == kBufferCount; });
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+bool AsyncReader::read(const FilePath& file, const uint64_t sequence, const std::optional<FileIdentity>& identity) {
+    {
+        std::lock_guard lock{mutex_};
+        if (broken_ || queue_.size() >= kMaxQueued) {
+            return false;
+        }
+        queue_.push_back({file, sequence, identity});
+    }
+    wake_.notify_one();
+    return true;
+}
+
+void AsyncReader::wait() {
+    std::unique_lock lock{mutex_};
+    idle_.wait(lock, [this] { return queue_.empty() && in_flight_ == 0; });
+}
+
+void AsyncReader::run() {
+    std::vector<size_t> unread{}; // Buffers claimed after the ring broke, handed over without reading
+    std::unique_lock lock{mutex_};
+    while (true) {
+        wake_.wait(lock, [this] {
+            return stop_ || in_flight_ != 0 || (!queue_.empty() && !free_buffers_.empty());
+        });
+        if (stop_ && in_flight_ == 0) {
+            return;
+        }
+        while (!queue_.empty() && !free_buffers_.empty()) {
+            const size_t buffer = free_buffers_.back();
+            free_buffers_.pop_back();
+            Slot& slot = slots_[buffer];
+            slot.request = std::move(queue_.front());
+            queue_.pop_front();
+            ++in_flight_;
+            if (broken_) {
+                unread.push_back(buffer);
+                continue;
+            }
+            io_uring_sqe& sqe = ring_->next_sqe();
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            slot.request.file.assign_to(slot.path);
+            sqe.addr = reinterpret_cast<uint64_t>(slot.path.c_str());
+            sqe.open_flags = O_RDONLY | O_CLOEXEC;
+            sqe.user_data = buffer;
+        }
+        lock.unlock();
+        for (const size_t buffer : unread) {
+            hand_over(buffer, std::nullopt);
+        }
+        unread.clear();
+        // Only this thread changes in_flight_ and broken_, so they can be read without the lock.
+        const int error = broken_ ? 0 : ring_->enter(in_flight_ != 0 ? 1 : 0);
+        if (error != 0 && error != EAGAIN && error != EBUSY) {
+            fail(error);
+        }
+        const unsigned completed =
+            ring_->for_each_completion([this](const size_t buffer, const int result) { complete(buffer, result); });
+        // Without a working io_uring_enter() nothing blocks until the kernel completes more.
+        if ((error != 0 || broken_) && completed == 0 && in_flight_ != 0) {
+            std::this_thread::sleep_for(kBackoff);
+        }
+        lock.lock();
+    }
+}
+
+void AsyncReader::complete(const size_t buffer, const int result) {
+    Slot& slot = slots_[buffer];
+    if (slot.fd < 0) {
+        // The open completed.
+        struct stat st {};
+        if (result < 0) {
+            hand_over(buffer, std::nullopt);
+            return;
+        }
+        slot.fd = result;
+        if (broken_ || ::fstat(slot.fd, &st) != 0 || st.st_size >= static_cast<off_t>(kBufferSize)) {
+            hand_over(buffer, std::nullopt);
+            return;
+        }
+        slot.size = st.st_size;
+        io_uring_sqe& sqe = ring_->next_sqe();
+        sqe.opcode = ring_->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.fd = slot.fd;
+        sqe.addr = reinterpret_cast<uint64_t>(ring_->buffer(buffer));
+        sqe.len = kBufferSize;
+        sqe.buf_index = static_cast<uint16_t>(buffer);
+        sqe.user_data = buffer;
+        return;
+    }
+    // The read completed; a size differing from fstat() means a short read or a file being
+    // written, which the callback handles by reading the file itself.
+    hand_over(buffer, result == slot.size ? std::optional<size_t>{static_cast<size_t>(result)} : std::nullopt);
+}
+
+void AsyncReader::fail(const int error) {
+    std::cerr << "io_uring failed: " << std::strerror(error) << "; reading the files directly" << std::endl;
+    {
+        std::lock_guard lock{mutex_};
+        broken_ = true;
+    }
+    // The entries the kernel never took are not read; those it took still complete.
+    ring_->drop_unsubmitted([this](const size_t buffer) { hand_over(buffer, std::nullopt); });
+}
+
+void AsyncReader::hand_over(const size_t buffer, const std::optional<size_t> size) {
+    Slot& slot = slots_[buffer];
+    if (slot.fd >= 0) {
+        ::close(slot.fd);
+        slot.fd = -1;
+    }
+    pool_.submit([this, buffer, size] {
+        const Slot& slot = slots_[buffer];
+        std::optional<std::string_view> contents{};
+        if (size.has_value()) {
+            contents.emplace(ring_->buffer(buffer), *size);
+        }
+        on_read_(slot.request.file, slot.request.sequence, slot.request.identity, contents);
+        release(buffer);
+    });
+    std::lock_guard lock{mutex_};
+    if (--in_flight_ == 0 && queue_.empty()) {
+        idle_.notify_all();
+    }
+}
+
+void AsyncReader::release(const size_t buffer) {
+    {
+        std::lock_guard lock{mutex_};
+        free_buffers_.push_back(buffer);
+        if (free_buffers_.size() == kBufferCount) {
+            idle_.notify_all();
+        }
+    }
+    wake_.notify_one();
+}
+#else
+struct AsyncReader::Ring {};
+
+std::unique_ptr<AsyncReader> AsyncReader::create(ThreadPool&, Callback) { return nullptr; }
+
+AsyncReader::~AsyncReader() = default;
+
+bool AsyncReader::read(const FilePath&, uint64_t, const std::optional<FileIdentity>&) { return false; }
+
+void AsyncReader::wait() {}
+#endif
+} // namespace mb
@@ -0,0 +1,118 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "file_identity.h"
+#include "file_path.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class AsyncReader
+ * @brief Reads whole files with io_uring and hands the contents to the thread pool.
+ *
+ * A dedicated thread keeps up to kBufferCount files in flight: it submits the open of each
+ * file, then a read of up to kBufferSize bytes into one of a set of buffers registered with
+ * the kernel. Every completed read becomes a pool task that calls the callback with the
+ * contents and gives the buffer back afterwards. The workers therefore only ever wait for
+ * the CPU, while cold-cache and network file system reads overlap instead of blocking one
+ * worker each.
+ *
+ * Only available on Linux with io_uring; create() returns nullptr elsewhere, in which case
+ * the files are best read by the pool's workers themselves.
+ */
+class AsyncReader final {
+public:
+    static constexpr size_t kBufferSize = size_t{256} << 10;
+    static constexpr size_t kBufferCount = 64;
+    static constexpr size_t kMaxQueued = 1024; ///< Requests waiting for a buffer before read() refuses more
+
+    /**
+     * @brief Receives a file on a pool thread.
+     *
+     * The contents are std::nullopt if the file could not be read in one piece, because it
+     * is larger than kBufferSize or because opening or reading it failed; the callback then
+     * has to read the file itself, and also gets to report any error. The view is only valid
+     * during the call.
+     */
+    using Callback = std::function<void(const FilePath& file, uint64_t sequence,
+                                        const std::optional<FileIdentity>& identity,
+                                        std::optional<std::string_view> contents)>;
+
+    /**
+     * @brief Sets up the ring and starts its thread.
+     *
+     * @param pool The pool running the callbacks.
+     * @param on_read Called for every file passed to read().
+     * @return The reader, or nullptr if io_uring is not available.
+     */
+    static std::unique_ptr<AsyncReader> create(ThreadPool& pool, Callback on_read);
+
+    /**
+     * @brief Waits for every read and every callback, then stops the ring thread.
+     */
+    ~AsyncReader();
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    /**
+     * @brief Queues a file to be read.
+     *
+     * @param file Path of the file.
+     * @param sequence Passed on to the callback.
+     * @param identity Passed on to the callback.
+     * @return false if kMaxQueued requests are already waiting or io_uring has failed; the
+     *         caller should read the file itself then.
+     */
+    bool read(const FilePath& file, uint64_t sequence, const std::optional<FileIdentity>& identity);
+    /**
+     * @brief Blocks until every queued file has been handed to the pool.
+     */
+    void wait();
+
+private:
+    struct Ring;
+    struct Request {
+        FilePath file;
+        uint64_t sequence = 0;
+        std::optional<FileIdentity> identity{};
+    };
+    struct Slot;
+
+    AsyncReader(ThreadPool& pool, Callback on_read, std::unique_ptr<Ring> ring);
+
+    void run();
+    void complete(size_t buffer, int result);
+    void fail(int error);
+    void hand_over(size_t buffer, std::optional<size_t> size);
+    void release(size_t buffer);
+
+    ThreadPool& pool_;
+    Callback on_read_;
+    std::unique_ptr<Ring> ring_;
+    std::vector<Slot> slots_; ///< One per buffer, holding the file read into it
+
+    std::mutex mutex_;
+    std::condition_variable wake_; ///< Signalled when there is something for the ring thread to do
+    std::condition_variable idle_; ///< Signalled when the last request has been handed over
+    std::deque<Request> queue_;
+    std::vector<size_t> free_buffers_;
+    size_t in_flight_ = 0; ///< Files between being dequeued and being handed to the pool
+    bool stop_ = false;
+    bool broken_ = false; ///< io_uring_enter() failed, so files are handed over unread
+    std::thread thread_;
+};
+} // namespace mb
@@ -0,0 +1,256 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "corpus_generator.h"
+#include "matcher.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr size_t kTextSize = size_t{16} << 20; ///< Text searched by the matcher benchmarks
+constexpr size_t kSlowTextSize = size_t{1} << 20; ///< Text for the std::regex fallback
+
+mb::CorpusSpec corpus_spec{};
+fs::path corpus_root{};
+size_t corpus_bytes = 0;
+
+/**
+ * @brief Returns log-like text with the corpus' needle on the corpus' fraction of lines.
+ */
+const std::string& text(const size_t size) {
+    static std::vector<std::pair<size_t, std::string>> texts{};
+    for (const auto& [text_size, contents] : texts) {
+        if (text_size == size) {
+            return contents;
+        }
+    }
+    std::mt19937_64 random{corpus_spec.seed};
+    auto contents = mb::generate_text(size, corpus_spec.hit_lines, corpus_spec.needle, random);
+    return texts.emplace_back(size, std::move(contents)).second;
+}
+
+/**
+ * @brief Counts the matching lines of a text the way the search walks a chunk.
+ */
+size_t count_matches(const mb::IMatcher& matcher, const std::string_view text) {
+    size_t matches = 0;
+    for (size_t pos = 0; pos < text.size();) {
+        const auto hit = matcher.find(text.substr(pos));
+        if (!hit.has_value()) {
+            break;
+        }
+        ++matches;
+        pos = text.find('\n', pos + hit->end);
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        ++pos;
+    }
+    return matches;
+}
+
+void matcher_benchmark(benchmark::State& state, const mb::IMatcher& matcher, const size_t size) {
+    const std::string& haystack = text(size);
+    size_t matches = 0;
+    for (auto _ : state) {
+        matches = count_matches(matcher, haystack);
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * haystack.size()));
+    state.counters["matches"] = static_cast<double>(matches);
+}
+
+void register_matchers() {
+    const std::string& needle = corpus_spec.needle;
+    struct Case {
+        const char* name;
+        std::unique_ptr<mb::IMatcher> matcher;
+        size_t size;
+    };
+    std::vector<Case> cases{};
+    cases.push_back({"substring", std::make_unique<mb::SubstringMatcher>(needle), kTextSize});
+    cases.push_back({"substring_ignore_case", std::make_unique<mb::SubstringMatcher>(needle, true), kTextSize});
+    cases.push_back({"multi_substring",
+                     std::make_unique<mb::MultiSubstringMatcher>(
+                         std::vector<std::string>{needle, "fatal error", "panic:", "segfault at"}),
+                     kTextSize});
+    cases.push_back({"regex_literal", std::make_unique<mb::RegexMatcher>(needle + "|fatal [a-z]+"), kTextSize});
+    cases.push_back({"regex_without_literal", std::make_unique<mb::RegexMatcher>("[a-z]+=[0-9]{3}x"), kTextSize});
+    cases.push_back({"regex_ignore_case", std::make_unique<mb::RegexMatcher>("status=5\\d\\d", true), kTextSize});
+    cases.push_back({"regex_backreference", std::make_unique<mb::RegexMatcher>("(cache) miss \\1"), kSlowTextSize});
+    for (auto& [name, matcher, size] : cases) {
+        benchmark::RegisterBenchmark(
+            (std::string{"BM_Matcher/"} + name).c_str(),
+            [matcher = std::shared_ptr<mb::IMatcher>{std::move(matcher)}, size = size](benchmark::State& state) {
+                matcher_benchmark(state, *matcher, size);
+            });
+    }
+}
+
+void BM_ThreadPoolSubmit(benchmark::State& state) {
+    mb::ThreadPool pool{mb::get_threads_number(mb::Workload::Compute)};
+    const auto tasks = static_cast<size_t>(state.range(0));
+    std::atomic<size_t> done{0};
+    for (auto _ : state) {
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        pool.wait();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tasks));
+}
+BENCHMARK(BM_ThreadPoolSubmit)->Arg(1)->Arg(1000)->Arg(100000)->UseRealTime();
+
+void BM_ThreadPoolFanOut(benchmark::State& state) {
+    mb::ThreadPool pool{mb::get_threads_number(mb::Workload::Compute)};
+    const auto tasks = static_cast<size_t>(state.range(0));
+    std::atomic<size_t> done{0};
+    for (auto _ : state) {
+        // Submitted from a task, so every task goes to a worker's own deque and is stolen from there.
+        pool.submit([&pool, &done, tasks] {
+            for (size_t i = 0; i < tasks; ++i) {
+                pool.submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+        pool.wait();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tasks));
+}
+BENCHMARK(BM_ThreadPoolFanOut)->Arg(1000)->Arg(100000)->UseRealTime();
+
+void BM_DetectEncoding(benchmark::State& state) {
+    std::string head = text(kSlowTextSize).substr(0, 4096);
+    if (state.range(0) != 0) {
+        head[300] = '\0'; // Binary
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mb::detect_encoding(head));
+    }
+}
+BENCHMARK(BM_DetectEncoding)->Arg(0)->Arg(1);
+
+/**
+ * @brief Runs the mb_grep executable over the corpus, its output discarded.
+ */
+void search_benchmark(benchmark::State& state, const std::string& arguments) {
+#ifdef _WIN32
+    constexpr std::string_view discard = " > NUL";
+#else
+    constexpr std::string_view discard = " > /dev/null";
+#endif
+    const std::string command = std::string{MB_GREP_BINARY} + " " + corpus_spec.needle + " \"" +
+                                corpus_root.string() + "\" " + arguments + std::string{discard};
+    for (auto _ : state) {
+        // --quiet exits with 1 when nothing matches, which is no failure.
+        if (std::system(command.c_str()) != 0 && arguments != "--quiet") {
+            state.SkipWithError("mb_grep failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * corpus_bytes));
+}
+
+void register_searches() {
+    const std::pair<const char*, std::string> cases[] = {
+        {"default", ""},          {"ignore_case", "--ignore-case"}, {"regex", "--regex"},
+        {"sorted", "--sort-files"}, {"count", "--count"},           {"quiet", "--quiet"},
+    };
+    for (const auto& [name, arguments] : cases) {
+        benchmark::RegisterBenchmark((std::string{"BM_Search/"} + name).c_str(),
+                                     [arguments = arguments](benchmark::State& state) {
+                                         search_benchmark(state, arguments);
+                                     })
+            ->UseRealTime()
+            ->Unit(benchmark::kMillisecond);
+    }
+}
+
+/**
+ * @brief Takes the corpus options out of the arguments, leaving the ones for the library.
+ *
+ * @return The directory to only generate a corpus into, if requested.
+ */
+std::optional<fs::path> parse_corpus_options(int& argc, char* argv[]) {
+    std::optional<fs::path> generate_only{};
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const auto value = [&arg](const std::string_view flag) -> std::optional<std::string> {
+            if (!arg.starts_with(flag)) {
+                return std::nullopt;
+            }
+            return std::string{arg.substr(flag.size())};
+        };
+        if (auto files = value("--corpus_files=")) {
+            corpus_spec.files = std::stoull(*files);
+        } else if (auto size = value("--corpus_mean_size=")) {
+            corpus_spec.mean_size = std::stoull(*size);
+        } else if (auto sizes = value("--corpus_sizes=")) {
+            if (*sizes == "fixed") {
+                corpus_spec.sizes = mb::CorpusSpec::Sizes::Fixed;
+            } else if (*sizes == "uniform") {
+                corpus_spec.sizes = mb::CorpusSpec::Sizes::Uniform;
+            } else if (*sizes == "lognormal") {
+                corpus_spec.sizes = mb::CorpusSpec::Sizes::LogNormal;
+            } else {
+                throw std::invalid_argument("--corpus_sizes must be fixed, uniform or lognormal");
+            }
+        } else if (auto hit_files = value("--corpus_hit_files=")) {
+            corpus_spec.hit_files = std::stod(*hit_files);
+        } else if (auto hit_lines = value("--corpus_hit_lines=")) {
+            corpus_spec.hit_lines = std::stod(*hit_lines);
+        } else if (auto seed = value("--corpus_seed=")) {
+            corpus_spec.seed = std::stoull(*seed);
+        } else if (auto directory = value("--generate_corpus=")) {
+            generate_only = *directory;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    return generate_only;
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        if (const auto directory = parse_corpus_options(argc, argv)) {
+            const size_t bytes = mb::generate_corpus(*directory, corpus_spec);
+            std::cout << "Generated " << corpus_spec.files << " files (" << bytes << " bytes) in " << *directory
+                      << std::endl;
+            return 0;
+        }
+        benchmark::Initialize(&argc, argv);
+        if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+            return 1;
+        }
+        corpus_root = fs::temp_directory_path() / ("mb_grep_bench_" + std::to_string(corpus_spec.seed) + "_" +
+                                                   std::to_string(std::random_device{}()));
+        corpus_bytes = mb::generate_corpus(corpus_root, corpus_spec);
+        register_matchers();
+        register_searches();
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::Shutdown();
+        fs::remove_all(corpus_root);
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        if (!corpus_root.empty()) {
+            fs::remove_all(corpus_root);
+        }
+        return 1;
+    }
+    return 0;
+}
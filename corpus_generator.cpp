@@ -0,0 +1,86 @@
+#include "corpus_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace mb {
+namespace {
+constexpr std::array<std::string_view, 16> kWords{
+    "INFO", "WARN", "request", "served", "in", "ms", "user_id=42", "session", "cache", "miss",
+    "GET", "/api/v1/items", "status=200", "latency", "worker", "shutdown",
+};
+constexpr size_t kMaxLineWords = 12;
+
+size_t file_size(const CorpusSpec& spec, std::mt19937_64& random) {
+    const auto mean = static_cast<double>(spec.mean_size);
+    switch (spec.sizes) {
+    case CorpusSpec::Sizes::Fixed:
+        return spec.mean_size;
+    case CorpusSpec::Sizes::Uniform:
+        return static_cast<size_t>(std::uniform_real_distribution<double>{0.0, 2.0 * mean}(random));
+    case CorpusSpec::Sizes::LogNormal: {
+        constexpr double sigma = 1.0;
+        // The mean of a log-normal distribution is exp(mu + sigma^2 / 2).
+        const double mu = std::log(std::max(mean, 1.0)) - sigma * sigma / 2.0;
+        return static_cast<size_t>(std::lognormal_distribution<double>{mu, sigma}(random));
+    }
+    }
+    return spec.mean_size;
+}
+} // namespace
+
+std::string generate_text(const size_t size, const double hit_lines, const std::string_view needle,
+                          std::mt19937_64& random) {
+    std::uniform_int_distribution<size_t> word{0, kWords.size() - 1};
+    std::uniform_int_distribution<size_t> words_per_line{1, kMaxLineWords};
+    std::bernoulli_distribution hit{std::clamp(hit_lines, 0.0, 1.0)};
+    std::string text{};
+    text.reserve(size + 128);
+    while (text.size() < size) {
+        const size_t words = words_per_line(random);
+        const size_t needle_at = hit(random) ? std::uniform_int_distribution<size_t>{0, words}(random) : words + 1;
+        for (size_t i = 0; i <= words; ++i) {
+            if (i == needle_at) {
+                text += needle;
+                text += ' ';
+            }
+            if (i < words) {
+                text += kWords[word(random)];
+                text += ' ';
+            }
+        }
+        text.back() = '\n';
+    }
+    text.resize(size);
+    return text;
+}
+
+size_t generate_corpus(const fs::path& root, const CorpusSpec& spec) {
+    if (fs::exists(root) && !fs::is_empty(root)) {
+        throw std::runtime_error("corpus directory " + root.string() + " is not empty");
+    }
+    fs::create_directories(root);
+    std::mt19937_64 random{spec.seed};
+    std::bernoulli_distribution hit_file{std::clamp(spec.hit_files, 0.0, 1.0)};
+    const size_t per_directory = std::max<size_t>(1, spec.files_per_directory);
+    size_t total = 0;
+    for (size_t i = 0; i < spec.files; ++i) {
+        const fs::path directory = root / ('d' + std::to_string(i / per_directory));
+        if (i % per_directory == 0) {
+            fs::create_directory(directory);
+        }
+        const size_t size = file_size(spec, random);
+        const std::string text = generate_text(size, hit_file(random) ? spec.hit_lines : 0.0, spec.needle, random);
+        std::ofstream file{directory / ('f' + std::to_string(i) + ".log"), std::ios::binary};
+        file.write(text.data(), static_cast<std::streamsize>(text.size()));
+        if (!file) {
+            throw std::runtime_error("cannot write corpus file in " + directory.string());
+        }
+        total += text.size();
+    }
+    return total;
+}
+} // namespace mb
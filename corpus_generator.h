@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @brief Describes a synthetic corpus for the benchmarks.
+ */
+struct CorpusSpec {
+    /**
+     * @brief How the file sizes are spread around mean_size.
+     */
+    enum class Sizes {
+        Fixed,     ///< Every file has mean_size bytes
+        Uniform,   ///< Uniform between 0 and twice mean_size
+        LogNormal, ///< Log-normal with mean mean_size: many small files and a long tail of large ones
+    };
+
+    size_t files = 1000;                    ///< Number of files
+    size_t files_per_directory = 100;       ///< Files per directory before another one is started
+    size_t mean_size = size_t{16} << 10;    ///< Mean file size in bytes
+    Sizes sizes = Sizes::LogNormal;         ///< Distribution of the file sizes
+    double hit_files = 0.1;                 ///< Fraction of the files containing the needle at all
+    double hit_lines = 0.01;                ///< Fraction of the lines containing it in those files
+    std::string needle = "mb_grep_needle";  ///< The string the benchmarks search for
+    uint64_t seed = 42;                     ///< Same seed, same corpus
+};
+
+/**
+ * @brief Generates log-like text with the needle on a given fraction of the lines.
+ *
+ * The lines are made of words from a fixed vocabulary, none of which contains the needle.
+ *
+ * @param size Size of the text in bytes; the last line is cut off there.
+ * @param hit_lines Fraction of the lines containing the needle.
+ * @param needle The string planted in the lines.
+ * @param random The source of randomness.
+ * @return The text.
+ */
+std::string generate_text(size_t size, double hit_lines, std::string_view needle, std::mt19937_64& random);
+
+/**
+ * @brief Writes a corpus into a new directory.
+ *
+ * The files are spread over numbered subdirectories, files_per_directory each.
+ *
+ * @param root The directory to write to; created if it does not exist.
+ * @param spec The corpus to write.
+ * @return Total size of the files in bytes.
+ * @throws std::runtime_error If the directory exists and is not empty.
+ * @throws fs::filesystem_error If the directory cannot be written.
+ */
+size_t generate_corpus(const fs::path& root, const CorpusSpec& spec);
+} // namespace mb
@@ -0,0 +1,444 @@
+#include "decompressor.h"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifdef MB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MB_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace mb {
+namespace {
+constexpr std::string_view kGzipMagic{"\x1f\x8b", 2};
+constexpr std::string_view kZstdMagic{"\x28\xb5\x2f\xfd", 4};
+constexpr std::string_view kLz4Magic{"\x04\x22\x4d\x18", 4};
+
+#ifdef MB_HAVE_ZLIB
+/**
+ * @brief Inflates gzip data, member after member.
+ */
+class GzipDecompressor final : public Decompressor {
+public:
+    GzipDecompressor(const std::string_view input, FileReader* reader) : Decompressor{input, reader} {
+        ready_ = inflateInit2(&stream_, 15 + 16) == Z_OK; // 15 window bits, gzip header expected
+    }
+
+    ~GzipDecompressor() override {
+        if (ready_) {
+            inflateEnd(&stream_);
+        }
+    }
+
+protected:
+    bool decompress(std::string_view& block) override {
+        stream_.next_out = reinterpret_cast<Bytef*>(block_.data());
+        stream_.avail_out = static_cast<uInt>(block_.size());
+        while (ready_ && stream_.avail_out != 0) {
+            // Without input left, inflating still flushes what is pending.
+            if (std::string_view input{}; stream_.avail_in == 0 && next_input(input, UINT_MAX)) {
+                stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+                stream_.avail_in = static_cast<uInt>(input.size());
+            }
+            const int result = inflate(&stream_, Z_NO_FLUSH);
+            if (result == Z_BUF_ERROR) {
+                break; // No progress possible: the input ended
+            }
+            if (result == Z_STREAM_END) {
+                // Concatenated members form one stream, as gzip -d treats them.
+                ready_ = (stream_.avail_in != 0 || input_left()) && inflateReset(&stream_) == Z_OK;
+                if (!ready_) {
+                    inflateEnd(&stream_);
+                }
+            } else if (result != Z_OK) {
+                inflateEnd(&stream_);
+                ready_ = false;
+            }
+        }
+        block = {block_.data(), block_.size() - stream_.avail_out};
+        return !block.empty();
+    }
+
+private:
+    z_stream stream_{};
+    bool ready_ = false;
+    std::string block_ = std::string(kBlockSize, '\0');
+};
+#endif
+
+#ifdef MB_HAVE_ZSTD
+/**
+ * @brief The frames of one input view, decompressed on the pool in order.
+ *
+ * Works like the parallel search of large files: the thread reading the file takes the
+ * frames in order and decompresses frames itself while it waits, helper tasks claim frames
+ * a window ahead of it, and the helpers share ownership since they may start late.
+ */
+class FrameBatch final : public std::enable_shared_from_this<FrameBatch> {
+public:
+    static constexpr size_t kMaxFrameSize = size_t{64} << 20;     ///< Larger frames are streamed
+    static constexpr size_t kMaxBatchMemory = size_t{256} << 20; ///< Bounds the frames decompressed ahead
+
+    /**
+     * @brief Splits an input view into frames if it consists of frames of known, bounded size.
+     * @return The batch, or nullptr if the view has to be streamed.
+     */
+    static std::shared_ptr<FrameBatch> plan(const std::string_view input, ThreadPool& pool) {
+        if (pool.size() < 2) {
+            return nullptr;
+        }
+        std::vector<Frame> frames{};
+        size_t largest = 1;
+        for (size_t offset = 0; offset < input.size();) {
+            const std::string_view rest = input.substr(offset);
+            const size_t compressed = ZSTD_findFrameCompressedSize(rest.data(), rest.size());
+            const unsigned long long size = ZSTD_getFrameContentSize(rest.data(), rest.size());
+            if (ZSTD_isError(compressed) || size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR ||
+                size > kMaxFrameSize) {
+                return nullptr;
+            }
+            frames.push_back(Frame{rest.substr(0, compressed), static_cast<size_t>(size)});
+            largest = std::max(largest, static_cast<size_t>(size));
+            offset += compressed;
+        }
+        if (frames.size() < 2) {
+            return nullptr;
+        }
+        const size_t window = std::clamp(kMaxBatchMemory / largest, size_t{2}, 2 * pool.size());
+        return std::make_shared<FrameBatch>(std::move(frames), pool, window);
+    }
+
+    struct Frame {
+        std::string_view compressed;
+        size_t size;
+        std::string contents{};
+        bool done = false;
+    };
+
+    FrameBatch(std::vector<Frame> frames, ThreadPool& pool, const size_t window)
+        : pool_{pool}, window_{window}, frames_{std::move(frames)} {}
+
+    /**
+     * @brief Hands out the contents of a frame, waiting for it if necessary.
+     *
+     * Frees the frame before it, whose contents are no longer needed.
+     *
+     * @return false after the last frame or if the frame is corrupt.
+     */
+    bool take(const size_t index, std::string_view& block) {
+        if (index > 0) {
+            frames_[index - 1].contents = {};
+        }
+        if (index == frames_.size()) {
+            return false;
+        }
+        wait_for(index);
+        Frame& frame = frames_[index];
+        if (frame.contents.size() != frame.size) {
+            return false;
+        }
+        block = frame.contents;
+        return true;
+    }
+
+    size_t size() const { return frames_.size(); }
+
+    /**
+     * @brief Stops claiming frames and waits for the ones being decompressed.
+     */
+    void finish() {
+        std::unique_lock lock{mutex_};
+        limit_ = next_;
+        decompressed_.wait(lock, [this] {
+            return std::all_of(frames_.begin(), frames_.begin() + static_cast<ptrdiff_t>(next_),
+                               [](const Frame& frame) { return frame.done; });
+        });
+    }
+
+private:
+    void wait_for(const size_t index) {
+        std::unique_lock lock{mutex_};
+        limit_ = std::min(index + window_, frames_.size());
+        const size_t wanted = std::min(pool_.size() - 1, limit_ - next_);
+        const size_t added = wanted > helpers_ ? wanted - helpers_ : 0;
+        helpers_ += added;
+        lock.unlock();
+        for (size_t i = 0; i < added; ++i) {
+            pool_.submit([batch = shared_from_this()] {
+                std::unique_lock helper_lock{batch->mutex_};
+                while (batch->decompress_next(helper_lock)) {
+                }
+                --batch->helpers_;
+            });
+        }
+        lock.lock();
+        while (!frames_[index].done) {
+            if (!decompress_next(lock)) {
+                decompressed_.wait(lock);
+            }
+        }
+    }
+
+    bool decompress_next(std::unique_lock<std::mutex>& lock) {
+        if (next_ >= limit_) {
+            return false;
+        }
+        Frame& frame = frames_[next_++];
+        lock.unlock();
+        frame.contents.resize(frame.size);
+        const size_t size =
+            ZSTD_decompress(frame.contents.data(), frame.size, frame.compressed.data(), frame.compressed.size());
+        if (ZSTD_isError(size) || size != frame.size) {
+            frame.contents = {}; // take() reports the frame as corrupt
+        }
+        lock.lock();
+        frame.done = true;
+        decompressed_.notify_all();
+        return true;
+    }
+
+    ThreadPool& pool_;
+    const size_t window_; ///< Frames that may be decompressed ahead of the one taken next
+    std::vector<Frame> frames_;
+
+    std::mutex mutex_;
+    std::condition_variable decompressed_;
+    size_t next_ = 0;    ///< The frame claimed next
+    size_t limit_ = 0;   ///< Frames from here on may not be claimed yet
+    size_t helpers_ = 0; ///< Helper tasks submitted and not finished
+};
+
+/**
+ * @brief Decompresses Zstandard data, in parallel where it is split into frames.
+ */
+class ZstdDecompressor final : public Decompressor {
+public:
+    ZstdDecompressor(const std::string_view input, FileReader* reader, ThreadPool& pool)
+        : Decompressor{input, reader}, pool_{pool}, context_{ZSTD_createDCtx()} {}
+
+    ~ZstdDecompressor() override {
+        if (batch_ != nullptr) {
+            batch_->finish();
+        }
+        ZSTD_freeDCtx(context_);
+    }
+
+protected:
+    bool decompress(std::string_view& block) override {
+        while (context_ != nullptr && !failed_) {
+            if (batch_ != nullptr) {
+                if (batch_->take(next_frame_, block)) {
+                    ++next_frame_;
+                    return true;
+                }
+                failed_ = next_frame_ != batch_->size();
+                batch_->finish();
+                batch_ = nullptr;
+                continue;
+            }
+            if (input_.pos == input_.size) {
+                std::string_view input{};
+                if (next_input(input, SIZE_MAX)) {
+                    if (at_frame_start_ && (batch_ = FrameBatch::plan(input, pool_)) != nullptr) {
+                        next_frame_ = 0;
+                        continue;
+                    }
+                    input_ = {input.data(), input.size(), 0};
+                } else if (at_frame_start_) {
+                    return false;
+                }
+            }
+            // Without input left, decompressing still flushes what is pending.
+            ZSTD_outBuffer output{block_.data(), block_.size(), 0};
+            const size_t consumed = input_.pos;
+            while (output.pos < output.size) {
+                const size_t output_before = output.pos;
+                const size_t input_before = input_.pos;
+                const size_t hint = ZSTD_decompressStream(context_, &output, &input_);
+                if (ZSTD_isError(hint)) {
+                    failed_ = true;
+                    break;
+                }
+                at_frame_start_ = hint == 0;
+                if (output.pos == output_before && input_.pos == input_before) {
+                    break;
+                }
+            }
+            if (output.pos != 0) {
+                block = {block_.data(), output.pos};
+                return true;
+            }
+            if (input_.pos == consumed) {
+                return false; // The input ended inside a frame
+            }
+        }
+        return false;
+    }
+
+private:
+    ThreadPool& pool_;
+    ZSTD_DCtx* context_;
+    ZSTD_inBuffer input_{};
+    bool at_frame_start_ = true; ///< No frame is partly decompressed
+    bool failed_ = false;
+    std::shared_ptr<FrameBatch> batch_{};
+    size_t next_frame_ = 0;
+    std::string block_ = std::string(kBlockSize, '\0');
+};
+#endif
+
+#ifdef MB_HAVE_LZ4
+/**
+ * @brief Decompresses LZ4 frames.
+ */
+class Lz4Decompressor final : public Decompressor {
+public:
+    Lz4Decompressor(const std::string_view input, FileReader* reader) : Decompressor{input, reader} {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&context_, LZ4F_VERSION))) {
+            context_ = nullptr;
+        }
+    }
+
+    ~Lz4Decompressor() override { LZ4F_freeDecompressionContext(context_); }
+
+protected:
+    bool decompress(std::string_view& block) override {
+        size_t produced = 0;
+        while (context_ != nullptr && !failed_ && produced < block_.size()) {
+            if (input_.empty()) {
+                next_input(input_, SIZE_MAX); // Without input left, decompressing still flushes
+            }
+            size_t output_size = block_.size() - produced;
+            size_t input_size = input_.size();
+            const size_t hint =
+                LZ4F_decompress(context_, block_.data() + produced, &output_size, input_.data(), &input_size, nullptr);
+            failed_ = LZ4F_isError(hint);
+            input_.remove_prefix(input_size);
+            produced += output_size;
+            if (output_size == 0 && input_size == 0) {
+                break;
+            }
+        }
+        block = {block_.data(), produced};
+        return produced != 0;
+    }
+
+private:
+    LZ4F_dctx* context_ = nullptr;
+    std::string_view input_{};
+    bool failed_ = false;
+    std::string block_ = std::string(kBlockSize, '\0');
+};
+#endif
+} // namespace
+
+Compression detect_compression(const std::string_view head) {
+    if (head.starts_with(kGzipMagic)) {
+        return Compression::Gzip;
+    }
+    if (head.starts_with(kZstdMagic)) {
+        return Compression::Zstd;
+    }
+    if (head.starts_with(kLz4Magic)) {
+        return Compression::Lz4;
+    }
+    return Compression::None;
+}
+
+std::unique_ptr<Decompressor> Decompressor::create(const Compression compression,
+                                                   [[maybe_unused]] const std::string_view input,
+                                                   [[maybe_unused]] FileReader* reader,
+                                                   [[maybe_unused]] ThreadPool& pool) {
+    switch (compression) {
+#ifdef MB_HAVE_ZLIB
+    case Compression::Gzip:
+        return std::make_unique<GzipDecompressor>(input, reader);
+#endif
+#ifdef MB_HAVE_ZSTD
+    case Compression::Zstd:
+        return std::make_unique<ZstdDecompressor>(input, reader, pool);
+#endif
+#ifdef MB_HAVE_LZ4
+    case Compression::Lz4:
+        return std::make_unique<Lz4Decompressor>(input, reader);
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+bool Decompressor::next(std::string_view& chunk) {
+    const auto hand_out = [this, &chunk](const std::string_view lines) {
+        chunk = lines;
+        if (!started_) {
+            started_ = true;
+            head_ = lines;
+        }
+        return true;
+    };
+    head_ = {};
+    if (!rest_.empty()) {
+        chunk = std::exchange(rest_, {});
+        return true;
+    }
+    while (!finished_) {
+        std::string_view block{};
+        if (!decompress(block)) {
+            finished_ = true;
+            break;
+        }
+        const size_t last_break = block.rfind('\n');
+        if (last_break == std::string_view::npos) {
+            carry_ += block;
+            continue;
+        }
+        std::string_view lines = block.substr(0, last_break + 1);
+        if (!carry_.empty()) {
+            // The line started in an earlier block is handed out first, the rest of the block
+            // by the next call.
+            const size_t first_end = lines.find('\n') + 1;
+            joined_.swap(carry_);
+            joined_.append(lines.substr(0, first_end));
+            rest_ = lines.substr(first_end);
+            lines = joined_;
+        }
+        carry_.assign(block.substr(last_break + 1));
+        return hand_out(lines);
+    }
+    if (carry_.empty()) {
+        return false;
+    }
+    joined_.swap(carry_);
+    carry_.clear();
+    return hand_out(joined_);
+}
+
+bool Decompressor::next_input(std::string_view& input, const size_t max_size) {
+    if (!input_left()) {
+        return false;
+    }
+    input = input_.substr(0, max_size);
+    input_.remove_prefix(input.size());
+    return true;
+}
+
+bool Decompressor::input_left() {
+    while (input_.empty()) {
+        if (reader_ == nullptr || !reader_->next(input_)) {
+            reader_ = nullptr;
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace mb
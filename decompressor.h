@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "file_reader.h"
+#include "thread_pool.h"
+
+namespace mb {
+/**
+ * @brief Compression format of a file.
+ */
+enum class Compression {
+    None, ///< Not compressed, or in a format that is not recognised
+    Gzip, ///< gzip, possibly several members concatenated
+    Zstd, ///< Zstandard, possibly several frames concatenated
+    Lz4,  ///< LZ4 frame format
+};
+
+/**
+ * @brief Determines the compression format of a file from its magic bytes.
+ *
+ * @param head The first bytes of the file.
+ * @return The format, or Compression::None.
+ */
+Compression detect_compression(std::string_view head);
+
+/**
+ * @class Decompressor
+ * @brief Streams the decompressed contents of a file as a sequence of chunks of whole lines.
+ *
+ * Hands out chunks the way FileReader does, so the search consumes both alike. The data is
+ * decompressed into blocks of kBlockSize bytes which are searched where they are; only a
+ * line straddling two blocks is copied to join its parts. Nothing is written to disk, and
+ * memory stays bounded however large the decompressed file is.
+ *
+ * Zstandard files made of several frames with known sizes, as written by `zstd -T0` or
+ * pzstd, are decompressed frame by frame on the pool, a few frames ahead of the search.
+ *
+ * Support for each format depends on the libraries found at build time; create() returns
+ * nullptr for the others.
+ */
+class Decompressor {
+public:
+    static constexpr size_t kBlockSize = size_t{1} << 20;
+
+    /**
+     * @brief Creates a decompressor for a file.
+     *
+     * @param compression Format of the file.
+     * @param input The first part of the compressed file.
+     * @param reader Supplies the rest of the file, or nullptr if the input is all of it.
+     * @param pool Runs the parallel decompression of Zstandard frames.
+     * @return The decompressor, or nullptr if the format is not supported by this build.
+     */
+    static std::unique_ptr<Decompressor> create(Compression compression, std::string_view input, FileReader* reader,
+                                                ThreadPool& pool);
+
+    virtual ~Decompressor() = default;
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    /**
+     * @brief Fetches the next chunk of decompressed lines.
+     *
+     * The returned view stays valid until the next call or until the decompressor is
+     * destroyed. Decompression stops at the first corrupt byte.
+     *
+     * @param chunk Receives the chunk.
+     * @return false when the whole file has been consumed.
+     */
+    bool next(std::string_view& chunk);
+    /**
+     * @brief Returns the first bytes of the decompressed file, for sniffing its type.
+     *
+     * Holds the first chunk after the first call of next(), and is empty at any other time.
+     */
+    std::string_view head() const { return head_; }
+
+protected:
+    Decompressor(std::string_view input, FileReader* reader) : input_{input}, reader_{reader} {}
+
+    /**
+     * @brief Decompresses the next block.
+     *
+     * @param block Receives the block, valid until the next call.
+     * @return false at the end of the data or on an error.
+     */
+    virtual bool decompress(std::string_view& block) = 0;
+
+    /**
+     * @brief Takes up to max_size bytes of compressed input.
+     * @return false once the file is consumed.
+     */
+    bool next_input(std::string_view& input, size_t max_size);
+    /**
+     * @brief Checks whether compressed input is left, without taking any.
+     */
+    bool input_left();
+
+private:
+    std::string_view input_;
+    FileReader* reader_;
+    bool finished_ = false;
+    bool started_ = false;
+    std::string_view head_{};
+    std::string_view rest_{}; ///< Lines of the current block handed out by the next call
+    std::string carry_{};     ///< Start of a line that continues in the next block
+    std::string joined_{};    ///< A line put together from two blocks, being handed out
+};
+} // namespace mb
@@ -0,0 +1,376 @@
+#include "dir_walker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "file_path.h"
+#include "path_filter.h"
+#include "stats.h"
+
+#if defined(__linux__)
+#define MB_HAVE_GETDENTS 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+namespace {
+/**
+ * @brief State shared by all directory tasks of one walk.
+ */
+struct Walk {
+    ThreadPool& pool;
+    const FileCallback& on_file;
+    const PathFilter* filter;
+    std::atomic<int> held{0}; ///< Descriptors opened by a parent for a directory task not finished yet
+};
+
+/**
+ * @brief Where a directory is in the tree, as far as the filter is concerned.
+ */
+struct Location {
+    std::string relative{};                                ///< Path relative to the root; empty for the root
+    std::shared_ptr<const PathFilter::Directory> rules{}; ///< The ignore rules in effect in its parent
+};
+
+/**
+ * @brief Checks the entries of one directory against the filter of the walk, if any.
+ *
+ * The relative path of every entry is built in a buffer reused across the entries, so only
+ * the subdirectories that are walked cost an allocation.
+ */
+class DirectoryFilter final {
+public:
+    /**
+     * @brief Reads the ignore files of the directory.
+     */
+    DirectoryFilter(const Walk& walk, const fs::path& path, const Location& location) : filter_(walk.filter) {
+        if (filter_ != nullptr) {
+            rules_ = filter_->enter(location.rules, path, location.relative);
+            relative_ = location.relative;
+            if (!relative_.empty()) {
+                relative_ += '/';
+            }
+            base_ = relative_.size();
+        }
+    }
+
+    bool accepts(const std::string_view name, const bool is_directory) {
+        if (filter_ == nullptr) {
+            return true;
+        }
+        relative_.resize(base_);
+        relative_ += name;
+        return filter_->accepts(rules_.get(), relative_, name, is_directory);
+    }
+
+    /**
+     * @brief Returns the location of a subdirectory.
+     */
+    Location child(const std::string_view name) const {
+        if (filter_ == nullptr) {
+            return {};
+        }
+        std::string relative{std::string_view{relative_}.substr(0, base_)};
+        relative += name;
+        return {std::move(relative), rules_};
+    }
+
+private:
+    const PathFilter* filter_;
+    std::shared_ptr<const PathFilter::Directory> rules_{};
+    std::string relative_{}; ///< The directory's relative path and a slash, then the last entry's name
+    size_t base_ = 0;        ///< Length of the directory's part
+};
+
+/**
+ * @brief Reports the files of one directory, keeping their names together with its path.
+ */
+class FileReporter final {
+public:
+    FileReporter(const Walk& walk, const fs::path& path) : walk_(walk), path_(path) {}
+
+    void report(const std::string_view name) {
+        if (directory_ == nullptr) {
+            directory_ = std::make_shared<FilePath::Directory>(path_);
+        }
+        walk_.on_file(FilePath{directory_, directory_->store(name)});
+    }
+
+private:
+    const Walk& walk_;
+    const fs::path& path_;
+    std::shared_ptr<FilePath::Directory> directory_{}; ///< Created along with the first file
+};
+
+#ifdef MB_HAVE_GETDENTS
+constexpr size_t kDirentBufferSize = size_t{32} << 10;
+constexpr int kMaxHeldDescriptors = 256; ///< Beyond this, queued directories are reopened by path
+constexpr int kDirectoryFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+/**
+ * @brief Record layout returned by getdents64(), which glibc does not declare.
+ */
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+/**
+ * @brief Calls `on_entry(name, type)` for every entry of an open directory but "." and "..".
+ *
+ * The type is DT_REG, DT_DIR or something else. Symlinks count as what they point to, but
+ * only files are followed.
+ */
+template <typename F>
+void for_each_entry(const int fd, F&& on_entry) {
+    alignas(LinuxDirent64) char buffer[kDirentBufferSize];
+    for (;;) {
+        const long size = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            break;
+        }
+        for (long offset = 0; offset < size;) {
+            const auto* entry = reinterpret_cast<const LinuxDirent64*>(buffer + offset);
+            offset += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                // The file system does not fill in the type: lstat gives it, a symlink included.
+                struct stat info {};
+                if (::fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                if (S_ISLNK(info.st_mode)) {
+                    type = DT_LNK;
+                } else {
+                    type = S_ISREG(info.st_mode) ? DT_REG : (S_ISDIR(info.st_mode) ? DT_DIR : 0);
+                }
+            }
+            if (type == DT_LNK) {
+                struct stat info {};
+                if (::fstatat(fd, name, &info, 0) != 0) {
+                    continue;
+                }
+                type = S_ISREG(info.st_mode) ? DT_REG : 0;
+            }
+            on_entry(name, type);
+        }
+    }
+}
+
+/**
+ * @brief Lists one directory and submits a task for each of its subdirectories.
+ *
+ * @param walk The walk the directory belongs to.
+ * @param path Path of the directory, used to build the paths of its entries.
+ * @param fd The directory opened by the parent task, or -1 to open it by path.
+ * @param location Where the directory is in the tree.
+ */
+void walk_directory(Walk& walk, const fs::path& path, int fd, const Location& location) {
+    const Stats::Scope scope{Stats::Phase::Traversal};
+    const bool held = fd >= 0;
+    if (walk.pool.cancelled()) {
+        if (held) {
+            ::close(fd);
+            walk.held.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    if (!held) {
+        fd = ::open(path.c_str(), kDirectoryFlags);
+        if (fd < 0) {
+            return;
+        }
+    }
+    DirectoryFilter filter{walk, path, location};
+    FileReporter files{walk, path};
+    std::vector<std::tuple<fs::path, int, Location>> deferred{}; // Subdirectories walked by this task
+    for_each_entry(fd, [&walk, &path, &filter, &files, &deferred, fd](const char* name, const unsigned char type) {
+        if ((type != DT_REG && type != DT_DIR) || !filter.accepts(name, type == DT_DIR)) {
+            return;
+        }
+        if (type == DT_REG) {
+            files.report(name);
+        } else {
+            int child = -1;
+            if (walk.held.load(std::memory_order_relaxed) < kMaxHeldDescriptors) {
+                child = ::openat(fd, name, kDirectoryFlags | O_NOFOLLOW);
+                if (child >= 0) {
+                    walk.held.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (walk.pool.saturated()) {
+                deferred.emplace_back(path / name, child, filter.child(name));
+            } else {
+                walk.pool.submit([&walk, child_path = path / name, child, child_location = filter.child(name)] {
+                    walk_directory(walk, child_path, child, child_location);
+                });
+            }
+        }
+    });
+    ::close(fd);
+    if (held) {
+        walk.held.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // Walked only now, once the listing buffer is gone, so recursion costs little stack.
+    for (const auto& [child_path, child, child_location] : deferred) {
+        walk_directory(walk, child_path, child, child_location);
+    }
+}
+
+/**
+ * @brief Walks a directory depth-first with its entries in name order, closing the descriptor.
+ *
+ * @param walk The walk the directory belongs to.
+ * @param path Path of the directory, used to build the paths of its entries.
+ * @param fd The open directory.
+ * @param location Where the directory is in the tree.
+ */
+void walk_sorted(Walk& walk, const fs::path& path, const int fd, const Location& location) {
+    const Stats::Scope scope{Stats::Phase::Traversal};
+    DirectoryFilter filter{walk, path, location};
+    std::vector<std::pair<std::string, bool>> entries{}; // Name and whether it is a directory
+    for_each_entry(fd, [&entries, &filter](const char* name, const unsigned char type) {
+        if ((type == DT_REG || type == DT_DIR) && filter.accepts(name, type == DT_DIR)) {
+            entries.emplace_back(name, type == DT_DIR);
+        }
+    });
+    std::ranges::sort(entries);
+    FileReporter files{walk, path};
+    for (const auto& [name, directory] : entries) {
+        if (walk.pool.cancelled()) {
+            break;
+        }
+        if (!directory) {
+            files.report(name);
+        } else if (const int child = ::openat(fd, name.c_str(), kDirectoryFlags | O_NOFOLLOW); child >= 0) {
+            walk_sorted(walk, path / name, child, filter.child(name));
+        }
+    }
+    ::close(fd);
+}
+#else
+/**
+ * @brief Lists one directory and submits a task for each of its subdirectories.
+ *
+ * @param walk The walk the directory belongs to.
+ * @param path Path of the directory.
+ * @param location Where the directory is in the tree.
+ */
+void walk_directory(Walk& walk, const fs::path& path, const Location& location) {
+    const Stats::Scope scope{Stats::Phase::Traversal};
+    if (walk.pool.cancelled()) {
+        return;
+    }
+    DirectoryFilter filter{walk, path, location};
+    FileReporter files{walk, path};
+    std::vector<std::pair<fs::path, Location>> deferred{}; // Subdirectories walked by this task
+    std::error_code error{};
+    for (fs::directory_iterator it{path, error}, end{}; !error && it != end; it.increment(error)) {
+        const auto& entry = *it;
+        std::error_code status_error{};
+        const std::string name = entry.path().filename().string();
+        if (entry.is_regular_file(status_error)) {
+            if (filter.accepts(name, false)) {
+                files.report(name);
+            }
+        } else if (entry.is_directory(status_error) && !entry.is_symlink(status_error) && filter.accepts(name, true)) {
+            if (walk.pool.saturated()) {
+                deferred.emplace_back(entry.path(), filter.child(name));
+            } else {
+                walk.pool.submit([&walk, child_path = entry.path(), child_location = filter.child(name)] {
+                    walk_directory(walk, child_path, child_location);
+                });
+            }
+        }
+    }
+    for (const auto& [child_path, child_location] : deferred) {
+        walk_directory(walk, child_path, child_location);
+    }
+}
+
+/**
+ * @brief Walks a directory depth-first with its entries in name order.
+ *
+ * @param walk The walk the directory belongs to.
+ * @param path Path of the directory.
+ * @param location Where the directory is in the tree.
+ */
+void walk_sorted(Walk& walk, const fs::path& path, const Location& location) {
+    const Stats::Scope scope{Stats::Phase::Traversal};
+    DirectoryFilter filter{walk, path, location};
+    std::vector<std::pair<fs::path, bool>> entries{}; // Path and whether it is a directory
+    std::error_code error{};
+    for (fs::directory_iterator it{path, error}, end{}; !error && it != end; it.increment(error)) {
+        const auto& entry = *it;
+        std::error_code status_error{};
+        const std::string name = entry.path().filename().string();
+        if (entry.is_regular_file(status_error)) {
+            if (filter.accepts(name, false)) {
+                entries.emplace_back(entry.path(), false);
+            }
+        } else if (entry.is_directory(status_error) && !entry.is_symlink(status_error) && filter.accepts(name, true)) {
+            entries.emplace_back(entry.path(), true);
+        }
+    }
+    std::ranges::sort(entries);
+    FileReporter files{walk, path};
+    for (const auto& [entry_path, directory] : entries) {
+        if (walk.pool.cancelled()) {
+            break;
+        }
+        if (directory) {
+            walk_sorted(walk, entry_path, filter.child(entry_path.filename().string()));
+        } else {
+            files.report(entry_path.filename().string());
+        }
+    }
+}
+#endif
+} // namespace
+
+void walk_tree(const fs::path& root, ThreadPool& pool, const FileCallback& on_file, const WalkOrder order,
+               const PathFilter* filter) {
+    Walk walk{pool, on_file, filter};
+#ifdef MB_HAVE_GETDENTS
+    const int fd = ::open(root.c_str(), kDirectoryFlags);
+    if (fd < 0) {
+        throw fs::filesystem_error("recursive directory iterator cannot open directory", root,
+                                   std::error_code(errno, std::generic_category()));
+    }
+    if (order == WalkOrder::Path) {
+        walk_sorted(walk, root, fd, {});
+    } else {
+        walk.held.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([&walk, &root, fd] { walk_directory(walk, root, fd, {}); });
+    }
+#else
+    (void)fs::directory_iterator{root}; // Reports an unreadable root the way the iterator does
+    if (order == WalkOrder::Path) {
+        walk_sorted(walk, root, {});
+    } else {
+        pool.submit([&walk, &root] { walk_directory(walk, root, {}); });
+    }
+#endif
+    pool.wait();
+}
+} // namespace mb
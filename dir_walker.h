@@ -0,0 +1,64 @@
+#pragma once
+#include <filesystem>
+#include <functional>
+
+#include "file_path.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+class PathFilter;
+
+/**
+ * @brief Callback receiving every file found by walk_tree().
+ */
+using FileCallback = std::function<void(const FilePath&)>;
+
+/**
+ * @brief Order in which walk_tree() reports files.
+ */
+enum class WalkOrder {
+    Any,  ///< Whatever order the parallel traversal finds them in
+    Path, ///< Sorted by path, from a single thread
+};
+
+/**
+ * @brief Walks a directory tree in parallel on a thread pool.
+ *
+ * Every directory is a pool task that lists its entries and submits one task per
+ * subdirectory, so wide trees are traversed by all workers at once. On Linux a directory is
+ * read with getdents64() and subdirectories are opened with openat() relative to their
+ * parent, and the entry type reported by the kernel saves a stat() call per entry; other
+ * systems use std::filesystem::directory_iterator.
+ *
+ * While the pool is saturated, subdirectories are walked by the task that found them rather
+ * than queued.
+ *
+ * Like a default std::filesystem::recursive_directory_iterator, symlinks to files are
+ * reported but symlinks to directories are not followed. Subdirectories that cannot be read
+ * are skipped.
+ *
+ * The files of a directory share one FilePath::Directory holding its path and their names,
+ * so reporting a file does not allocate.
+ *
+ * With WalkOrder::Path the tree is instead walked depth-first on the calling thread, each
+ * directory's entries sorted by name, which yields the files in the order of their paths.
+ *
+ * Once the pool is cancelled, no further directories are listed.
+ *
+ * With a filter, every entry is checked before it is reported or listed, and directories the
+ * filter rejects are pruned with everything below them.
+ *
+ * @param root The directory to walk.
+ * @param pool The pool running the traversal.
+ * @param on_file Called for every regular file; from pool threads and concurrently, unless
+ *                the order is WalkOrder::Path.
+ * @param order The order the files are reported in.
+ * @param filter Decides which entries are walked, or null to walk them all.
+ * @throws fs::filesystem_error If the root is not a readable directory.
+ * @note Returns only after the traversal and all other tasks on the pool have finished.
+ */
+void walk_tree(const fs::path& root, ThreadPool& pool, const FileCallback& on_file, WalkOrder order = WalkOrder::Any,
+               const PathFilter* filter = nullptr);
+} // namespace mb
@@ -0,0 +1,43 @@
+#include "file_identity.h"
+
+#include <system_error>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace mb {
+bool file_identity(const char* path, FileIdentity& identity) {
+#ifndef _WIN32
+    struct stat st {};
+    if (::stat(path, &st) != 0) {
+        return false;
+    }
+#if defined(__APPLE__)
+    const auto& mtime = st.st_mtimespec;
+#else
+    const auto& mtime = st.st_mtim;
+#endif
+    identity = {static_cast<uint64_t>(st.st_size), int64_t{mtime.tv_sec} * 1000000000 + mtime.tv_nsec,
+                static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_dev)};
+    return true;
+#else
+    return file_identity(fs::path{path}, identity);
+#endif
+}
+
+bool file_identity(const fs::path& path, FileIdentity& identity) {
+#ifndef _WIN32
+    return file_identity(path.c_str(), identity);
+#else
+    std::error_code error{};
+    identity.size = fs::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    const auto time = fs::last_write_time(path, error);
+    identity.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return !error;
+#endif
+}
+} // namespace mb
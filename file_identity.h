@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @brief What tells whether a file has changed since it was last looked at.
+ */
+struct FileIdentity {
+    uint64_t size = 0;
+    int64_t mtime = 0;   ///< Nanoseconds since the epoch, std::filesystem::file_time_type ticks elsewhere
+    uint64_t inode = 0;  ///< 0 where there are no inode numbers
+    uint64_t device = 0; ///< 0 where there are no device numbers
+
+    bool operator==(const FileIdentity&) const = default;
+};
+
+/**
+ * @brief Reads the identity of a file, following symlinks.
+ * @return false if the file cannot be stat'ed.
+ */
+bool file_identity(const fs::path& path, FileIdentity& identity);
+/**
+ * @brief Reads the identity of a file without building a std::filesystem::path for it.
+ */
+bool file_identity(const char* path, FileIdentity& identity);
+inline bool file_identity(const std::string& path, FileIdentity& identity) {
+    return file_identity(path.c_str(), identity);
+}
+} // namespace mb
@@ -0,0 +1,40 @@
+#include "file_path.h"
+
+#include <cstring>
+#include <memory>
+
+namespace mb {
+FilePath::Directory::Directory(const fs::path& path) : prefix_((path / "-").string()) {
+    prefix_.pop_back(); // Whatever separator `/` put in front of a name stays
+}
+
+std::string_view FilePath::Directory::store(const std::string_view name) {
+    char* copy = nullptr;
+    if (name.size() > kBlockSize / 4) {
+        // A long name gets a block of its own rather than wasting the rest of the current one.
+        blocks_.push_back(std::make_unique_for_overwrite<char[]>(name.size()));
+        copy = blocks_.back().get();
+    } else {
+        if (block_ == nullptr || kBlockSize - used_ < name.size()) {
+            blocks_.push_back(std::make_unique_for_overwrite<char[]>(kBlockSize));
+            block_ = blocks_.back().get();
+            used_ = 0;
+        }
+        copy = block_ + used_;
+        used_ += name.size();
+    }
+    std::memcpy(copy, name.data(), name.size());
+    return {copy, name.size()};
+}
+
+void FilePath::assign_to(std::string& path) const {
+    path.assign(directory_->prefix_);
+    path.append(name_);
+}
+
+fs::path FilePath::path() const {
+    std::string path{};
+    assign_to(path);
+    return path;
+}
+} // namespace mb
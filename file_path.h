@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class FilePath
+ * @brief The path of a file as a directory shared with its neighbours and a name; cheap to copy.
+ *
+ * Building an fs::path for every file found and copying it into the task that searches the
+ * file costs several allocations per file. A FilePath instead points into a Directory that
+ * holds the path of the directory once and the names of its files in blocks, so copying one
+ * costs a reference count, and the full path is only spelled out into a string the searching
+ * thread reuses.
+ */
+class FilePath final {
+public:
+    /**
+     * @brief The path of a directory and the names stored for the files in it.
+     *
+     * Names are added by one thread. A stored name never moves, so other threads may read it
+     * while further names are added.
+     */
+    class Directory final {
+    public:
+        /**
+         * @param path Path of the directory; the paths of its files are built the way `path / name` is.
+         */
+        explicit Directory(const fs::path& path);
+
+        Directory(const Directory&) = delete;
+        Directory& operator=(const Directory&) = delete;
+
+        /**
+         * @brief Copies a name into the directory.
+         * @return The copy, valid as long as the directory.
+         */
+        std::string_view store(std::string_view name);
+
+    private:
+        friend class FilePath;
+
+        static constexpr size_t kBlockSize = 4096;
+
+        std::string prefix_;                            ///< Path of the directory and a separator if it needs one
+        std::vector<std::unique_ptr<char[]>> blocks_{}; ///< The names, in blocks of kBlockSize bytes or one long name
+        char* block_ = nullptr;                         ///< The last block of kBlockSize bytes
+        size_t used_ = 0;                               ///< Bytes taken of it
+    };
+
+    FilePath() = default;
+    /**
+     * @param directory The directory the name belongs to.
+     * @param name The path below the directory, stored in it or otherwise outliving it.
+     */
+    FilePath(std::shared_ptr<const Directory> directory, const std::string_view name)
+        : directory_(std::move(directory)), name_(name) {}
+
+    /**
+     * @brief Returns the path below the directory, which for files found by walk_tree() is their name.
+     */
+    std::string_view name() const { return name_; }
+    /**
+     * @brief Writes the full path into a string, replacing its contents.
+     *
+     * The string's storage is reused, so a thread that keeps one string only allocates while
+     * the paths it sees grow longer.
+     */
+    void assign_to(std::string& path) const;
+    /**
+     * @brief Returns the full path.
+     */
+    fs::path path() const;
+
+private:
+    std::shared_ptr<const Directory> directory_{};
+    std::string_view name_{};
+};
+} // namespace mb
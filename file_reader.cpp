@@ -0,0 +1,284 @@
+#include "file_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <utility>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define read _read
+#define close _close
+#define fstat _fstat64
+#define stat _stat64
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#else
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+
+namespace mb {
+namespace {
+constexpr size_t kPageSize = 4096;
+constexpr size_t kChunkSize = size_t{1} << 20;     ///< Read area used for pipes and unmappable files
+constexpr size_t kMinMappedSize = size_t{1} << 16; ///< Below this size a single read() beats mmap()
+constexpr size_t kMaxMappedSize = sizeof(void*) >= 8 ? size_t{1} << 36 : size_t{1} << 28;
+
+size_t round_up_to_page(const size_t size) { return (size + kPageSize - 1) / kPageSize * kPageSize; }
+
+constexpr size_t kMaxSpareSize = kChunkSize + kPageSize; ///< Larger buffers are freed rather than kept
+
+void free_aligned(char* ptr) {
+    if (ptr != nullptr) {
+        ::operator delete(ptr, std::align_val_t{kPageSize});
+    }
+}
+
+/**
+ * @brief The buffer of the last reader a thread destroyed, taken by its next reader that fits.
+ */
+struct SpareBuffer {
+    ~SpareBuffer() { free_aligned(storage); }
+
+    char* storage = nullptr;
+    size_t size = 0;
+};
+
+thread_local SpareBuffer spare_buffer{};
+
+/**
+ * @brief Returns a page-aligned buffer of at least a size, the thread's spare one if it is large enough.
+ * @param size The size wanted; receives the size of the buffer.
+ */
+char* allocate_aligned(size_t& size) {
+    if (spare_buffer.storage != nullptr && spare_buffer.size >= size) {
+        size = std::exchange(spare_buffer.size, 0);
+        return std::exchange(spare_buffer.storage, nullptr);
+    }
+    return static_cast<char*>(::operator new(size, std::align_val_t{kPageSize}));
+}
+
+/**
+ * @brief Keeps a buffer as the thread's spare one, unless it is too large or the spare is larger.
+ */
+void release_aligned(char* ptr, const size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (size <= kMaxSpareSize && size > spare_buffer.size) {
+        free_aligned(std::exchange(spare_buffer.storage, ptr));
+        spare_buffer.size = size;
+    } else {
+        free_aligned(ptr);
+    }
+}
+
+/**
+ * @brief Checks whether reading a stream would return data, or its end, without blocking.
+ */
+bool stream_ready(const int fd) {
+#ifdef _WIN32
+    (void)fd;
+    return false;
+#else
+    pollfd poll_fd{fd, POLLIN, 0};
+    return ::poll(&poll_fd, 1, 0) > 0;
+#endif
+}
+
+const char* find_last_newline(const char* begin, const size_t size) {
+#if defined(__GLIBC__)
+    return static_cast<const char*>(memrchr(begin, '\n', size));
+#else
+    for (const char* p = begin + size; p != begin;) {
+        if (*--p == '\n') {
+            return p;
+        }
+    }
+    return nullptr;
+#endif
+}
+} // namespace
+
+FileReader::FileReader(const fs::path& path) : FileReader(path.string().c_str()) {}
+
+FileReader::FileReader(const char* path) {
+    fd_ = ::open(path, O_RDONLY | O_BINARY);
+    if (fd_ >= 0) {
+        start();
+    }
+}
+
+FileReader::FileReader(const int fd) : fd_(fd), owns_fd_(false) {
+    if (fd_ >= 0) {
+        start();
+    }
+}
+
+void FileReader::start() {
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) {
+        return;
+    }
+    const bool regular = (st.st_mode & S_IFMT) == S_IFREG;
+    const auto size = static_cast<size_t>(st.st_size);
+    if (regular && size == 0) {
+        eof_ = true;
+        return;
+    }
+    if (regular && size >= kMinMappedSize && size <= kMaxMappedSize && map_file(size)) {
+        return;
+    }
+#ifdef F_SETPIPE_SZ
+    // A pipe as large as a chunk lets a fast writer run ahead while a chunk is searched.
+    if ((st.st_mode & S_IFMT) == S_IFIFO) {
+        ::fcntl(fd_, F_SETPIPE_SZ, static_cast<int>(kChunkSize));
+    }
+#endif
+    // A regular file is read with a single call when it fits into one chunk.
+    const size_t capacity = regular ? std::min(kChunkSize, round_up_to_page(size)) : kChunkSize;
+    remaining_ = regular ? size : SIZE_MAX;
+    stream_ = !regular;
+    reserve(0, capacity);
+}
+
+FileReader::~FileReader() {
+#ifndef _WIN32
+    if (mapping_ != nullptr) {
+        ::munmap(mapping_, mapping_size_);
+    }
+#endif
+    release_aligned(storage_, storage_size_);
+    if (fd_ >= 0 && owns_fd_) {
+        ::close(fd_);
+    }
+}
+
+bool FileReader::map_file(const size_t size) {
+#ifdef _WIN32
+    (void)size;
+    return false;
+#else
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+    mapping_ = mapping;
+    mapping_size_ = size;
+    return true;
+#endif
+}
+
+void FileReader::reserve(const size_t headroom, const size_t capacity) {
+    const size_t new_headroom = round_up_to_page(headroom);
+    size_t size = new_headroom + capacity;
+    char* storage = allocate_aligned(size);
+    if (carry_ != 0) {
+        std::memcpy(storage + new_headroom - carry_, pending_, carry_);
+    }
+    release_aligned(storage_, storage_size_);
+    storage_ = storage;
+    storage_size_ = size;
+    headroom_ = new_headroom;
+    capacity_ = capacity;
+}
+
+void FileReader::stage_carry() {
+    if (carry_ == 0) {
+        return;
+    }
+    if (carry_ > headroom_) {
+        reserve(std::max(carry_, 2 * headroom_), capacity_);
+    } else {
+        std::memmove(storage_ + headroom_ - carry_, pending_, carry_);
+    }
+    pending_ = storage_ + headroom_ - carry_;
+}
+
+bool FileReader::fill_buffer() {
+    filled_ = 0;
+    char* area = storage_ + headroom_;
+    while (!eof_ && filled_ < capacity_) {
+        const auto bytes = ::read(fd_, area + filled_, static_cast<unsigned>(capacity_ - filled_));
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            eof_ = true;
+            break;
+        }
+        filled_ += static_cast<size_t>(bytes);
+        Stats::add(Stats::Counter::BytesRead, static_cast<uint64_t>(bytes));
+        remaining_ -= std::min(remaining_, static_cast<size_t>(bytes));
+        eof_ = remaining_ == 0;
+        if (stream_ && !stream_ready(fd_)) {
+            break; // A stream with nothing more to read yet: hand out what came so far
+        }
+    }
+    return filled_ != 0;
+}
+
+bool FileReader::next(std::string_view& chunk) {
+    head_ = {};
+    if (fd_ < 0) {
+        return false;
+    }
+    const bool first = !std::exchange(started_, true);
+    if (mapping_ != nullptr) {
+        if (eof_) {
+            return false;
+        }
+        eof_ = true;
+        chunk = {static_cast<const char*>(mapping_), mapping_size_};
+        Stats::add(Stats::Counter::BytesRead, mapping_size_);
+        head_ = chunk;
+        return true;
+    }
+    while (true) {
+        // The partial line left behind by the previous chunk moves in front of the read area,
+        // so that it joins up with the bytes read next.
+        stage_carry();
+        const char* begin = storage_ + headroom_ - carry_;
+        if (!fill_buffer()) {
+            if (carry_ == 0) {
+                return false;
+            }
+            // The file ends without a trailing newline.
+            chunk = {begin, carry_};
+            carry_ = 0;
+            return true;
+        }
+        const char* area = storage_ + headroom_;
+        const char* end = area + filled_;
+        if (first) {
+            head_ = {begin, static_cast<size_t>(end - begin)};
+        }
+        if (const char* last_newline = find_last_newline(area, filled_); last_newline != nullptr) {
+            chunk = {begin, static_cast<size_t>(last_newline + 1 - begin)};
+            pending_ = last_newline + 1;
+            carry_ = static_cast<size_t>(end - pending_);
+            return true;
+        }
+        if (eof_) {
+            chunk = {begin, static_cast<size_t>(end - begin)};
+            carry_ = 0;
+            return true;
+        }
+        // Not a single line break in the whole read area: keep reading the same line.
+        pending_ = begin;
+        carry_ = static_cast<size_t>(end - begin);
+    }
+}
+} // namespace mb
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class FileReader
+ * @brief Hands out the contents of a file as a sequence of large buffers.
+ *
+ * Regular files are memory-mapped in one piece. Small files, pipes, special files and
+ * files above the mapping limit are read with large page-aligned `read()` calls instead.
+ * A chunk of a pipe or other stream ends with the data that is ready: the reader keeps
+ * reading while more is, up to the size of its buffer, but does not wait for more, so
+ * lines written slowly into a pipe are handed out as they arrive.
+ * Every chunk ends on a line boundary (except for the last chunk of the file), so a line
+ * never straddles two chunks and callers can search each chunk as a whole.
+ *
+ * Every thread keeps the buffer of the last reader it destroyed for its next one, so reading
+ * one small file after the other allocates nothing.
+ */
+class FileReader final {
+public:
+    /**
+     * @brief Opens the file for reading.
+     * @param path Path to the file.
+     */
+    explicit FileReader(const fs::path& path);
+    /**
+     * @brief Opens the file for reading.
+     * @param path Path to the file in the native narrow encoding.
+     */
+    explicit FileReader(const char* path);
+    /**
+     * @brief Reads a descriptor that is already open, like stdin's; it is not closed afterwards.
+     * @param fd The file descriptor.
+     */
+    explicit FileReader(int fd);
+    /**
+     * @brief Unmaps or frees the buffer and closes the file.
+     */
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    /**
+     * @brief Checks whether the file was opened successfully.
+     * @return true if the file can be read.
+     */
+    bool is_open() const { return fd_ >= 0; }
+    /**
+     * @brief Fetches the next chunk of the file.
+     *
+     * The returned view stays valid until the next call or until the reader is destroyed.
+     *
+     * @param chunk Receives the chunk.
+     * @return false when the whole file has been consumed or a read error occurred.
+     */
+    bool next(std::string_view& chunk);
+    /**
+     * @brief Returns the first bytes of the file, for sniffing its type.
+     *
+     * After the first call of next() this holds at least the first chunk, and also the bytes
+     * read past its last line break. It is empty at any other time.
+     */
+    std::string_view head() const { return head_; }
+
+private:
+    void start();
+    bool map_file(size_t size);
+    bool fill_buffer();
+    void stage_carry();
+    void reserve(size_t headroom, size_t capacity);
+
+    int fd_ = -1;
+    bool owns_fd_ = true;
+    bool eof_ = false;
+    bool stream_ = false;     ///< Not a regular file: reads return what is ready, not what was asked for
+    bool started_ = false;    ///< A chunk has been handed out already
+    std::string_view head_{}; ///< Start of the file while the first chunk is current
+
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+
+    char* storage_ = nullptr;       ///< Page-aligned buffer laid out as [headroom_][capacity_]
+    size_t storage_size_ = 0;       ///< Bytes allocated for it, which may exceed the two
+    size_t headroom_ = 0;           ///< Space in front of the read area for the carried-over partial line
+    size_t capacity_ = 0;           ///< Size of the read area
+    size_t filled_ = 0;             ///< Bytes currently held in the read area
+    const char* pending_ = nullptr; ///< Partial line left over from the previous chunk
+    size_t carry_ = 0;              ///< Length of that partial line
+    size_t remaining_ = 0;          ///< Bytes left according to fstat(); lets regular files skip the EOF read
+};
+} // namespace mb
@@ -0,0 +1,241 @@
+#include "glob_set.h"
+
+#include <algorithm>
+#include <optional>
+
+namespace mb {
+namespace {
+/**
+ * @brief Every byte a wildcard may match: anything but the path separator and a line break.
+ */
+ByteSet name_bytes() {
+    ByteSet set{};
+    set.set();
+    set.reset('/');
+    set.reset('\n');
+    return set;
+}
+
+/**
+ * @brief Parses a bracket expression starting at `[`.
+ * @return The bytes it accepts, or std::nullopt if it is not closed, in which case the
+ *         bracket is an ordinary byte.
+ */
+std::optional<ByteSet> parse_class(const std::string_view glob, size_t& pos) {
+    size_t i = pos + 1;
+    const bool negate = i < glob.size() && (glob[i] == '!' || glob[i] == '^');
+    if (negate) {
+        ++i;
+    }
+    ByteSet set{};
+    // Reads one byte of the set, which a backslash escapes.
+    const auto next_byte = [&glob, &i] {
+        if (glob[i] == '\\' && i + 1 < glob.size()) {
+            ++i;
+        }
+        return static_cast<unsigned char>(glob[i++]);
+    };
+    // A ']' right after the opening bracket is a member, not the end.
+    for (bool first = true; i < glob.size() && (first || glob[i] != ']'); first = false) {
+        const unsigned char low = next_byte();
+        unsigned char high = low;
+        if (i + 1 < glob.size() && glob[i] == '-' && glob[i + 1] != ']') {
+            ++i;
+            high = next_byte();
+        }
+        for (unsigned c = low; c <= high; ++c) {
+            set.set(c);
+        }
+    }
+    if (i >= glob.size()) {
+        return std::nullopt;
+    }
+    pos = i + 1;
+    if (negate) {
+        set.flip();
+    }
+    return set & name_bytes();
+}
+} // namespace
+
+bool GlobSet::add(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    // Trailing spaces go unless the last one is escaped.
+    while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\')) {
+        line.remove_suffix(1);
+    }
+    if (line.empty() || line.front() == '#') {
+        return false;
+    }
+    Glob glob{};
+    const bool negated = line.front() == '!';
+    if (negated) {
+        line.remove_prefix(1);
+    }
+    if (!line.empty() && line.back() == '/') {
+        glob.directory_only = true;
+        line.remove_suffix(1);
+    }
+    glob.anchored = line.find('/') != std::string_view::npos;
+    if (!line.empty() && line.front() == '/') {
+        line.remove_prefix(1);
+    }
+    if (line.empty()) {
+        return false;
+    }
+    const ByteSet any_byte = name_bytes();
+    for (size_t i = 0; i < line.size();) {
+        const char c = line[i];
+        if (c == '*') {
+            if (i + 1 < line.size() && line[i + 1] == '*' && (i == 0 || line[i - 1] == '/') &&
+                (i + 2 == line.size() || line[i + 2] == '/')) {
+                if (i + 2 == line.size()) {
+                    glob.tokens.push_back({Token::Kind::Globstar});
+                    i += 2;
+                } else {
+                    glob.tokens.push_back({Token::Kind::AnyDirs});
+                    i += 3;
+                }
+                continue;
+            }
+            glob.tokens.push_back({Token::Kind::Star});
+            while (i < line.size() && line[i] == '*') {
+                ++i;
+            }
+            continue;
+        }
+        if (c == '?') {
+            glob.tokens.push_back({Token::Kind::Byte, any_byte});
+            ++i;
+            continue;
+        }
+        if (c == '[') {
+            if (auto set = parse_class(line, i); set.has_value()) {
+                glob.tokens.push_back({Token::Kind::Byte, *set});
+                continue;
+            }
+        }
+        char byte = c;
+        if (c == '\\' && i + 1 < line.size()) {
+            byte = line[++i];
+        }
+        ++i;
+        ByteSet set{};
+        set.set(static_cast<unsigned char>(byte));
+        glob.tokens.push_back({Token::Kind::Byte, set});
+    }
+    glob.index = static_cast<int>(negated_.size());
+    negated_.push_back(negated);
+    plain_ += negated ? 0 : 1;
+
+    if (auto text = literal(glob.tokens, 0); text.has_value()) {
+        record(glob.anchored ? paths_ : names_, std::move(*text), glob.index, glob.directory_only);
+        return true;
+    }
+    if (!glob.anchored && glob.tokens.front().kind == Token::Kind::Star) {
+        // `*.ext`: the name ends in the extension, which is all after its last dot.
+        if (auto suffix = literal(glob.tokens, 1);
+            suffix.has_value() && suffix->size() > 1 && suffix->front() == '.' &&
+            suffix->find('.', 1) == std::string::npos) {
+            record(extensions_, suffix->substr(1), glob.index, glob.directory_only);
+            return true;
+        }
+    }
+    others_.push_back(std::move(glob));
+    return true;
+}
+
+GlobSet::Result GlobSet::match(const std::string_view path, const std::string_view name,
+                               const bool is_directory) const {
+    int best = -1;
+    const auto consider = [&best, is_directory](const Table& table, const std::string_view key) {
+        if (const auto it = table.find(key); it != table.end()) {
+            best = std::max(best, it->second.any);
+            if (is_directory) {
+                best = std::max(best, it->second.directory);
+            }
+        }
+    };
+    if (!names_.empty()) {
+        consider(names_, name);
+    }
+    if (!paths_.empty()) {
+        consider(paths_, path);
+    }
+    if (const size_t dot = name.rfind('.'); !extensions_.empty() && dot != std::string_view::npos) {
+        consider(extensions_, name.substr(dot + 1));
+    }
+    for (auto it = others_.rbegin(); it != others_.rend() && it->index > best; ++it) {
+        if ((!it->directory_only || is_directory) && match_tokens(it->tokens, 0, it->anchored ? path : name, 0)) {
+            best = it->index;
+        }
+    }
+    if (best < 0) {
+        return Result::None;
+    }
+    return negated_[static_cast<size_t>(best)] ? Result::Negated : Result::Matched;
+}
+
+bool GlobSet::match_tokens(const std::vector<Token>& tokens, size_t token, const std::string_view text,
+                           size_t pos) {
+    for (; token < tokens.size(); ++token) {
+        switch (tokens[token].kind) {
+        case Token::Kind::Byte:
+            if (pos == text.size() || !tokens[token].set.test(static_cast<unsigned char>(text[pos]))) {
+                return false;
+            }
+            ++pos;
+            break;
+        case Token::Kind::Star:
+            for (;; ++pos) {
+                if (match_tokens(tokens, token + 1, text, pos)) {
+                    return true;
+                }
+                if (pos == text.size() || text[pos] == '/') {
+                    return false;
+                }
+            }
+        case Token::Kind::Globstar:
+            return true;
+        case Token::Kind::AnyDirs:
+            if (match_tokens(tokens, token + 1, text, pos)) {
+                return true;
+            }
+            for (; pos < text.size(); ++pos) {
+                if (text[pos] == '/' && match_tokens(tokens, token + 1, text, pos + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    return pos == text.size();
+}
+
+/**
+ * @brief Returns the bytes matched by the tokens from an offset on if each is a single byte, or std::nullopt.
+ */
+std::optional<std::string> GlobSet::literal(const std::vector<Token>& tokens, const size_t from) {
+    std::string text{};
+    for (size_t i = from; i < tokens.size(); ++i) {
+        const ByteSet& set = tokens[i].set;
+        if (tokens[i].kind != Token::Kind::Byte || set.count() != 1) {
+            return std::nullopt;
+        }
+        for (unsigned c = 0; c < 256; ++c) {
+            if (set.test(c)) {
+                text += static_cast<char>(c);
+                break;
+            }
+        }
+    }
+    return text;
+}
+
+void GlobSet::record(Table& table, std::string key, const int index, const bool directory_only) {
+    Indices& indices = table[std::move(key)];
+    (directory_only ? indices.directory : indices.any) = index;
+}
+} // namespace mb
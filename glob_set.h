@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "regex_parser.h"
+
+namespace mb {
+/**
+ * @class GlobSet
+ * @brief An ordered list of globs in .gitignore syntax, matched all at once.
+ *
+ * Like in a .gitignore file, the last glob that matches a path decides, and it may be
+ * negated with a leading `!`. A glob without a slash matches the name of an entry at any
+ * depth, a glob with one matches its whole relative path; a trailing slash restricts it to
+ * directories. `*` and `?` never match a slash, `**` as a whole path component matches any
+ * number of them, and `[...]` matches one byte of a set.
+ *
+ * Most globs in practice are plain names, like `node_modules`, plain paths, like `/build`,
+ * or extensions, like `*.o`. Those are kept in hash tables that hold the last index of every
+ * name, path and extension, so matching them costs three lookups however many there are.
+ * Only the remaining globs are matched one by one, newest first, and only while they could
+ * still beat the index found in the tables.
+ */
+class GlobSet final {
+public:
+    /**
+     * @brief What decided a match.
+     */
+    enum class Result {
+        None,    ///< No glob matches
+        Matched, ///< The last matching glob is a plain one
+        Negated, ///< The last matching glob starts with `!`
+    };
+
+    /**
+     * @brief Appends a glob, or a line of a .gitignore file.
+     *
+     * Blank lines and comments starting with `#` are skipped. Trailing spaces are dropped
+     * unless escaped with a backslash.
+     *
+     * @param line The glob.
+     * @return false if the line holds no glob.
+     */
+    bool add(std::string_view line);
+    /**
+     * @brief Matches an entry against the globs.
+     *
+     * @param path Relative path of the entry, '/'-separated, from the directory the globs belong to.
+     * @param name The last component of the path.
+     * @param is_directory Whether the entry is a directory.
+     * @return Whether the last glob matching the entry is negated, if any matches.
+     */
+    Result match(std::string_view path, std::string_view name, bool is_directory) const;
+    /**
+     * @brief Checks whether no glob has been added.
+     */
+    bool empty() const { return negated_.empty(); }
+    /**
+     * @brief Checks whether any glob has been added without `!`.
+     */
+    bool has_plain() const { return plain_ != 0; }
+
+private:
+    struct Token {
+        enum class Kind {
+            Byte,     ///< One byte of set, never '/'
+            Star,     ///< `*`, any run of bytes without '/'
+            Globstar, ///< A trailing `**`, anything
+            AnyDirs,  ///< `**/`, no or any number of whole directories
+        };
+
+        Kind kind = Kind::Byte;
+        ByteSet set{};
+    };
+
+    struct Glob {
+        int index = 0;
+        bool anchored = false;       ///< Matched against the path rather than the name
+        bool directory_only = false; ///< Ended in a slash
+        std::vector<Token> tokens;
+    };
+
+    /**
+     * @brief The last index of the globs sharing a hash table key.
+     */
+    struct Indices {
+        int any = -1;       ///< Of the globs matching files and directories
+        int directory = -1; ///< Of the globs matching only directories
+    };
+
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(const std::string_view text) const { return std::hash<std::string_view>{}(text); }
+    };
+    using Table = std::unordered_map<std::string, Indices, StringHash, std::equal_to<>>;
+
+    static std::optional<std::string> literal(const std::vector<Token>& tokens, size_t from);
+    static bool match_tokens(const std::vector<Token>& tokens, size_t token, std::string_view text, size_t pos);
+    static void record(Table& table, std::string key, int index, bool directory_only);
+
+    Table names_{};      ///< Globs without wildcards and slashes
+    Table paths_{};      ///< Globs without wildcards but with a slash
+    Table extensions_{}; ///< Globs like `*.ext`, by extension without the dot
+    std::vector<Glob> others_{};
+    std::vector<bool> negated_{}; ///< By index
+    size_t plain_ = 0;            ///< Globs not negated
+};
+} // namespace mb
@@ -0,0 +1,433 @@
+#include "lazy_dfa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace mb {
+namespace {
+constexpr size_t kMaxNfaStates = size_t{1} << 16;    ///< Larger patterns are left to the fallback engine
+constexpr size_t kCacheMemoryLimit = size_t{4} << 20; ///< Per thread and automaton
+constexpr size_t kMaxCachesPerThread = 8;
+constexpr uint32_t kBeginMarker = UINT32_MAX; ///< Distinguishes line-start states from equal mid-line sets
+
+struct SetHash {
+    size_t operator()(const std::vector<uint32_t>& set) const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const uint32_t id : set) {
+            hash = (hash ^ id) * 1099511628211ULL;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+} // namespace
+
+/**
+ * @brief DFA states and transitions built so far, owned by one thread.
+ *
+ * State 0 is entered once a line is known to match, state 1 is the start of a line.
+ * Transitions are stored pre-multiplied: an entry holds the table offset of the target state,
+ * negated (minus two) for match and dead states. The scan loop thus needs a single dependent
+ * load per byte, and kUnknown (-1) falls into the same rarely taken negative branch.
+ */
+struct DfaCache {
+    static constexpr int32_t kUnknown = -1;
+    static constexpr int32_t kMatched = 0;
+    static constexpr int32_t kStart = 1;
+
+    enum Flags : uint8_t {
+        kMatch = 1,    ///< The line matches
+        kDead = 2,     ///< Nothing but the line break can lead to a match
+        kEolMatch = 4, ///< The line matches if it ends here
+    };
+
+    explicit DfaCache(const LazyDfa& dfa) : owner(dfa.id_), stride(dfa.class_count_) {
+        marks.assign(dfa.states_.size(), 0);
+        ++generation;
+        dfa.closure(*this, dfa.start_, false, false, unanchored);
+        std::sort(unanchored.begin(), unanchored.end());
+        unanchored_dead = std::none_of(unanchored.begin(), unanchored.end(),
+                                       [&](const uint32_t id) { return dfa.states_[id].op == LazyDfa::Op::Byte; });
+        reset(dfa);
+    }
+
+    void reset(const LazyDfa& dfa) {
+        table.clear();
+        flags.clear();
+        sets.clear();
+        index.clear();
+        memory = 0;
+        std::vector<uint32_t> start{};
+        ++generation;
+        dfa.closure(*this, dfa.start_, true, false, start);
+        std::sort(start.begin(), start.end());
+        start.push_back(kBeginMarker);
+        add(dfa, {kBeginMarker, kBeginMarker}); // The matched sentinel; its key never occurs otherwise
+        flags[kMatched] = kMatch;
+        add(dfa, std::move(start));
+    }
+
+    int32_t add(const LazyDfa& dfa, std::vector<uint32_t> set) {
+        if (const auto it = index.find(set); it != index.end()) {
+            return it->second;
+        }
+        const auto id = static_cast<int32_t>(flags.size());
+        const bool begin = !set.empty() && set.back() == kBeginMarker;
+        uint8_t state_flags = 0;
+        std::vector<uint32_t> eol{};
+        ++generation;
+        for (const uint32_t nfa_id : set) {
+            if (nfa_id == kBeginMarker) {
+                continue;
+            }
+            const auto& state = dfa.states_[nfa_id];
+            if (state.op == LazyDfa::Op::Match) {
+                state_flags |= kMatch;
+            } else if (state.op == LazyDfa::Op::End) {
+                dfa.closure(*this, state.out, begin, true, eol);
+            }
+        }
+        if (std::any_of(eol.begin(), eol.end(),
+                        [&](const uint32_t nfa_id) { return dfa.states_[nfa_id].op == LazyDfa::Op::Match; })) {
+            state_flags |= kEolMatch;
+        }
+        // Without a pending byte state every further byte leads back to the unanchored start set.
+        if (unanchored_dead && set == unanchored) {
+            state_flags |= kDead;
+        }
+        flags.push_back(state_flags);
+        table.resize(table.size() + stride, kUnknown);
+        memory += stride * sizeof(int32_t) + 2 * set.size() * sizeof(uint32_t) + 128;
+        sets.push_back(set);
+        index.emplace(std::move(set), id);
+        return id;
+    }
+
+    int32_t encode(const int32_t state) const {
+        const int32_t offset = state * static_cast<int32_t>(stride);
+        return (flags[state] & (kMatch | kDead)) != 0 ? -offset - 2 : offset;
+    }
+
+    static int32_t offset_of(const int32_t entry) { return entry < 0 ? -entry - 2 : entry; }
+
+    int32_t decode(const int32_t entry) const { return offset_of(entry) / static_cast<int32_t>(stride); }
+
+    /**
+     * @brief Builds the transition of a state on a byte class.
+     * @return The encoded target state.
+     */
+    int32_t next(const LazyDfa& dfa, const int32_t from, const uint32_t cls) {
+        if (cls == dfa.newline_class_) {
+            const int32_t target = encode((flags[from] & kEolMatch) != 0 ? kMatched : kStart);
+            table[static_cast<size_t>(from) * stride + cls] = target;
+            return target;
+        }
+        std::vector<uint32_t> set{};
+        ++generation;
+        for (const uint32_t nfa_id : sets[from]) {
+            if (nfa_id == kBeginMarker) {
+                continue;
+            }
+            const auto& state = dfa.states_[nfa_id];
+            if (state.op == LazyDfa::Op::Byte && state.classes.test(cls)) {
+                dfa.closure(*this, state.out, false, false, set);
+            }
+        }
+        // A match may start at any position, so the start state is mixed into every step.
+        dfa.closure(*this, dfa.start_, false, false, set);
+        std::sort(set.begin(), set.end());
+        if (memory > kCacheMemoryLimit && index.find(set) == index.end()) {
+            reset(dfa);
+            return encode(add(dfa, std::move(set)));
+        }
+        const int32_t target = encode(add(dfa, std::move(set)));
+        table[static_cast<size_t>(from) * stride + cls] = target;
+        return target;
+    }
+
+    uint64_t owner;
+    size_t stride;
+    std::vector<uint32_t> unanchored; ///< Closure of the start state away from the line start
+    bool unanchored_dead = false;     ///< The unanchored start set consumes no bytes
+    std::vector<int32_t> table;
+    std::vector<uint8_t> flags;
+    std::vector<std::vector<uint32_t>> sets;
+    std::unordered_map<std::vector<uint32_t>, int32_t, SetHash> index;
+    size_t memory = 0;
+    std::vector<uint32_t> marks;
+    std::vector<uint32_t> stack;
+    uint32_t generation = 0;
+};
+
+std::unique_ptr<LazyDfa> LazyDfa::compile(const RegexNode& root) {
+    static std::atomic<uint64_t> next_id{1};
+    std::unique_ptr<LazyDfa> dfa{new LazyDfa{}};
+    try {
+        const uint32_t match = dfa->add_state(State{});
+        dfa->start_ = dfa->compile_node(root, match);
+    } catch (const std::length_error&) {
+        return nullptr;
+    }
+    // Split the bytes into classes that no state tells apart, starting with the line break.
+    uint32_t classes[256]{};
+    uint32_t count = 1;
+    const auto refine = [&](const ByteSet& set) {
+        uint32_t renumbered[512];
+        std::fill(std::begin(renumbered), std::end(renumbered), UINT32_MAX);
+        count = 0;
+        for (size_t b = 0; b < 256; ++b) {
+            auto& slot = renumbered[classes[b] * 2 + (set.test(b) ? 1 : 0)];
+            if (slot == UINT32_MAX) {
+                slot = count++;
+            }
+            classes[b] = slot;
+        }
+    };
+    ByteSet newline{};
+    newline.set('\n');
+    refine(newline);
+    for (const auto& state : dfa->states_) {
+        if (state.op == Op::Byte) {
+            refine(state.classes);
+        }
+    }
+    for (size_t b = 0; b < 256; ++b) {
+        dfa->byte_class_[b] = static_cast<uint8_t>(classes[b]);
+    }
+    dfa->class_count_ = count;
+    dfa->newline_class_ = dfa->byte_class_[static_cast<unsigned char>('\n')];
+    for (auto& state : dfa->states_) {
+        if (state.op != Op::Byte) {
+            continue;
+        }
+        ByteSet accepted{};
+        for (size_t b = 0; b < 256; ++b) {
+            if (state.classes.test(b)) {
+                accepted.set(dfa->byte_class_[b]);
+            }
+        }
+        state.classes = accepted;
+    }
+    dfa->id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+    return dfa;
+}
+
+uint32_t LazyDfa::add_state(State state) {
+    if (states_.size() >= kMaxNfaStates) {
+        throw std::length_error("regex automaton is too large");
+    }
+    states_.push_back(state);
+    return static_cast<uint32_t>(states_.size() - 1);
+}
+
+uint32_t LazyDfa::compile_node(const RegexNode& node, const uint32_t next) {
+    switch (node.kind) {
+    case RegexNode::Kind::Empty:
+        return next;
+    case RegexNode::Kind::Set: {
+        // Lines never contain their line break, so no pattern byte may consume it.
+        ByteSet bytes = node.set;
+        bytes.reset('\n');
+        return add_state(State{Op::Byte, next, 0, bytes});
+    }
+    case RegexNode::Kind::Concat: {
+        uint32_t entry = next;
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+            entry = compile_node(*it, entry);
+        }
+        return entry;
+    }
+    case RegexNode::Kind::Alternate: {
+        uint32_t entry = compile_node(node.children.back(), next);
+        for (auto it = std::next(node.children.rbegin()); it != node.children.rend(); ++it) {
+            const uint32_t branch = compile_node(*it, next);
+            entry = add_state(State{Op::Split, branch, entry, {}});
+        }
+        return entry;
+    }
+    case RegexNode::Kind::Repeat: {
+        const RegexNode& child = node.children.front();
+        uint32_t entry = next;
+        if (node.max < 0) {
+            const uint32_t loop = add_state(State{Op::Split, 0, next, {}});
+            const uint32_t body = compile_node(child, loop);
+            states_[loop].out = body;
+            entry = loop;
+        } else {
+            for (int i = node.min; i < node.max; ++i) {
+                const uint32_t body = compile_node(child, entry);
+                entry = add_state(State{Op::Split, body, next, {}});
+            }
+        }
+        for (int i = 0; i < node.min; ++i) {
+            entry = compile_node(child, entry);
+        }
+        return entry;
+    }
+    case RegexNode::Kind::LineBegin:
+        return add_state(State{Op::Begin, next, 0, {}});
+    case RegexNode::Kind::LineEnd:
+        return add_state(State{Op::End, next, 0, {}});
+    }
+    return next;
+}
+
+void LazyDfa::closure(DfaCache& cache, const uint32_t from, const bool at_begin, const bool at_end,
+                      std::vector<uint32_t>& out) const {
+    auto& stack = cache.stack;
+    stack.push_back(from);
+    while (!stack.empty()) {
+        const uint32_t id = stack.back();
+        stack.pop_back();
+        if (cache.marks[id] == cache.generation) {
+            continue;
+        }
+        cache.marks[id] = cache.generation;
+        const State& state = states_[id];
+        switch (state.op) {
+        case Op::Byte:
+        case Op::Match:
+            out.push_back(id);
+            break;
+        case Op::Split:
+            stack.push_back(state.out1);
+            stack.push_back(state.out);
+            break;
+        case Op::Begin:
+            if (at_begin) {
+                stack.push_back(state.out);
+            }
+            break;
+        case Op::End:
+            if (at_end) {
+                stack.push_back(state.out);
+            } else {
+                out.push_back(id);
+            }
+            break;
+        }
+    }
+}
+
+DfaCache& LazyDfa::cache() const {
+    thread_local std::vector<std::unique_ptr<DfaCache>> caches{};
+    for (size_t i = 0; i < caches.size(); ++i) {
+        if (caches[i]->owner == id_) {
+            if (i != 0) {
+                std::swap(caches[0], caches[i]);
+            }
+            return *caches[0];
+        }
+    }
+    if (caches.size() >= kMaxCachesPerThread) {
+        caches.pop_back();
+    }
+    caches.insert(caches.begin(), std::make_unique<DfaCache>(*this));
+    return *caches[0];
+}
+
+size_t LazyDfa::scan(DfaCache& cache, const std::string_view text, const bool final_line) const {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t size = text.size();
+    if ((cache.flags[DfaCache::kStart] & DfaCache::kMatch) != 0) {
+        return size != 0 || final_line ? 0 : std::string_view::npos;
+    }
+    int32_t entry = DfaCache::kStart * static_cast<int32_t>(cache.stride); // Table offset of the current state
+    const int32_t* table = cache.table.data();
+    for (size_t i = 0; i < size; ++i) {
+        const uint8_t cls = byte_class_[bytes[i]];
+        int32_t next = table[entry + cls];
+        if (next >= 0) {
+            entry = next;
+            continue;
+        }
+        if (next == DfaCache::kUnknown) {
+            next = cache.next(*this, cache.decode(entry), cls);
+            table = cache.table.data();
+        }
+        entry = DfaCache::offset_of(next);
+        if (next >= 0) {
+            continue;
+        }
+        if ((cache.flags[cache.decode(entry)] & DfaCache::kMatch) != 0) {
+            return i;
+        }
+        // Nothing can match before the next line break, so jump right to it.
+        const auto* newline = static_cast<const unsigned char*>(std::memchr(bytes + i + 1, '\n', size - i - 1));
+        if (newline == nullptr) {
+            break;
+        }
+        i = static_cast<size_t>(newline - bytes) - 1;
+    }
+    if (final_line && (cache.flags[cache.decode(entry)] & DfaCache::kEolMatch) != 0) {
+        return size;
+    }
+    return std::string_view::npos;
+}
+
+size_t LazyDfa::find(const std::string_view buffer) const {
+    return scan(cache(), buffer, !buffer.empty() && buffer.back() != '\n');
+}
+
+bool LazyDfa::match(const std::string_view line) const { return scan(cache(), line, true) != std::string_view::npos; }
+
+std::optional<std::pair<size_t, size_t>> LazyDfa::find_span(const std::string_view line, const size_t from) const {
+    DfaCache& cache = this->cache();
+    const auto* bytes = reinterpret_cast<const unsigned char*>(line.data());
+    const size_t size = line.size();
+    // Threads are kept in the order of their starts, so the closure of an earlier start claims
+    // a state shared with a later one.
+    std::vector<uint32_t> threads{};
+    std::vector<size_t> starts{};
+    std::vector<uint32_t> next{};
+    std::vector<size_t> next_starts{};
+    std::optional<std::pair<size_t, size_t>> found{};
+    ++cache.generation;
+    closure(cache, start_, from == 0, from == size, threads);
+    starts.assign(threads.size(), from);
+    for (size_t pos = from;; ++pos) {
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (states_[threads[i]].op == Op::Match && (!found.has_value() || starts[i] <= found->first)) {
+                found = {starts[i], pos};
+                break;
+            }
+        }
+        if (found.has_value()) {
+            // Threads that started later can no longer matter; earlier ones may still match further left.
+            size_t kept = 0;
+            for (size_t i = 0; i < threads.size(); ++i) {
+                if (starts[i] <= found->first) {
+                    threads[kept] = threads[i];
+                    starts[kept++] = starts[i];
+                }
+            }
+            threads.resize(kept);
+            starts.resize(kept);
+        }
+        if (pos == size || (found.has_value() && threads.empty())) {
+            return found;
+        }
+        const uint8_t cls = byte_class_[bytes[pos]];
+        const bool at_end = pos + 1 == size;
+        next.clear();
+        next_starts.clear();
+        ++cache.generation;
+        for (size_t i = 0; i < threads.size(); ++i) {
+            const State& state = states_[threads[i]];
+            if (state.op == Op::Byte && state.classes.test(cls)) {
+                closure(cache, state.out, false, at_end, next);
+                next_starts.resize(next.size(), starts[i]);
+            }
+        }
+        if (!found.has_value()) {
+            closure(cache, start_, false, at_end, next);
+            next_starts.resize(next.size(), pos + 1);
+        }
+        threads.swap(next);
+        starts.swap(next_starts);
+    }
+}
+} // namespace mb
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "regex_parser.h"
+
+namespace mb {
+struct DfaCache;
+
+/**
+ * @class LazyDfa
+ * @brief Linear-time regex matcher built on a Thompson NFA and an on-demand DFA.
+ *
+ * The parsed pattern is compiled into a Thompson NFA over byte classes. Searching walks a
+ * DFA whose states are sets of NFA states; a state and its transitions are only built the
+ * first time the scan needs them and are kept in a per-thread cache. When the cache grows
+ * beyond its memory cap it is flushed and rebuilt from the current state, so every input
+ * byte costs at most one NFA step and the search time stays linear in the input size.
+ *
+ * Lines are matched independently: `^` and `$` anchor at line boundaries and nothing
+ * matches across a line break.
+ */
+class LazyDfa final {
+public:
+    /**
+     * @brief Compiles a parsed pattern.
+     *
+     * @param root The parsed regex.
+     * @return The automaton, or nullptr if the NFA would exceed its size limit.
+     */
+    static std::unique_ptr<LazyDfa> compile(const RegexNode& root);
+
+    /**
+     * @brief Finds the first line of a buffer that contains a match.
+     *
+     * @param buffer The text to search, lines separated by '\\n'.
+     * @return An offset inside the matching line (the offset of its line break if the match
+     *         was only confirmed there), or std::string_view::npos if no line matches.
+     */
+    size_t find(std::string_view buffer) const;
+
+    /**
+     * @brief Checks whether a single line contains a match.
+     *
+     * @param line The line, without its line break.
+     * @return true if the line matches.
+     */
+    bool match(std::string_view line) const;
+
+    /**
+     * @brief Finds the leftmost-longest match in a line that starts at or after an offset.
+     *
+     * Simulates the NFA directly, every thread remembering where its match started, which
+     * takes longer per byte than the cached DFA; meant for the few lines known to match.
+     *
+     * @param line The line, without its line break.
+     * @param from Offset to start looking at.
+     * @return The begin and end of the match, or std::nullopt if there is none.
+     */
+    std::optional<std::pair<size_t, size_t>> find_span(std::string_view line, size_t from) const;
+
+private:
+    enum class Op : uint8_t { Byte, Split, Begin, End, Match };
+
+    struct State {
+        Op op = Op::Match;
+        uint32_t out = 0;  ///< Next state
+        uint32_t out1 = 0; ///< Second branch of a Split
+        ByteSet classes{}; ///< Byte classes accepted by a Byte state
+    };
+
+    friend struct DfaCache;
+
+    LazyDfa() = default;
+
+    uint32_t add_state(State state);
+    uint32_t compile_node(const RegexNode& node, uint32_t next);
+    void closure(DfaCache& cache, uint32_t from, bool at_begin, bool at_end, std::vector<uint32_t>& out) const;
+    size_t scan(DfaCache& cache, std::string_view text, bool final_line) const;
+    DfaCache& cache() const;
+
+    std::vector<State> states_;
+    uint32_t start_ = 0;
+    uint8_t byte_class_[256]{}; ///< Maps every byte onto its equivalence class
+    uint32_t class_count_ = 0;
+    uint8_t newline_class_ = 0;
+    uint64_t id_ = 0; ///< Identifies the automaton's cache in the per-thread cache list
+};
+} // namespace mb
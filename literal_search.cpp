@@ -0,0 +1,258 @@
+#include "literal_search.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "simd.h"
+
+namespace mb {
+namespace {
+/**
+ * Relative frequency rank of every byte value (255 = most frequent), measured over a mix of
+ * source code, documentation and system logs.
+ */
+constexpr unsigned char kByteRank[256] = {
+     22,  13,   0,  41,  55,  16,   2,  46,  19, 189, 241,  14,  96, 159,  11,  76,
+     23,  38,  43,  12,  80,   4,  34, 105,  15,   1,  21,  59,  39,   7,  17,  44,
+    254, 165, 222, 191, 167, 162, 173, 176, 217, 218, 219, 168, 213, 226, 235, 251,
+    231, 223, 225, 210, 204, 201, 196, 190, 193, 198, 224, 185, 228, 214, 230, 158,
+    171, 206, 199, 211, 187, 207, 197, 184, 182, 209, 180, 169, 215, 188, 200, 192,
+    186, 161, 203, 216, 212, 181, 172, 175, 174, 170, 166, 195, 177, 194, 150, 239,
+    202, 246, 240, 243, 242, 255, 233, 234, 236, 250, 208, 220, 248, 238, 244, 249,
+    247, 205, 245, 252, 253, 237, 229, 221, 227, 232, 183, 179, 164, 178, 153, 103,
+    157,  64, 143, 118, 140,  24,  29, 101, 123,  78,  60, 104,  62,  68,  31, 102,
+     84,  35,  47,  74, 156,  65,  48,  66, 129, 128,  25,  69, 144, 125,  91, 148,
+    141, 137,  94, 124, 146,   9,  72, 100,   6, 154,  73, 149,  33, 142,  18, 108,
+    127, 155, 132, 139, 130, 134, 147,  95, 138,  52, 131, 122, 133, 126, 136, 112,
+     86,  20, 152, 163, 111, 145,  53,  82,   3,  27,  28,  40,  77,  99,  89,  79,
+    151, 135,  42,  50,  26,  51,  30, 120,  32,  90,  83, 119,  61,  97,  45, 117,
+     71,  70, 160, 106,  56, 121,  87,  75,  37, 113,  10,  92,  93, 115, 109,  81,
+      5,  67,  54,  98,   8,  63,  57, 114,  49,  36,  58, 107,  88,  85, 110, 116,};
+} // namespace
+
+/**
+ * @brief The search kernels, one per instruction set.
+ *
+ * Every kernel tests a block of candidate start positions against the two anchor bytes and
+ * hands the remaining positions at the end of the haystack to the scalar kernel. With Fold
+ * set, haystack bytes are ORed with the anchor's case bit before the comparison, which maps
+ * both cases of an ASCII letter onto the folded anchor; the few non-letters this lets
+ * through are rejected by the verification step.
+ */
+struct LiteralKernels {
+    using Kernel = LiteralSearcher::Kernel;
+
+    template <bool Fold>
+    static bool verify(const LiteralSearcher& s, const char* candidate) {
+        if constexpr (Fold) {
+            const char* needle = s.needle_.data();
+            for (size_t i = 0; i < s.needle_.size(); ++i) {
+                if (to_lower_ascii(candidate[i]) != needle[i]) {
+                    return false;
+                }
+            }
+            return true;
+        } else {
+            return std::memcmp(candidate, s.needle_.data(), s.needle_.size()) == 0;
+        }
+    }
+
+    static size_t empty(const LiteralSearcher&, const char*, size_t) { return 0; }
+
+    static size_t single(const LiteralSearcher& s, const char* haystack, const size_t size) {
+        const auto* hit = static_cast<const char*>(std::memchr(haystack, s.byte1_, size));
+        return hit != nullptr ? static_cast<size_t>(hit - haystack) : std::string_view::npos;
+    }
+
+    template <bool Fold>
+    static size_t scalar_from(const LiteralSearcher& s, const char* haystack, const size_t size, size_t from) {
+        const size_t len = s.needle_.size();
+        if (size < len) {
+            return std::string_view::npos;
+        }
+        const size_t last = size - len;
+        if constexpr (Fold) {
+            for (; from <= last; ++from) {
+                if ((static_cast<unsigned char>(haystack[from + s.offset1_]) | s.case1_) == s.byte1_ &&
+                    (static_cast<unsigned char>(haystack[from + s.offset2_]) | s.case2_) == s.byte2_ &&
+                    verify<true>(s, haystack + from)) {
+                    return from;
+                }
+            }
+            return std::string_view::npos;
+        }
+        while (from <= last) {
+            const auto* anchor = static_cast<const char*>(
+                std::memchr(haystack + from + s.offset1_, s.byte1_, last - from + 1));
+            if (anchor == nullptr) {
+                break;
+            }
+            const auto candidate = static_cast<size_t>(anchor - haystack) - s.offset1_;
+            if (static_cast<unsigned char>(haystack[candidate + s.offset2_]) == s.byte2_ &&
+                verify<false>(s, haystack + candidate)) {
+                return candidate;
+            }
+            from = candidate + 1;
+        }
+        return std::string_view::npos;
+    }
+
+    template <bool Fold>
+    static size_t scalar(const LiteralSearcher& s, const char* haystack, const size_t size) {
+        return scalar_from<Fold>(s, haystack, size, 0);
+    }
+
+#ifdef MB_HAVE_SSE2
+    template <bool Fold>
+    static size_t sse2(const LiteralSearcher& s, const char* haystack, const size_t size) {
+        constexpr size_t block = 16;
+        const size_t len = s.needle_.size();
+        const __m128i anchor1 = _mm_set1_epi8(static_cast<char>(s.byte1_));
+        const __m128i anchor2 = _mm_set1_epi8(static_cast<char>(s.byte2_));
+        const __m128i case1 = _mm_set1_epi8(static_cast<char>(s.case1_));
+        const __m128i case2 = _mm_set1_epi8(static_cast<char>(s.case2_));
+        size_t i = 0;
+        for (; i + block - 1 + len <= size; i += block) {
+            __m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + s.offset1_));
+            __m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + s.offset2_));
+            if constexpr (Fold) {
+                bytes1 = _mm_or_si128(bytes1, case1);
+                bytes2 = _mm_or_si128(bytes2, case2);
+            }
+            const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(bytes1, anchor1), _mm_cmpeq_epi8(bytes2, anchor2));
+            for (auto mask = static_cast<uint32_t>(_mm_movemask_epi8(eq)); mask != 0; mask &= mask - 1) {
+                const size_t candidate = i + static_cast<size_t>(std::countr_zero(mask));
+                if (verify<Fold>(s, haystack + candidate)) {
+                    return candidate;
+                }
+            }
+        }
+        return scalar_from<Fold>(s, haystack, size, i);
+    }
+#endif
+
+#ifdef MB_HAVE_AVX2
+    template <bool Fold>
+    MB_TARGET_AVX2 static size_t avx2(const LiteralSearcher& s, const char* haystack, const size_t size) {
+        constexpr size_t block = 32;
+        const size_t len = s.needle_.size();
+        const __m256i anchor1 = _mm256_set1_epi8(static_cast<char>(s.byte1_));
+        const __m256i anchor2 = _mm256_set1_epi8(static_cast<char>(s.byte2_));
+        const __m256i case1 = _mm256_set1_epi8(static_cast<char>(s.case1_));
+        const __m256i case2 = _mm256_set1_epi8(static_cast<char>(s.case2_));
+        size_t i = 0;
+        for (; i + block - 1 + len <= size; i += block) {
+            __m256i bytes1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + s.offset1_));
+            __m256i bytes2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + s.offset2_));
+            if constexpr (Fold) {
+                bytes1 = _mm256_or_si256(bytes1, case1);
+                bytes2 = _mm256_or_si256(bytes2, case2);
+            }
+            const __m256i eq =
+                _mm256_and_si256(_mm256_cmpeq_epi8(bytes1, anchor1), _mm256_cmpeq_epi8(bytes2, anchor2));
+            for (auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq)); mask != 0; mask &= mask - 1) {
+                const size_t candidate = i + static_cast<size_t>(std::countr_zero(mask));
+                if (verify<Fold>(s, haystack + candidate)) {
+                    return candidate;
+                }
+            }
+        }
+        return scalar_from<Fold>(s, haystack, size, i);
+    }
+#endif
+
+#ifdef MB_ARCH_NEON
+    template <bool Fold>
+    static size_t neon(const LiteralSearcher& s, const char* haystack, const size_t size) {
+        constexpr size_t block = 16;
+        const size_t len = s.needle_.size();
+        const uint8x16_t anchor1 = vdupq_n_u8(s.byte1_);
+        const uint8x16_t anchor2 = vdupq_n_u8(s.byte2_);
+        const uint8x16_t case1 = vdupq_n_u8(s.case1_);
+        const uint8x16_t case2 = vdupq_n_u8(s.case2_);
+        size_t i = 0;
+        for (; i + block - 1 + len <= size; i += block) {
+            uint8x16_t bytes1 = vld1q_u8(reinterpret_cast<const uint8_t*>(haystack + i + s.offset1_));
+            uint8x16_t bytes2 = vld1q_u8(reinterpret_cast<const uint8_t*>(haystack + i + s.offset2_));
+            if constexpr (Fold) {
+                bytes1 = vorrq_u8(bytes1, case1);
+                bytes2 = vorrq_u8(bytes2, case2);
+            }
+            const uint8x16_t eq = vandq_u8(vceqq_u8(bytes1, anchor1), vceqq_u8(bytes2, anchor2));
+            // Narrow every byte of the comparison result to a nibble, keeping one bit per byte.
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            for (mask &= 0x8888888888888888ULL; mask != 0; mask &= mask - 1) {
+                const size_t candidate = i + static_cast<size_t>(std::countr_zero(mask)) / 4;
+                if (verify<Fold>(s, haystack + candidate)) {
+                    return candidate;
+                }
+            }
+        }
+        return scalar_from<Fold>(s, haystack, size, i);
+    }
+#endif
+
+    template <bool Fold>
+    static Kernel select() {
+        Kernel kernel = &scalar<Fold>;
+#if defined(MB_HAVE_SSE2)
+        kernel = &sse2<Fold>;
+#elif defined(MB_ARCH_NEON)
+        kernel = &neon<Fold>;
+#endif
+#ifdef MB_HAVE_AVX2
+        static const bool has_avx2 = cpu_has_avx2();
+        if (has_avx2) {
+            kernel = &avx2<Fold>;
+        }
+#endif
+        return kernel;
+    }
+};
+
+LiteralSearcher::LiteralSearcher(std::string needle, const bool ignore_case)
+    : needle_(std::move(needle)), ignore_case_(ignore_case) {
+    if (needle_.empty()) {
+        kernel_ = &LiteralKernels::empty;
+        return;
+    }
+    if (ignore_case_) {
+        std::ranges::transform(needle_, needle_.begin(), to_lower_ascii);
+    }
+    // A folded letter is as frequent as its two cases together, which the more frequent case approximates.
+    const auto rank = [this](const size_t i) {
+        const auto byte = static_cast<unsigned char>(needle_[i]);
+        if (!ignore_case_) {
+            return kByteRank[byte];
+        }
+        return std::max(kByteRank[byte], kByteRank[static_cast<unsigned char>(to_upper_ascii(needle_[i]))]);
+    };
+    for (size_t i = 1; i < needle_.size(); ++i) {
+        if (rank(i) < rank(offset1_)) {
+            offset1_ = i;
+        }
+    }
+    offset2_ = offset1_ == 0 && needle_.size() > 1 ? 1 : 0;
+    for (size_t i = 0; i < needle_.size(); ++i) {
+        if (i != offset1_ && rank(i) < rank(offset2_)) {
+            offset2_ = i;
+        }
+    }
+    byte1_ = static_cast<unsigned char>(needle_[offset1_]);
+    byte2_ = static_cast<unsigned char>(needle_[offset2_]);
+    if (ignore_case_) {
+        case1_ = is_lower_ascii(needle_[offset1_]) ? 0x20 : 0;
+        case2_ = is_lower_ascii(needle_[offset2_]) ? 0x20 : 0;
+    }
+    // A needle without letters matches the same bytes in both modes.
+    const bool fold = ignore_case_ && std::ranges::any_of(needle_, is_lower_ascii);
+    if (needle_.size() == 1 && !fold) {
+        kernel_ = &LiteralKernels::single;
+        return;
+    }
+    kernel_ = fold ? LiteralKernels::select<true>() : LiteralKernels::select<false>();
+}
+} // namespace mb
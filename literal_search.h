@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mb {
+/**
+ * @brief Locale-independent ASCII lowercase conversion; other bytes are returned unchanged.
+ */
+constexpr char to_lower_ascii(const char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c; }
+
+/**
+ * @brief Locale-independent ASCII uppercase conversion; other bytes are returned unchanged.
+ */
+constexpr char to_upper_ascii(const char c) { return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c; }
+
+/**
+ * @brief Checks whether a byte is a lowercase ASCII letter.
+ */
+constexpr bool is_lower_ascii(const char c) { return c >= 'a' && c <= 'z'; }
+
+/**
+ * @class LiteralSearcher
+ * @brief Vectorized substring search for a fixed needle.
+ *
+ * The two rarest bytes of the needle, ranked by a static byte-frequency table, are chosen
+ * as anchors. A SIMD kernel compares a whole block of candidate positions against both
+ * anchors at once, and only positions where both match are verified byte by byte. The
+ * kernel (AVX2, SSE2, NEON or scalar) is picked once at construction time from the CPU
+ * the program runs on.
+ *
+ * Case-insensitive searches fold ASCII letters on the fly while comparing, so they cost about
+ * the same as case-sensitive ones and never copy the haystack.
+ */
+class LiteralSearcher final {
+public:
+    /**
+     * @brief Prepares the search for the given needle.
+     * @param needle The substring to look for.
+     * @param ignore_case If true, ASCII letters match regardless of case.
+     */
+    explicit LiteralSearcher(std::string needle, bool ignore_case = false);
+
+    /**
+     * @brief Finds the first occurrence of the needle.
+     *
+     * @param haystack The text to search.
+     * @return Offset of the first occurrence, or std::string_view::npos if there is none.
+     */
+    size_t find(std::string_view haystack) const { return kernel_(*this, haystack.data(), haystack.size()); }
+
+    /**
+     * @brief Returns the needle being searched for, lowercased for case-insensitive searches.
+     */
+    const std::string& needle() const { return needle_; }
+
+private:
+    using Kernel = size_t (*)(const LiteralSearcher&, const char*, size_t);
+
+    friend struct LiteralKernels;
+
+    std::string needle_;
+    bool ignore_case_{};
+    size_t offset1_ = 0;    ///< Position of the rarest needle byte
+    size_t offset2_ = 0;    ///< Position of the second rarest needle byte
+    unsigned char byte1_{}; ///< The rarest needle byte
+    unsigned char byte2_{}; ///< The second rarest needle byte
+    unsigned char case1_{}; ///< Case bit ORed into haystack bytes compared with byte1_
+    unsigned char case2_{}; ///< Case bit ORed into haystack bytes compared with byte2_
+    Kernel kernel_ = nullptr;
+};
+} // namespace mb
@@ -1,119 +1,1090 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
 
+#include "async_reader.h"
+#include "decompressor.h"
+#include "dir_walker.h"
+#include "file_identity.h"
+#include "file_reader.h"
 #include "matcher.h"
+#include "output.h"
+#include "path_filter.h"
+#include "prefilter.h"
+#include "query_plan.h"
+#include "query_server.h"
+#include "regex_parser.h"
+#include "result_cache.h"
+#include "stats.h"
 #include "thread_pool.h"
+#include "topology.h"
+#include "tree_watcher.h"
+#include "trigram_index.h"
 #include "utils.h"
 
 namespace fs = std::filesystem;
 namespace mb {
+constexpr std::string_view kStdinArgument = "-";            ///< Searches stdin in place of a directory
+constexpr std::string_view kStdinName = "(standard input)"; ///< Printed as the path of the lines of stdin
 
 /**
  * @brief Holds options for the search operation.
  */
 struct SearchOptions {
     std::string query{};                                      ///< The search pattern
+    std::optional<std::vector<std::string>> patterns{};       ///< Patterns from -e and -f, replacing query
     fs::path root_path{};                                     ///< Directory to search
     bool use_regex = false;                                   ///< Use regex for matching
     bool ignore_case = false;                                 ///< Case-insensitive search
+    bool sort_files = false;                                  ///< Print files in the order of their paths
+    bool build_index = false;                                 ///< Build the trigram index instead of searching
+    bool use_index = false;                                   ///< Only search the candidates from the index
+    bool watch_index = false;                                 ///< Keep the index up to date after building it
+    bool async_io = false;                                    ///< Read the files with io_uring
+    bool numa = false;                                        ///< Pin the workers to the NUMA nodes
+    Output::Report report = Output::Report::Lines;            ///< What is printed for the matches
+    size_t max_count = Output::kUnlimited;                    ///< Matching lines per file to stop after
+    Output::Context context{};                                ///< Lines printed around the matching ones
+    Output::Format format = Output::Format::Text;             ///< How the matching lines are written
+    bool search_zip = false;                                  ///< Search inside compressed files
+    bool stats = false;                                       ///< Report counters and timings on stderr
+    std::optional<fs::path> trace_path = std::nullopt;        ///< Optional Chrome trace output file
     std::optional<std::string> file_extension = std::nullopt; ///< Optional file extension filter
+    std::vector<std::string> globs{};                         ///< --glob globs, in the order given
+    std::vector<std::string> types{};                         ///< --type file types
+    bool use_ignore_files = true;                             ///< Skip what .gitignore and .ignore files list
+    std::optional<fs::path> serve_socket = std::nullopt;      ///< Answer queries on this socket instead of searching
+    std::optional<fs::path> cache_path = std::nullopt;        ///< Replay the matches of unchanged files from this cache
 };
 
+/**
+ * @brief Searches one chunk of a file and collects the matching lines.
+ *
+ * Line boundaries and line numbers are only worked out around the hits the matcher reports.
+ * The search is instantiated for every concrete matcher class, so its find() is called
+ * directly, with no virtual call per hit, and may be inlined into the loop.
+ *
+ * @param chunk Whole lines of the file.
+ * @param matcher The matcher object used to determine pattern match.
+ * @param results Receives the matching lines of the file through `add(line_num, line)`, which
+ *                returns false once no further lines are wanted.
+ * @param line_num Number of lines before the chunk, advanced past it.
+ * @return false if the search stopped early because results wanted no further lines.
+ */
+template <typename Matcher, typename Results>
+bool search_chunk(const std::string_view chunk, const Matcher& matcher, Results& results, size_t& line_num) {
+    size_t pos = 0;     // Start of the part not searched yet, always the beginning of a line
+    size_t counted = 0; // Line breaks before this offset are already included in line_num
+    while (pos < chunk.size()) {
+        const auto hit = matcher.find(chunk.substr(pos));
+        if (!hit.has_value()) {
+            break;
+        }
+        const size_t hit_begin = pos + hit->begin;
+        const auto previous_break = hit_begin == pos ? std::string_view::npos : chunk.rfind('\n', hit_begin - 1);
+        const size_t begin =
+            previous_break == std::string_view::npos || previous_break < pos ? pos : previous_break + 1;
+        const size_t end = std::min(chunk.find('\n', pos + hit->end), chunk.size());
+        line_num += static_cast<size_t>(std::count(chunk.data() + counted, chunk.data() + begin, '\n')) + 1;
+        if (!results.add(line_num, chunk.substr(begin, end - begin))) {
+            return false;
+        }
+        pos = end + 1;
+        counted = std::min(pos, chunk.size());
+    }
+    line_num += static_cast<size_t>(std::count(chunk.data() + counted, chunk.data() + chunk.size(), '\n'));
+    return true;
+}
+
+/**
+ * @brief A large chunk split into pieces that are searched by several workers at once.
+ *
+ * Each piece holds whole lines and is searched on its own, numbering its lines from 1, and
+ * counts its line breaks on the way. The thread that owns the file writes the pieces out in
+ * order, offsetting their line numbers by the line breaks of the pieces before: the prefix
+ * sum of the parallel counts. Pieces are only claimed up to a window ahead of the piece
+ * written next, which bounds the matches held in memory however large the file is, and no
+ * piece keeps more matches than the file still accepts.
+ *
+ * Helper tasks may start after the search is over, so they share ownership of the state, but
+ * they only touch the chunk after claiming a piece and the owner waits for every piece.
+ */
+template <typename Matcher>
+class ParallelSearch final : public std::enable_shared_from_this<ParallelSearch<Matcher>> {
+public:
+    static constexpr size_t kPieceSize = size_t{8} << 20;
+    static constexpr size_t kMinSize = 2 * kPieceSize; ///< Smaller chunks are searched by one thread
+
+    /**
+     * @brief Searches a chunk and collects the matching lines in order.
+     *
+     * @param chunk Whole lines of the file.
+     * @param matcher The matcher object used to determine pattern match.
+     * @param pool Runs the helpers searching pieces next to the calling thread.
+     * @param results Receives the matching lines of the file.
+     * @param line_num Number of lines before the chunk, advanced past it.
+     * @return false if the search stopped early because results wanted no further lines.
+     */
+    static bool run(const std::string_view chunk, const Matcher& matcher, ThreadPool& pool,
+                    Output::FileResults& results, size_t& line_num) {
+        const auto search = std::make_shared<ParallelSearch>(chunk, matcher, pool, results.remaining());
+        for (size_t index = 0; index < search->pieces_.size(); ++index) {
+            search->wait_for(index);
+            for (const auto& [number, line] : search->pieces_[index].matches) {
+                if (!results.add(line_num + number, line)) {
+                    search->finish();
+                    return false;
+                }
+            }
+            line_num += search->pieces_[index].line_breaks;
+            search->pieces_[index].matches = {};
+        }
+        return true;
+    }
+
+    ParallelSearch(const std::string_view chunk, const Matcher& matcher, ThreadPool& pool, const size_t wanted)
+        : matcher_{matcher}, pool_{pool}, window_{2 * pool.size()} {
+        for (size_t begin = 0; begin < chunk.size();) {
+            size_t end = chunk.size();
+            if (chunk.size() - begin > kPieceSize) {
+                const void* line_break = std::memchr(chunk.data() + begin + kPieceSize, '\n',
+                                                     chunk.size() - begin - kPieceSize);
+                if (line_break != nullptr) {
+                    end = static_cast<size_t>(static_cast<const char*>(line_break) - chunk.data()) + 1;
+                }
+            }
+            pieces_.push_back(Piece{chunk.substr(begin, end - begin), wanted});
+            begin = end;
+        }
+    }
+
+private:
+    struct Piece {
+        std::string_view lines;
+        size_t wanted; ///< Matches after which the rest of the piece does not matter
+        std::vector<std::pair<size_t, std::string_view>> matches{};
+        size_t line_breaks = 0;
+        bool done = false;
+
+        bool add(const size_t line_num, const std::string_view line) {
+            matches.emplace_back(line_num, line);
+            return matches.size() < wanted;
+        }
+    };
+
+    /**
+     * @brief Blocks until a piece is searched, searching pieces itself meanwhile.
+     */
+    void wait_for(const size_t index) {
+        std::unique_lock lock{mutex_};
+        limit_ = std::min(index + window_, pieces_.size());
+        const size_t wanted = std::min(pool_.size() - 1, limit_ - next_);
+        const size_t added = wanted > helpers_ ? wanted - helpers_ : 0;
+        helpers_ += added;
+        lock.unlock();
+        for (size_t i = 0; i < added; ++i) {
+            pool_.submit([search = this->shared_from_this()] {
+                std::unique_lock helper_lock{search->mutex_};
+                while (search->search_next(helper_lock)) {
+                }
+                --search->helpers_;
+            });
+        }
+        lock.lock();
+        while (!pieces_[index].done) {
+            if (!search_next(lock)) {
+                searched_.wait(lock);
+            }
+        }
+    }
+
+    /**
+     * @brief Stops claiming pieces and waits for the ones being searched.
+     */
+    void finish() {
+        std::unique_lock lock{mutex_};
+        limit_ = next_;
+        searched_.wait(lock, [this] {
+            return std::all_of(pieces_.begin(), pieces_.begin() + static_cast<ptrdiff_t>(next_),
+                               [](const Piece& piece) { return piece.done; });
+        });
+    }
+
+    /**
+     * @brief Claims and searches the next piece within the window, unlocking meanwhile.
+     * @return false if there was no piece to claim.
+     */
+    bool search_next(std::unique_lock<std::mutex>& lock) {
+        if (next_ >= limit_) {
+            return false;
+        }
+        Piece& piece = pieces_[next_++];
+        lock.unlock();
+        {
+            const Stats::Scope scope{Stats::Phase::Matching};
+            search_chunk(piece.lines, matcher_, piece, piece.line_breaks);
+        }
+        lock.lock();
+        piece.done = true;
+        searched_.notify_all();
+        return true;
+    }
+
+    const Matcher& matcher_;
+    ThreadPool& pool_;
+    const size_t window_; ///< Pieces that may be searched ahead of the one written next
+    std::vector<Piece> pieces_{};
+
+    std::mutex mutex_;
+    std::condition_variable searched_;
+    size_t next_ = 0;    ///< The piece claimed next
+    size_t limit_ = 0;   ///< Pieces from here on may not be claimed yet
+    size_t helpers_ = 0; ///< Helper tasks submitted and not finished
+};
+
+/**
+ * @brief What the search of every file needs.
+ */
+template <typename Matcher>
+struct SearchContext {
+    const Matcher& matcher;  ///< Decides which lines match
+    ThreadPool& pool;        ///< Helps searching large files
+    Output& output;          ///< Receives the matching lines
+    bool search_zip = false; ///< Decompress compressed files instead of skipping them
+    bool stream = false;     ///< The input is a pipe, whose lines go out after every chunk
+};
+
+/**
+ * @brief Searches a chunk, splitting it across the pool if it is large.
+ *
+ * The chunk is announced to results as the text its context lines come from.
+ *
+ * @return false if the search stopped early because results wanted no further lines.
+ */
+template <typename Matcher>
+bool search_text(const std::string_view chunk, const SearchContext<Matcher>& context, Output::FileResults& results,
+                 size_t& line_num) {
+    results.begin_text(chunk);
+    const bool more = chunk.size() >= ParallelSearch<Matcher>::kMinSize && context.pool.size() > 1
+                          ? ParallelSearch<Matcher>::run(chunk, context.matcher, context.pool, results, line_num)
+                          : search_chunk(chunk, context.matcher, results, line_num);
+    results.end_text();
+    return more;
+}
+
+/**
+ * @brief Hands out a file already read in one piece the way FileReader hands out chunks.
+ */
+struct WholeFile {
+    std::string_view contents;
+
+    std::string_view head() const { return contents; }
+    bool next(std::string_view&) { return false; }
+};
+
+/**
+ * @brief Searches the chunks of a file handed out by a FileReader, Decompressor or WholeFile.
+ *
+ * The first chunk decides the encoding: binary files are skipped and UTF-16 files with a
+ * byte order mark are converted to UTF-8 before the search. The search stops as soon as the
+ * output wants no further lines of the file, or the pool is cancelled.
+ *
+ * The lines scanned are counted for --stats from the line numbers the search works out anyway.
+ *
+ * @param source The file, its first chunk already taken.
+ * @param chunk The first chunk.
+ * @param context The search configuration.
+ * @param results Receives the matching lines.
+ */
+template <typename Matcher, typename Source>
+void search_chunks(Source& source, std::string_view chunk, const SearchContext<Matcher>& context,
+                   Output::FileResults& results) {
+    size_t line_num = 0;
+    const Encoding encoding = detect_encoding(source.head());
+    switch (encoding) {
+    case Encoding::Binary:
+        Stats::add(Stats::Counter::SkippedBinary, 1);
+        return;
+    case Encoding::Utf16LE:
+    case Encoding::Utf16BE: {
+        // Chunks end at a '\n' byte, which need not be a UTF-16 line break, so the whole file is
+        // converted before it is searched.
+        std::string text{chunk};
+        while (source.next(chunk)) {
+            text += chunk;
+        }
+        const Stats::Scope scope{Stats::Phase::Matching};
+        const std::string utf8 = utf16_to_utf8(std::string_view{text}.substr(2), encoding == Encoding::Utf16BE);
+        search_text(utf8, context, results, line_num);
+        Stats::add(Stats::Counter::LinesScanned, line_num);
+        return;
+    }
+    case Encoding::Text:
+        break;
+    }
+    while (true) {
+        bool more = false;
+        {
+            const Stats::Scope scope{Stats::Phase::Matching};
+            more = search_text(chunk, context, results, line_num);
+        }
+        if (!more || context.pool.cancelled()) {
+            break;
+        }
+        if (context.stream) {
+            results.flush(); // The next chunk may be long in coming
+        }
+        const Stats::Scope scope{Stats::Phase::Io};
+        if (!source.next(chunk)) {
+            break;
+        }
+    }
+    Stats::add(Stats::Counter::LinesScanned, line_num);
+}
+
+/**
+ * @brief Searches a compressed file if --search-zip is set and its format is recognised.
+ *
+ * @param input The first part of the file.
+ * @param reader Supplies the rest of the file, or nullptr if the input is all of it.
+ * @param context The search configuration.
+ * @param results Receives the matching lines.
+ * @return false if the file is to be searched as it is.
+ */
+template <typename Matcher>
+bool search_compressed(const std::string_view input, FileReader* reader, const SearchContext<Matcher>& context,
+                       Output::FileResults& results) {
+    const Compression compression = context.search_zip ? detect_compression(input) : Compression::None;
+    if (compression == Compression::None) {
+        return false;
+    }
+    // Formats this build cannot decompress are skipped like any other binary file.
+    auto decompressor = Decompressor::create(compression, input, reader, context.pool);
+    if (decompressor == nullptr) {
+        Stats::add(Stats::Counter::SkippedBinary, 1);
+        return true;
+    }
+    std::string_view chunk{};
+    bool decompressed = false;
+    {
+        const Stats::Scope scope{Stats::Phase::Io};
+        decompressed = decompressor->next(chunk);
+    }
+    if (decompressed) {
+        search_chunks(*decompressor, chunk, context, results);
+    }
+    return true;
+}
+
+/**
+ * @brief Searches a file opened by a FileReader, decompressing it with --search-zip.
+ *
+ * @param reader The file.
+ * @param context The search configuration.
+ * @param results Receives the matching lines.
+ */
+template <typename Matcher>
+void search_reader(FileReader& reader, const SearchContext<Matcher>& context, Output::FileResults& results) {
+    std::optional<Stats::Scope> io{std::in_place, Stats::Phase::Io};
+    std::string_view chunk{};
+    if (!reader.is_open() || !reader.next(chunk)) {
+        return;
+    }
+    io.reset();
+    if (search_compressed(chunk, &reader, context, results)) {
+        return;
+    }
+    search_chunks(reader, chunk, context, results);
+}
+
 /**
  * @brief Searches the given file for matches to the pattern.
  *
+ * The file is opened once and consumed in large chunks which are searched as a whole.
+ * Memory-mapped files come as a single chunk, which is split across the pool when it is
+ * large. With --search-zip, compressed files are decompressed on the fly.
+ *
  * @param filePath Path to the file being searched.
- * @param matcher The matcher object used to determine pattern match.
- * @param output_mutex Mutex used to guard console output.
+ * @param context The search configuration.
+ * @param results Receives the matching lines.
  */
-void search_file(const fs::path& filePath, const IMatcher& matcher, std::mutex& output_mutex) {
-    std::ifstream file{filePath};
-    if (!file) {
+template <typename Matcher>
+void search_file(const std::string& filePath, const SearchContext<Matcher>& context, Output::FileResults& results) {
+    std::optional<Stats::Scope> io{std::in_place, Stats::Phase::Io};
+    FileReader reader{filePath.c_str()};
+    io.reset();
+    search_reader(reader, context, results);
+}
+
+/**
+ * @brief Searches stdin, for `-` in place of the directory.
+ *
+ * A pipe is read in chunks of whatever has arrived, up to FileReader's buffer size, and the
+ * matching lines of every chunk are handed to the writer before the next read, so a search
+ * at the end of a `tail -f` pipeline prints them as they come. A line split across two reads
+ * is carried over by the FileReader and searched once it is complete. Redirected files are
+ * memory-mapped like any other.
+ *
+ * @param options The search configuration.
+ * @param pool Helps searching large chunks.
+ * @param matcher The matcher used to determine whether a line satisfies the query.
+ * @param output Receives the matching lines.
+ */
+template <typename Matcher>
+void search_stdin(const SearchOptions& options, ThreadPool& pool, const Matcher& matcher, Output& output) {
+    constexpr int stdin_fd = 0;
+    const SearchContext<Matcher> context{matcher, pool, output, options.search_zip, true};
+    auto results = output.begin_file(kStdinName, 0);
+    FileReader reader{stdin_fd};
+    search_reader(reader, context, results);
+}
+
+/**
+ * @brief Searches the contents of a file read in one piece.
+ *
+ * Counterpart to search_file() for files the AsyncReader has read already.
+ *
+ * @param contents The whole file.
+ * @param context The search configuration.
+ * @param results Receives the matching lines.
+ */
+template <typename Matcher>
+void search_buffer(const std::string_view contents, const SearchContext<Matcher>& context,
+                   Output::FileResults& results) {
+    Stats::add(Stats::Counter::BytesRead, contents.size());
+    if (contents.empty() || search_compressed(contents, nullptr, context, results)) {
         return;
     }
-    std::string line{};
-    size_t line_num = 0;
-    while (std::getline(file, line)) {
-        ++line_num;
-        if (matcher.match(line)) {
-            std::lock_guard lock{output_mutex};
-            std::cout << filePath << ", line num: " << line_num << ": " << line << std::endl;
+    WholeFile file{contents};
+    search_chunks(file, contents, context, results);
+}
+
+/**
+ * @brief Spells out everything make_matcher() builds a matcher from, as the key of a cache.
+ */
+std::string matcher_key(const SearchOptions& options) {
+    std::string key{options.use_regex ? 'r' : 's', options.ignore_case ? 'i' : 'c',
+                    options.patterns.has_value() ? 'e' : 'q'};
+    for (const auto& pattern : options.patterns.value_or(std::vector<std::string>{options.query})) {
+        key += pattern;
+        key += '\0'; // Patterns never contain one, as command-line arguments cannot
+    }
+    return key;
+}
+
+/**
+ * @brief Works out the literals one of which every matching line contains, for the index.
+ *
+ * @param options The search configuration.
+ * @return The literals, or std::nullopt if a pattern requires no literal.
+ */
+std::optional<std::vector<std::string>> index_literals(const SearchOptions& options) {
+    const auto queries = options.patterns.value_or(std::vector<std::string>{options.query});
+    std::vector<std::string> literals{};
+    for (const auto& query : queries) {
+        if (!options.use_regex) {
+            if (query.find('\n') == std::string::npos) { // Such a query never matches
+                literals.push_back(query);
+            }
+            continue;
+        }
+        const auto root = parse_regex(query, options.ignore_case);
+        if (!root.has_value()) {
+            return std::nullopt;
+        }
+        auto required = Prefilter::required_literals(*root, options.ignore_case);
+        if (required.empty()) {
+            return std::nullopt;
         }
+        literals.insert(literals.end(), required.begin(), required.end());
     }
+    return literals;
 }
 
 /**
  * @brief Recursively walks through a directory and searches files for matching lines.
  *
- * This function traverses the directory tree rooted at the specified path and submits
- * file search tasks to the provided thread pool. It filters out non-regular and binary files,
- * and optionally limits search to files with a given extension.
+ * This function traverses the directory tree rooted at the specified path on the provided
+ * thread pool, every directory being a task of its own, and submits a file search task for
+ * every file found. It filters out non-regular files, skips what the ignore files list and
+ * optionally limits search to files matching --glob, --type and --ext, pruning the directories
+ * they exclude; binary files are recognised and skipped by the search itself.
+ *
+ * Once the pool is saturated, files are searched by the thread that found them instead of
+ * being queued, so memory stays flat however large the tree is.
+ *
+ * With --io-uring, files are read by an AsyncReader where io_uring is available and the
+ * workers only search them, so slow reads overlap each other instead of stalling one worker
+ * each.
+ *
+ * With --quiet the first match cancels the pool, after which no further files are searched.
+ * So does a failed write, as when the reader of the output went away.
+ *
+ * With --sort=path the tree is enumerated in path order by the calling thread while the pool
+ * searches the files, and every file is numbered so the output can be put back in order.
+ * The enumeration pauses while the files finished ahead of their turn fill the reorder
+ * buffer, so the files finished behind a slow one do not pile up in memory.
+ * With --use-index the files come from the trigram index instead of the file system, and
+ * only the ones that may contain the query are searched. The index only holds the files the
+ * ignore files let through, so only the globs, file types and extension are left to apply to
+ * them. Files from a snapshot are filtered the same way.
  *
  * @param options The search configuration, including root path, file extension, and query flags.
- * @param pool A thread pool used to parallelize file search operations.
+ * @param pool A thread pool used to parallelize traversal and file search operations.
  * @param matcher The matcher used to determine whether a line satisfies the query.
- * @param output_mtx A mutex used to synchronize access to the standard output.
+ * @param output Receives the matching lines.
+ * @param snapshot The files of the tree in path order, named by their relative paths, to
+ *                 search instead of walking the tree; or null.
  */
-void walk_directory(const SearchOptions& options, ThreadPool& pool, const IMatcher& matcher, std::mutex& output_mtx) {
-    const auto& root_path = options.root_path;
-    const auto& file_extension = options.file_extension;
-    for (auto& entry : fs::recursive_directory_iterator(root_path)) {
-        if (!entry.is_regular_file()) {
-            continue;
+template <typename Matcher>
+void walk_directory(const SearchOptions& options, ThreadPool& pool, const Matcher& matcher, Output& output,
+                    const std::vector<FilePath>* snapshot = nullptr) {
+    const PathFilter filter{{options.use_ignore_files, options.globs, options.types, options.file_extension}};
+    uint64_t sequence = 0;
+    const SearchContext<Matcher> context{matcher, pool, output, options.search_zip};
+    const bool quiet = options.report == Output::Report::Quiet;
+    std::optional<ResultCache> cache{};
+    if (options.cache_path.has_value()) {
+        cache.emplace(*options.cache_path, matcher_key(options) + (options.search_zip ? 'z' : '-'));
+    }
+    // With --quiet the first match decides the outcome, so it calls off the rest of the search.
+    // Only then are files skipped; they still take their turn in the order, printing nothing.
+    // With --cache, identity is what the lookup found the file to be, and a miss is stored under it.
+    const auto search = [&](const FilePath& file, const uint64_t number, const std::optional<FileIdentity>& identity,
+                            const std::optional<std::string_view> contents) {
+        if (pool.cancelled()) {
+            output.begin_file({}, number);
+            return;
         }
-        const auto& path = entry.path();
-        if (is_binary_file(path)) {
-            continue;
+        // A thread searches one file at a time, so it spells every path out into the same string.
+        static thread_local std::string path{};
+        file.assign_to(path);
+        ResultCache::Result recorded{};
+        const bool record = identity.has_value();
+        {
+            auto results = output.begin_file(path, number);
+            if (record) {
+                results.record(&recorded.lines);
+            }
+            if (contents.has_value()) {
+                search_buffer(*contents, context, results);
+            } else {
+                search_file(path, context, results);
+            }
+            recorded.complete = results.remaining() != 0;
         }
-        if (file_extension.has_value() && file_extension.value() != path.extension()) {
-            continue;
+        if (record && !pool.cancelled()) {
+            cache->store(path, *identity, std::move(recorded));
+        }
+        if ((quiet && output.matched()) || output.failed()) {
+            pool.cancel();
+        }
+    };
+    // With --cache a file that has not changed is not read: its matches are replayed instead.
+    const size_t wanted = options.report == Output::Report::Files || quiet ? 1 : options.max_count;
+    // The identity is taken before the file is read, so a change during the read is seen next time.
+    const auto replay = [&](const FilePath& file, const uint64_t number, std::optional<FileIdentity>& identity) {
+        static thread_local std::string path{};
+        file.assign_to(path);
+        FileIdentity found{};
+        if (!file_identity(path, found)) {
+            return false;
+        }
+        identity = found;
+        const ResultCache::Result* cached = cache->find(path, found, wanted);
+        if (cached == nullptr) {
+            return false;
         }
-        pool.submit([path, &matcher, &output_mtx] { search_file(path, matcher, output_mtx); });
+        Stats::add(Stats::Counter::Cached, 1);
+        {
+            auto results = output.begin_file(path, number);
+            for (const auto& [line_num, line] : cached->lines) {
+                if (!results.add(line_num, line)) {
+                    break;
+                }
+            }
+        }
+        if ((quiet && output.matched()) || output.failed()) {
+            pool.cancel();
+        }
+        return true;
+    };
+    std::unique_ptr<AsyncReader> reader{};
+    if (options.async_io) {
+        reader = AsyncReader::create(pool, search);
+    }
+    const FileCallback on_file = [&](const FilePath& file) {
+        Stats::add(Stats::Counter::FilesEnumerated, 1);
+        if (pool.cancelled()) {
+            return;
+        }
+        if (options.sort_files) {
+            output.wait_for_turn(sequence); // The reorder buffer is full: let the pool catch up
+        }
+        const uint64_t number = options.sort_files ? sequence++ : 0;
+        std::optional<FileIdentity> identity{};
+        if (cache.has_value() && replay(file, number, identity)) {
+            return;
+        }
+        if (reader != nullptr && reader->read(file, number, identity)) {
+            return;
+        }
+        if (pool.saturated()) {
+            search(file, number, identity, std::nullopt); // Backpressure: the producer waits by working
+            return;
+        }
+        if (identity.has_value()) {
+            // Too large for a task's inline storage, but a miss allocates its cache entry anyway.
+            pool.submit([file, &search, number, identity] { search(file, number, identity, std::nullopt); });
+        } else {
+            pool.submit([file, &search, number] { search(file, number, std::nullopt, std::nullopt); });
+        }
+    };
+    // The index and the snapshot list the files in path order on this thread, as sorting requires.
+    const FileCallback on_candidate = [&](const FilePath& file) {
+        if (filter.accepts_file(file.name())) {
+            on_file(file);
+        }
+    };
+    if (snapshot != nullptr) {
+        for (const auto& file : *snapshot) {
+            on_candidate(file);
+        }
+    } else if (options.use_index) {
+        TrigramIndex::open(options.root_path)
+            ->for_each_candidate(options.root_path, index_literals(options), on_candidate);
+    } else {
+        walk_tree(options.root_path, pool, on_file, options.sort_files ? WalkOrder::Path : WalkOrder::Any, &filter);
+    }
+    if (reader != nullptr) {
+        reader->wait();
+    }
+    pool.wait();
+    if (cache.has_value()) {
+        cache->save(!pool.cancelled());
     }
 }
 
+/**
+ * @brief The matcher of a search, as whichever concrete class make_matcher() picks.
+ */
+using AnyMatcher = std::variant<std::unique_ptr<const RegexMatcher>, std::unique_ptr<const SubstringMatcher>,
+                                std::unique_ptr<const MultiSubstringMatcher>>;
+
 /**
  * @brief Creates a matcher based on the search options.
  *
- * This function constructs a matcher object based on whether regex mode is enabled
- * and whether case should be ignored. It returns a smart pointer to the appropriate
- * matcher implementation.
+ * The QueryPlan of the patterns picks the cheapest engine that finds them: regexes that are
+ * plain literals or alternations of literals are searched like substrings, and only real
+ * regexes compile an automaton. Several patterns are compiled into a single matcher, so the
+ * files are still read only once.
+ *
+ * This is the only place the kind of matcher is decided: the search is passed the matcher as
+ * its concrete class, so the whole scan is instantiated for it and never dispatches on the
+ * matcher again.
  *
  * @param options The search configuration including query string, flags for regex and case sensitivity.
- * @return A unique pointer to a matcher object capable of evaluating lines against the query.
+ * @return The matcher.
  */
-std::unique_ptr<IMatcher> create_matcher(const SearchOptions& options) {
-    if (options.use_regex) {
-        return std::make_unique<RegexMatcher>(options.query, options.ignore_case);
+AnyMatcher make_matcher(const SearchOptions& options) {
+    const auto patterns = options.patterns.value_or(std::vector<std::string>{options.query});
+    switch (QueryPlan plan = QueryPlan::create(patterns, options.use_regex); plan.kind) {
+    case QueryPlan::Kind::Literal:
+        return std::make_unique<const SubstringMatcher>(std::move(plan.literals.front()), options.ignore_case);
+    case QueryPlan::Kind::Alternation:
+        return std::make_unique<const MultiSubstringMatcher>(std::move(plan.literals), options.ignore_case);
+    case QueryPlan::Kind::Regex:
+        break;
     }
-    return std::make_unique<SubstringMatcher>(options.query, options.ignore_case);
+    return std::make_unique<const RegexMatcher>(patterns, options.ignore_case);
+}
+
+/**
+ * @brief Runs a search with a matcher as its concrete class.
+ *
+ * @param matcher The matcher.
+ * @param search Called with the matcher, as `search(const auto& matcher)`.
+ */
+template <typename Search>
+void with_matcher(const AnyMatcher& matcher, Search&& search) {
+    std::visit([&search](const auto& concrete) { search(*concrete); }, matcher);
+}
+
+/**
+ * @brief Creates a matcher based on the search options and runs the search with it.
+ *
+ * @param options The search configuration.
+ * @param search Called with the matcher, as `search(const auto& matcher)`.
+ */
+template <typename Search>
+void create_matcher(const SearchOptions& options, Search&& search) {
+    with_matcher(make_matcher(options), std::forward<Search>(search));
+}
+
+/**
+ * @class MatcherCache
+ * @brief Keeps the matchers of the latest queries of a server, so repeating a query skips compiling it.
+ *
+ * Matchers are looked up by everything make_matcher() builds them from; once kCapacity are
+ * kept, the least recently used one is dropped.
+ */
+class MatcherCache final {
+public:
+    static constexpr size_t kCapacity = 64;
+
+    /**
+     * @brief Returns the matcher of a query, creating it if it is not cached.
+     *
+     * @param options The search configuration.
+     * @return The matcher, valid until kCapacity other queries have been looked up.
+     */
+    const AnyMatcher& get(const SearchOptions& options) {
+        std::string key = matcher_key(options);
+        if (const auto it = index_.find(key); it != index_.end()) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->second;
+        }
+        entries_.emplace_front(key, make_matcher(options));
+        index_.emplace(std::move(key), entries_.begin());
+        if (entries_.size() > kCapacity) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        return entries_.front().second;
+    }
+
+private:
+    using Entry = std::pair<std::string, AnyMatcher>;
+
+    std::list<Entry> entries_{}; ///< Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_{};
+};
+
+/**
+ * @class TreeSnapshot
+ * @brief The files of a directory tree, kept by a server so a query does not walk the tree.
+ *
+ * The tree is walked with its ignore files, and the files are kept in path order under their
+ * paths relative to the root, ready to be filtered like the files of the trigram index. A
+ * TreeWatcher thread marks the snapshot stale at the first change to the tree, and the next
+ * query walks it again. Only the list of files is kept: their contents are read by every query.
+ */
+class TreeSnapshot final {
+public:
+    /**
+     * @brief Starts watching the tree and walks it.
+     *
+     * The watches are in place before the walk, so a file created meanwhile is either found
+     * by the walk or marks the snapshot stale. The watching thread is detached, as the server
+     * only ends with its process.
+     *
+     * @throws fs::filesystem_error If the root is not a readable directory.
+     */
+    TreeSnapshot(fs::path root, ThreadPool& pool) : root_(std::move(root)) {
+        watcher_.watch(root_);
+        walk(pool);
+        std::thread{[this] {
+            while (true) {
+                watcher_.wait();
+                stale_.store(true, std::memory_order_release);
+            }
+        }}.detach();
+    }
+
+    /**
+     * @brief Returns the files, walking the tree again first if it changed since the last walk.
+     *
+     * Must not be called while a search still uses the files returned before.
+     */
+    const std::vector<FilePath>& files(ThreadPool& pool) {
+        if (stale_.exchange(false, std::memory_order_acquire)) {
+            walk(pool); // A change during the walk marks the snapshot stale again
+        }
+        return files_;
+    }
+
+private:
+    void walk(ThreadPool& pool) {
+        auto directory = std::make_shared<FilePath::Directory>(root_);
+        std::string prefix{};
+        FilePath{directory, {}}.assign_to(prefix);
+        std::vector<FilePath> files{};
+        std::mutex mutex{};
+        const PathFilter filter{PathFilter::Options{}};
+        walk_tree(root_, pool, [&](const FilePath& found) {
+            static thread_local std::string path{};
+            found.assign_to(path);
+            const std::string_view relative = std::string_view{path}.substr(prefix.size());
+            std::lock_guard lock{mutex};
+            files.emplace_back(directory, directory->store(relative));
+        }, WalkOrder::Any, &filter);
+        // Comparing '/' below every other byte sorts the paths the way walking them in order does.
+        const auto component_order = [](const char a, const char b) {
+            return (a == '/' ? 0 : static_cast<unsigned char>(a) + 1) <
+                   (b == '/' ? 0 : static_cast<unsigned char>(b) + 1);
+        };
+        std::sort(files.begin(), files.end(), [&component_order](const FilePath& a, const FilePath& b) {
+            return std::lexicographical_compare(a.name().begin(), a.name().end(), b.name().begin(), b.name().end(),
+                                                component_order);
+        });
+        files_ = std::move(files);
+    }
+
+    const fs::path root_;
+    TreeWatcher watcher_{std::chrono::milliseconds{0}};
+    std::vector<FilePath> files_{};
+    std::atomic_bool stale_{false};
+};
+
+/**
+ * @brief Reads a pattern file, one pattern per line.
+ *
+ * @param path Path to the pattern file.
+ * @param patterns Receives the patterns.
+ */
+void read_patterns(const fs::path& path, std::vector<std::string>& patterns) {
+    std::ifstream file{path};
+    if (!file) {
+        throw std::runtime_error("cannot read pattern file " + path.string());
+    }
+    for (std::string line; std::getline(file, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        patterns.push_back(std::move(line));
+    }
+}
+
+/**
+ * @brief Parses the numeric argument of an option.
+ *
+ * @param text The number.
+ * @param option The option, for the error message.
+ * @param minimum The smallest number accepted, 0 or 1.
+ * @return The number.
+ */
+size_t parse_number(const std::string& text, const std::string_view option, const size_t minimum) {
+    size_t number = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (error != std::errc{} || end != text.data() + text.size() || number < minimum) {
+        throw std::invalid_argument(std::string{option} + " requires a " +
+                                    (minimum == 0 ? "non-negative" : "positive") + " number, got \"" + text + "\"");
+    }
+    return number;
 }
 
 /**
  * @brief Extracts search options from command-line arguments.
  *
- * @param argc Argument count.
- * @param argv Argument vector.
+ * Without -e or -f the first two positional arguments are the query and the directory; with
+ * them the patterns come from the flags and the first positional argument is the directory.
+ *
+ * @param args The arguments, without the program name.
+ * @param root The directory of a query sent to a server, which the arguments must not name;
+ *             std::nullopt to take it from them.
  * @return SearchOptions Parsed search configuration.
  */
-SearchOptions extract_arguments(const int argc, char* argv[]) {
+SearchOptions extract_arguments(const std::vector<std::string>& args,
+                                const std::optional<fs::path>& root = std::nullopt) {
     SearchOptions options{};
-    options.query = argv[1];
-    options.root_path = argv[2];
-    for (int i = 3; i < argc; ++i) {
-        if (std::string arg = argv[i]; arg == "--regex") {
+    std::vector<std::string> positional{};
+    std::optional<size_t> after_context{}; // -A and -B override -C whatever their order
+    std::optional<size_t> before_context{};
+    size_t context = 0;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (std::string arg = args[i]; arg == "--regex") {
             options.use_regex = true;
         } else if (arg == "--ignore-case") {
             options.ignore_case = true;
+        } else if (arg == "--index") {
+            options.build_index = true;
+        } else if (arg == "--watch") {
+            options.watch_index = true;
+        } else if (arg == "--use-index") {
+            options.use_index = true;
+        } else if (arg == "--sort-files" || arg == "--sort=path") {
+            options.sort_files = true;
+        } else if (arg == "--sort=none") {
+            options.sort_files = false;
+        } else if (arg.rfind("--sort=", 0) == 0) {
+            throw std::invalid_argument("--sort requires path or none, got \"" + arg.substr(7) + "\"");
+        } else if (arg == "--io-uring") {
+            options.async_io = true;
+        } else if (arg == "--numa") {
+            options.numa = true;
+        } else if (arg == "--search-zip" || arg == "-z") {
+            options.search_zip = true;
+        } else if (arg == "--files-with-matches" || arg == "-l") {
+            options.report = Output::Report::Files;
+        } else if (arg == "--count" || arg == "-c") {
+            options.report = Output::Report::Count;
+        } else if (arg == "--quiet" || arg == "-q") {
+            options.report = Output::Report::Quiet;
+        } else if (arg == "--json") {
+            options.format = Output::Format::Json;
+        } else if (arg == "--binary") {
+            options.format = Output::Format::Binary;
+        } else if (arg.rfind("--max-count=", 0) == 0) {
+            options.max_count = parse_number(arg.substr(12), "--max-count", 1);
+        } else if (arg.rfind("--after-context=", 0) == 0) {
+            after_context = parse_number(arg.substr(16), "--after-context", 0);
+        } else if (arg.rfind("--before-context=", 0) == 0) {
+            before_context = parse_number(arg.substr(17), "--before-context", 0);
+        } else if (arg.rfind("--context=", 0) == 0) {
+            context = parse_number(arg.substr(10), "--context", 0);
+        } else if (arg == "-A" || arg == "-B" || arg == "-C") {
+            if (i + 1 == args.size()) {
+                throw std::invalid_argument(arg + " requires an argument");
+            }
+            const size_t lines = parse_number(args[++i], arg, 0);
+            if (arg == "-A") {
+                after_context = lines;
+            } else if (arg == "-B") {
+                before_context = lines;
+            } else {
+                context = lines;
+            }
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            options.trace_path = arg.substr(8);
         } else if (arg.rfind("--ext=", 0) == 0) {
             options.file_extension = arg.substr(6);
+        } else if (arg.rfind("--glob=", 0) == 0) {
+            options.globs.push_back(arg.substr(7));
+        } else if (arg.rfind("--type=", 0) == 0) {
+            options.types.push_back(arg.substr(7));
+        } else if (arg == "--no-ignore") {
+            options.use_ignore_files = false;
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            options.serve_socket = arg.substr(8);
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            options.cache_path = arg.substr(8);
+        } else if (arg == "-e" || arg == "-f") {
+            if (i + 1 == args.size()) {
+                throw std::invalid_argument(arg + " requires an argument");
+            }
+            auto& patterns = options.patterns.has_value() ? *options.patterns : options.patterns.emplace();
+            if (arg == "-e") {
+                patterns.push_back(args[++i]);
+            } else {
+                read_patterns(args[++i], patterns);
+            }
+        } else {
+            positional.push_back(std::move(arg));
         }
     }
+    const bool query_given = !options.patterns.has_value() && !options.build_index && !options.serve_socket.has_value();
+    const size_t required = (query_given ? 1 : 0) + (root.has_value() ? 0 : 1);
+    if (positional.size() < required) {
+        throw std::invalid_argument(root.has_value() ? "missing <query> argument" : "missing <directory> argument");
+    }
+    if (root.has_value() && positional.size() > required) {
+        throw std::invalid_argument("a query sent to a server searches the served directory and cannot name one");
+    }
+    if (query_given) {
+        options.query = positional.front();
+    }
+    options.root_path = root.has_value() ? *root : fs::path{positional[required - 1]};
+    options.context = {before_context.value_or(context), after_context.value_or(context)};
+    const bool context_lines = options.context.before != 0 || options.context.after != 0;
+    if (options.cache_path.has_value() && context_lines) {
+        throw std::invalid_argument("--cache cannot be combined with -A, -B or -C");
+    }
+    // The index is built with the ignore files, so the files they list are not in it.
+    if (options.use_index && !options.use_ignore_files) {
+        throw std::invalid_argument("--use-index cannot be combined with --no-ignore");
+    }
+    // Records carry byte offsets, which the cache does not keep, and have no form for context lines.
+    if (options.format != Output::Format::Text && (options.cache_path.has_value() || context_lines)) {
+        throw std::invalid_argument("--json and --binary cannot be combined with --cache, -A, -B or -C");
+    }
     return options;
 }
+
+/**
+ * @brief Creates the thread pool of a search, index build or server.
+ *
+ * With --io-uring the workers only compute, since the files are read for them; otherwise they
+ * read the files themselves. With --numa they are pinned to the NUMA nodes of the machine.
+ *
+ * @param options The configuration.
+ * @return The pool.
+ */
+ThreadPool make_pool(const SearchOptions& options) {
+    const Workload workload = options.async_io ? Workload::Compute : Workload::Reading;
+    return ThreadPool{get_threads_number(workload),
+                      options.numa ? std::optional{CpuTopology::detect()} : std::nullopt};
+}
+
+/**
+ * @brief Returns the warning printed instead of searching for a query that looks like a regex
+ *        without --regex, or an empty string.
+ */
+std::string regex_warning(const SearchOptions& options) {
+    if (options.use_regex || options.patterns.has_value() || !contains_regex_chars(options.query)) {
+        return {};
+    }
+    return "Warning: The pattern \"" + options.query +
+           "\" looks like a regular expression, but --regex flag was not set.";
+}
+
+/**
+ * @brief Answers the queries sent to a socket with --connect until the process is stopped.
+ *
+ * Everything a single search sets up in advance is kept between queries: the thread pool,
+ * the files of the directory tree in a TreeSnapshot, and the matchers of recent queries in a
+ * MatcherCache. A query is searched exactly like the same command line would be, in the
+ * served directory; only --no-ignore and --use-index queries still walk the tree or read the
+ * index. Since the output streams to the client, a client that goes away, because its query
+ * was superseded, cancels the search at the next write.
+ *
+ * @param options The configuration of the server: its socket and directory.
+ * @throws std::runtime_error If the socket cannot be listened on.
+ * @throws fs::filesystem_error If the directory cannot be read.
+ */
+[[noreturn]] void serve(const SearchOptions& options) {
+    QueryServer server{*options.serve_socket};
+    ThreadPool pool{make_pool(options)};
+    TreeSnapshot snapshot{options.root_path, pool};
+    MatcherCache matchers{};
+    server.run([&](const std::vector<std::string>& args, const int fd) -> QueryServer::Reply {
+        const SearchOptions query = extract_arguments(args, options.root_path);
+        if (query.build_index || query.watch_index || query.stats || query.trace_path.has_value() ||
+            query.serve_socket.has_value()) {
+            throw std::invalid_argument("--index, --watch, --stats, --trace and --serve cannot be sent to a server");
+        }
+        if (std::string warning = regex_warning(query); !warning.empty()) {
+            return {1, std::move(warning)};
+        }
+        pool.resume(); // The previous query may have stopped early
+        bool matched = false;
+        with_matcher(matchers.get(query), [&](const auto& matcher) {
+            Output output{query.sort_files, query.report, query.max_count, query.context, fd, query.format, &matcher};
+            const bool use_snapshot = query.use_ignore_files && !query.use_index;
+            walk_directory(query, pool, matcher, output, use_snapshot ? &snapshot.files(pool) : nullptr);
+            matched = output.matched();
+        });
+        return {query.report == Output::Report::Quiet && !matched ? 1 : 0, {}};
+    });
+}
 } // namespace mb
 
 namespace {
@@ -126,7 +1097,21 @@ namespace {
  * @param program_name The name of the executable, typically from argv[0].
  */
 void help(const std::string& program_name) {
-    std::cerr << "Usage: " << program_name << " <query> <directory> [--regex] [--ignore-case] [--ext=.txt]"
+    std::cerr << "Usage: " << program_name
+              << " <query> <directory> [--regex] [--ignore-case] [--ext=.txt] [--sort=path] [--io-uring] [--numa]"
+                 " [--search-zip]\n"
+              << "       " << program_name
+              << " <query> <directory> [options] [--glob=<glob>...] [--type=<type>...] [--no-ignore]\n"
+              << "       " << program_name << " <query> <directory> [options] [--stats] [--trace=<file.json>]\n"
+              << "       " << program_name
+              << " <query> <directory> [options] [-l | -c | -q] [--max-count=N] [-A N] [-B N] [-C N]\n"
+              << "       " << program_name
+              << " <query> <directory> [options] [--json | --binary]   (records with byte offsets and match spans)\n"
+              << "       " << program_name << " -e <query> [-e <query>...] [-f <file>] <directory> [options]\n"
+              << "       " << program_name << " <query> - [options]   (searches stdin)\n"
+              << "       " << program_name << " --index [--watch] <directory>   (then search with --use-index)\n"
+              << "       " << program_name
+              << " --serve=<socket> <directory>   (then search with --connect=<socket> <query> [options])"
               << std::endl;
 }
 } // namespace
@@ -138,21 +1123,65 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     try {
-        auto options = mb::extract_arguments(argc, argv);
-        if (!options.use_regex && mb::contains_regex_chars(options.query)) {
-            std::cerr << "Warning: The pattern \"" << options.query
-                      << "\" looks like a regular expression, but --regex flag was not set.\n";
+        std::vector<std::string> args{argv + 1, argv + argc};
+        if (const auto connect =
+                std::ranges::find_if(args, [](const std::string& arg) { return arg.starts_with("--connect="); });
+            connect != args.end()) {
+            // The client only passes the command line on; the server parses and searches it.
+            const fs::path socket_path = connect->substr(10);
+            args.erase(connect);
+            return mb::QueryServer::query(socket_path, args);
+        }
+        auto options = mb::extract_arguments(args);
+        if (options.serve_socket.has_value()) {
+            mb::serve(options);
+        }
+        if (options.build_index) {
+            mb::ThreadPool pool{mb::make_pool(options)};
+            const auto report = [&options](const mb::TrigramIndex::BuildStats& stats) {
+                std::cout << "Indexed " << stats.files << " files (" << stats.read << " read) into "
+                          << options.root_path / mb::TrigramIndex::kFileName << std::endl;
+            };
+            if (options.watch_index) {
+                mb::TrigramIndex::watch(options.root_path, pool, report);
+            }
+            report(mb::TrigramIndex::build(options.root_path, pool));
+            return 0;
+        }
+        if (const std::string warning = mb::regex_warning(options); !warning.empty()) {
+            std::cerr << warning << '\n';
             return 1;
         }
-        auto matcher = mb::create_matcher(options);
-        auto num_threads = mb::get_threads_number();
-        mb::ThreadPool pool{num_threads};
-        std::mutex output_mutex{};
-        mb::walk_directory(options, pool, *matcher, output_mutex);
+        if (options.stats || options.trace_path.has_value()) {
+            mb::Stats::enable(options.trace_path.has_value());
+        }
+        bool matched = false;
+        mb::create_matcher(options, [&](const auto& matcher) {
+            mb::Output output{options.sort_files, options.report, options.max_count, options.context, 1,
+                              options.format, &matcher};
+            mb::ThreadPool pool{mb::make_pool(options)};
+            if (options.root_path == mb::kStdinArgument) {
+                mb::search_stdin(options, pool, matcher, output);
+            } else {
+                mb::walk_directory(options, pool, matcher, output);
+            }
+            matched = output.matched();
+        }); // The workers and the writer are joined, so their records are complete
+        if (options.stats) {
+            mb::Stats::report(std::cerr);
+        }
+        if (options.trace_path.has_value()) {
+            mb::Stats::write_trace(*options.trace_path);
+        }
+        if (options.report == mb::Output::Report::Quiet) {
+            return matched ? 0 : 1;
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Exception: " << ex.what() << std::endl;
+        return mb::QueryServer::kErrorStatus;
     } catch (...) {
         std::cerr << "Unknown exception!" << std::endl;
+        return mb::QueryServer::kErrorStatus;
     }
     return 0;
 }
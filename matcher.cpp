@@ -1,34 +1,233 @@
 #include "matcher.h"
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
 
 namespace mb {
-RegexMatcher::RegexMatcher(const std::string& query, const bool ignore_case) {
+namespace {
+/**
+ * After this many candidates the prefilter must have skipped at least kMinCandidateGap bytes
+ * per candidate, otherwise its literals are too common and the automaton scans on its own.
+ */
+constexpr size_t kMinCandidates = 64;
+constexpr size_t kMinCandidateGap = 256;
+
+/**
+ * @brief Parses several patterns into one alternation.
+ * @return The alternation, or std::nullopt if a pattern is outside the automaton's subset.
+ */
+std::optional<RegexNode> make_alternation(const std::vector<std::string>& queries, const bool ignore_case) {
+    RegexNode root{};
+    root.kind = RegexNode::Kind::Alternate;
+    for (const auto& query : queries) {
+        auto node = parse_regex(query, ignore_case);
+        if (!node.has_value()) {
+            return std::nullopt;
+        }
+        root.children.push_back(std::move(*node));
+    }
+    if (root.children.size() == 1) {
+        return std::move(root.children.front());
+    }
+    return root;
+}
+} // namespace
+
+std::optional<Match> IMatcher::find(const std::string_view buffer) const {
+    size_t line_begin = 0;
+    while (line_begin < buffer.size()) {
+        const auto* newline =
+            static_cast<const char*>(std::memchr(buffer.data() + line_begin, '\n', buffer.size() - line_begin));
+        const size_t line_end = newline != nullptr ? static_cast<size_t>(newline - buffer.data()) : buffer.size();
+        if (match(buffer.substr(line_begin, line_end - line_begin))) {
+            return Match{line_begin, line_end};
+        }
+        line_begin = line_end + 1;
+    }
+    return std::nullopt;
+}
+
+std::optional<Match> IMatcher::find_in_line(const std::string_view line, const size_t from) const {
+    if (from != 0 || !match(line)) {
+        return std::nullopt;
+    }
+    return Match{0, line.size()};
+}
+
+RegexMatcher::RegexMatcher(const std::string& query, const bool ignore_case)
+    : RegexMatcher(std::vector<std::string>{query}, ignore_case) {}
+
+RegexMatcher::RegexMatcher(const std::vector<std::string>& queries, const bool ignore_case) {
+    if (const auto root = make_alternation(queries, ignore_case); root.has_value()) {
+        dfa_ = LazyDfa::compile(*root);
+        if (dfa_ != nullptr) {
+            prefilter_ = Prefilter::create(*root, ignore_case);
+            return;
+        }
+    }
     auto flags = std::regex::ECMAScript;
     if (ignore_case) {
         flags |= std::regex::icase;
     }
-    pattern_ = std::regex(query, flags);
+    for (const auto& query : queries) {
+        patterns_.emplace_back(query, flags);
+    }
+}
+
+bool RegexMatcher::match(const std::string_view line) const {
+    if (dfa_ != nullptr) {
+        if (prefilter_ != nullptr && Prefilter::Cursor{*prefilter_, line}.next(0) == std::string_view::npos) {
+            return false;
+        }
+        return dfa_->match(line);
+    }
+    return std::ranges::any_of(patterns_, [line](const std::regex& pattern) {
+        return std::regex_search(line.begin(), line.end(), pattern);
+    });
+}
+
+std::optional<Match> RegexMatcher::find(const std::string_view buffer) const {
+    if (dfa_ == nullptr) {
+        return IMatcher::find(buffer);
+    }
+    if (prefilter_ != nullptr) {
+        return find_candidates(buffer);
+    }
+    const size_t pos = dfa_->find(buffer);
+    if (pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    return Match{pos, pos};
+}
+
+std::optional<Match> RegexMatcher::find_in_line(const std::string_view line, const size_t from) const {
+    if (dfa_ != nullptr) {
+        const auto span = dfa_->find_span(line, from);
+        return span.has_value() ? std::optional{Match{span->first, span->second}} : std::nullopt;
+    }
+    std::optional<Match> leftmost{};
+    const auto flags = from == 0 ? std::regex_constants::match_default : std::regex_constants::match_prev_avail;
+    for (const auto& pattern : patterns_) {
+        std::match_results<std::string_view::const_iterator> found{};
+        if (!std::regex_search(line.begin() + static_cast<ptrdiff_t>(from), line.end(), found, pattern, flags)) {
+            continue;
+        }
+        const size_t begin = from + static_cast<size_t>(found.position(0));
+        const size_t end = begin + static_cast<size_t>(found.length(0));
+        if (!leftmost.has_value() || begin < leftmost->begin || (begin == leftmost->begin && end > leftmost->end)) {
+            leftmost = Match{begin, end};
+        }
+    }
+    return leftmost;
 }
 
-bool RegexMatcher::match(const std::string& line) const {
-    return std::regex_search(line, pattern_);
+std::optional<Match> RegexMatcher::find_candidates(const std::string_view buffer) const {
+    Prefilter::Cursor cursor{*prefilter_, buffer};
+    size_t line_begin = 0; // Everything before it has been ruled out
+    size_t candidates = 0;
+    while (line_begin < buffer.size()) {
+        if (candidates >= kMinCandidates && line_begin / candidates < kMinCandidateGap) {
+            const size_t pos = dfa_->find(buffer.substr(line_begin));
+            if (pos == std::string_view::npos) {
+                return std::nullopt;
+            }
+            return Match{line_begin + pos, line_begin + pos};
+        }
+        const size_t hit = cursor.next(line_begin);
+        if (hit == std::string_view::npos) {
+            return std::nullopt;
+        }
+        ++candidates;
+        const size_t previous_break = hit == line_begin ? std::string_view::npos : buffer.rfind('\n', hit - 1);
+        const size_t candidate_begin =
+            previous_break == std::string_view::npos || previous_break < line_begin ? line_begin : previous_break + 1;
+        const auto* end = static_cast<const char*>(std::memchr(buffer.data() + hit, '\n', buffer.size() - hit));
+        const size_t candidate_end = end != nullptr ? static_cast<size_t>(end - buffer.data()) : buffer.size();
+        if (dfa_->match(buffer.substr(candidate_begin, candidate_end - candidate_begin))) {
+            return Match{hit, hit};
+        }
+        line_begin = candidate_end + 1;
+    }
+    return std::nullopt;
 }
 
 SubstringMatcher::SubstringMatcher(std::string query, const bool ignore_case)
-    : query_(std::move(query)), ignore_case_(ignore_case) {
-    if (ignore_case_) {
-        std::ranges::transform(query_, query_.begin(), tolower);
+    : query_(std::move(query)), ignore_case_(ignore_case), matchable_(query_.find('\n') == std::string::npos),
+      searcher_(query_, ignore_case_) {}
+
+bool SubstringMatcher::match(const std::string_view line) const {
+    return searcher_.find(line) != std::string_view::npos;
+}
+
+std::optional<Match> SubstringMatcher::find_in_line(const std::string_view line, const size_t from) const {
+    const size_t pos = matchable_ ? searcher_.find(line.substr(from)) : std::string_view::npos;
+    if (pos == std::string_view::npos) {
+        return std::nullopt;
     }
+    return Match{from + pos, from + pos + query_.size()};
 }
 
-bool SubstringMatcher::match(const std::string& line) const {
-    if (ignore_case_) {
-        std::string lower_line = line;
-        std::ranges::transform(lower_line, lower_line.begin(), tolower);
-        return lower_line.find(query_) != std::string::npos;
+MultiSubstringMatcher::MultiSubstringMatcher(std::vector<std::string> queries, const bool ignore_case)
+    : searcher_(
+          [&queries] {
+              // A line never contains its own line break, so such a query cannot match anything.
+              std::erase_if(queries, [](const std::string& query) { return query.find('\n') != std::string::npos; });
+              return std::move(queries);
+          }(),
+          ignore_case),
+      ignore_case_(ignore_case), sorted_needles_(searcher_.needles()) {
+    std::ranges::sort(sorted_needles_);
+    for (const auto& needle : sorted_needles_) {
+        needle_sizes_.push_back(needle.size());
     }
-    return line.find(query_) != std::string::npos;
+    std::ranges::sort(needle_sizes_, std::greater{});
+    needle_sizes_.erase(std::unique(needle_sizes_.begin(), needle_sizes_.end()), needle_sizes_.end());
 }
 
+bool MultiSubstringMatcher::match(const std::string_view line) const { return searcher_.find(line).has_value(); }
+
+std::optional<Match> MultiSubstringMatcher::find(const std::string_view buffer) const {
+    const auto hit = searcher_.find(buffer);
+    if (!hit.has_value()) {
+        return std::nullopt;
+    }
+    return Match{hit->offset, hit->offset + hit->length};
+}
+
+std::optional<Match> MultiSubstringMatcher::find_in_line(const std::string_view line, const size_t from) const {
+    const auto hit = searcher_.find(line.substr(from));
+    if (!hit.has_value()) {
+        return std::nullopt;
+    }
+    // No occurrence ends before the hit starts, so the leftmost one starts at most a needle
+    // size before it.
+    const size_t hit_begin = from + hit->offset;
+    const size_t longest = needle_sizes_.front();
+    for (size_t pos = hit_begin >= from + longest ? hit_begin + 1 - longest : from; pos < hit_begin; ++pos) {
+        if (const auto size = longest_at(line, pos); size.has_value()) {
+            return Match{pos, pos + *size};
+        }
+    }
+    return Match{hit_begin, hit_begin + longest_at(line, hit_begin).value_or(hit->length)};
+}
+
+std::optional<size_t> MultiSubstringMatcher::longest_at(const std::string_view line, const size_t pos) const {
+    static thread_local std::string folded{};
+    for (const size_t size : needle_sizes_) {
+        if (size > line.size() - pos) {
+            continue;
+        }
+        std::string_view candidate = line.substr(pos, size);
+        if (ignore_case_) {
+            folded.assign(candidate);
+            std::ranges::transform(folded, folded.begin(), to_lower_ascii);
+            candidate = folded;
+        }
+        if (std::ranges::binary_search(sorted_needles_, candidate, std::less{})) {
+            return size;
+        }
+    }
+    return std::nullopt;
+}
 } // namespace mb
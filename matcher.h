@@ -1,8 +1,25 @@
 #pragma once
+#include <memory>
+#include <optional>
 #include <regex>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "lazy_dfa.h"
+#include "literal_search.h"
+#include "multi_literal.h"
+#include "prefilter.h"
 
 namespace mb {
+/**
+ * @brief Byte range of a match inside a searched buffer.
+ */
+struct Match {
+    size_t begin = 0; ///< Offset of the first matched byte
+    size_t end = 0;   ///< Offset one past the last matched byte
+};
+
 /**
  * @class IMatcher
  * @brief Abstract base class for matchers.
@@ -14,10 +31,34 @@ public:
     /**
      * @brief Check if a line matches the query.
      *
-     * @param line The line to check.
+     * @param line The line to check, without its line break.
      * @return true if the line matches.
      */
-    virtual bool match(const std::string& line) const = 0;
+    virtual bool match(std::string_view line) const = 0;
+    /**
+     * @brief Finds the first match in a buffer holding many lines.
+     *
+     * Matches never span a line break. The default implementation splits the buffer into
+     * lines and calls match() on each of them; matchers that can search the buffer as a
+     * whole override it.
+     *
+     * @param buffer The text to search, lines separated by '\n'.
+     * @return The first match, or std::nullopt if no line matches. The default
+     *         implementation reports the whole matching line.
+     */
+    virtual std::optional<Match> find(std::string_view buffer) const;
+    /**
+     * @brief Finds the leftmost match in a line that starts at or after an offset.
+     *
+     * Of the matches starting there, the longest is reported. Used to point out where a line
+     * matches, which takes more work than finding out that it does. The default
+     * implementation reports the whole line if it matches.
+     *
+     * @param line The line, without its line break.
+     * @param from Offset to start looking at; what precedes it still counts for `^`.
+     * @return The match, with offsets into the line, or std::nullopt if there is none.
+     */
+    virtual std::optional<Match> find_in_line(std::string_view line, size_t from) const;
 
     virtual ~IMatcher() = default;
 };
@@ -25,6 +66,16 @@ public:
 /**
  * @class RegexMatcher
  * @brief Regex-based matcher implementation.
+ *
+ * Patterns are matched in linear time by a LazyDfa. Constructs a finite automaton cannot
+ * express (backreferences, lookaheads, word boundaries) fall back to std::regex, which also
+ * reports syntax errors with the usual std::regex_error.
+ *
+ * If every match must contain one of a few literal strings, a Prefilter finds the lines
+ * holding them and the automaton only checks those lines.
+ *
+ * Several patterns are combined into one alternation, so a single automaton scans the input
+ * no matter how many there are.
  */
 class RegexMatcher final : public IMatcher {
 public:
@@ -35,16 +86,45 @@ public:
      * @param ignore_case If true, performs case-insensitive matching.
      */
     explicit RegexMatcher(const std::string& query, bool ignore_case = false);
+    /**
+     * @brief Constructs a RegexMatcher accepting lines that match any of several patterns.
+     *
+     * @param queries Regex patterns.
+     * @param ignore_case If true, performs case-insensitive matching.
+     */
+    explicit RegexMatcher(const std::vector<std::string>& queries, bool ignore_case = false);
     /**
      * @brief Check if a line matches the query.
      *
      * @param line The line to check.
      * @return true if the line matches.
      */
-    bool match(const std::string& line) const override;
+    bool match(std::string_view line) const override;
+    /**
+     * @brief Finds the first matching line in a buffer.
+     *
+     * The automaton scans the whole buffer in one pass, or only the lines the prefilter picks;
+     * the fallback engine goes line by line.
+     *
+     * @param buffer The text to search, lines separated by '\n'.
+     * @return A position inside the first matching line, or std::nullopt if no line matches.
+     */
+    std::optional<Match> find(std::string_view buffer) const override;
+    /**
+     * @brief Finds the leftmost-longest match in a line that starts at or after an offset.
+     *
+     * @param line The line, without its line break.
+     * @param from Offset to start looking at.
+     * @return The match, or std::nullopt if there is none.
+     */
+    std::optional<Match> find_in_line(std::string_view line, size_t from) const override;
 
 private:
-    std::regex pattern_;
+    std::optional<Match> find_candidates(std::string_view buffer) const;
+
+    std::unique_ptr<LazyDfa> dfa_;
+    std::unique_ptr<Prefilter> prefilter_;
+    std::vector<std::regex> patterns_; ///< Fallback engines, one per pattern
 };
 
 /**
@@ -66,10 +146,87 @@ public:
      * @param line The line to check.
      * @return true if the line matches.
      */
-    bool match(const std::string& line) const override;
+    bool match(std::string_view line) const override;
+    /**
+     * @brief Finds the first occurrence of the substring in a buffer.
+     *
+     * The whole buffer is scanned by the vectorized LiteralSearcher kernel. Defined here so
+     * that a search instantiated for this class inlines it.
+     *
+     * @param buffer The text to search, lines separated by '\n'.
+     * @return The first occurrence, or std::nullopt if there is none.
+     */
+    std::optional<Match> find(const std::string_view buffer) const override {
+        const size_t pos = matchable_ ? searcher_.find(buffer) : std::string_view::npos;
+        if (pos == std::string_view::npos) {
+            return std::nullopt;
+        }
+        return Match{pos, pos + query_.size()};
+    }
+    /**
+     * @brief Finds the first occurrence of the substring in a line at or after an offset.
+     *
+     * @param line The line, without its line break.
+     * @param from Offset to start looking at.
+     * @return The occurrence, or std::nullopt if there is none.
+     */
+    std::optional<Match> find_in_line(std::string_view line, size_t from) const override;
 
 private:
     std::string query_;
     bool ignore_case_{};
+    bool matchable_{}; ///< False if the query holds a line break, which no line does
+    LiteralSearcher searcher_;
+};
+
+/**
+ * @class MultiSubstringMatcher
+ * @brief Matches lines containing any of several substrings.
+ *
+ * All substrings are looked for in a single pass by a MultiLiteralSearcher.
+ */
+class MultiSubstringMatcher final : public IMatcher {
+public:
+    /**
+     * @brief Constructs a MultiSubstringMatcher.
+     *
+     * @param queries Substring patterns.
+     * @param ignore_case If true, performs case-insensitive matching.
+     */
+    explicit MultiSubstringMatcher(std::vector<std::string> queries, bool ignore_case = false);
+    /**
+     * @brief Check if a line contains any of the substrings.
+     *
+     * @param line The line to check.
+     * @return true if the line matches.
+     */
+    bool match(std::string_view line) const override;
+    /**
+     * @brief Finds the first occurrence of any substring in a buffer.
+     *
+     * @param buffer The text to search, lines separated by '\n'.
+     * @return The first occurrence, or std::nullopt if there is none.
+     */
+    std::optional<Match> find(std::string_view buffer) const override;
+    /**
+     * @brief Finds the leftmost-longest occurrence of any substring in a line at or after an offset.
+     *
+     * The searcher may report an occurrence to the right of an overlapping one, so the start
+     * positions from where an occurrence overlapping it could begin are checked for the
+     * longest substring starting there.
+     *
+     * @param line The line, without its line break.
+     * @param from Offset to start looking at.
+     * @return The occurrence, or std::nullopt if there is none.
+     */
+    std::optional<Match> find_in_line(std::string_view line, size_t from) const override;
+
+private:
+    std::optional<size_t> longest_at(std::string_view line, size_t pos) const;
+
+    MultiLiteralSearcher searcher_;
+    bool ignore_case_;
+    std::vector<std::string> sorted_needles_{}; ///< The searcher's needles, sorted
+    std::vector<size_t> needle_sizes_{};        ///< Their distinct sizes, longest first
 };
 } // namespace mb
\ No newline at end of file
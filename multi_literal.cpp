@@ -0,0 +1,401 @@
+#include "multi_literal.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+#include "literal_search.h"
+#include "simd.h"
+
+namespace mb {
+namespace {
+constexpr uint32_t kMatchBit = uint32_t{1} << 31; ///< Tags transitions into states that end a needle
+constexpr size_t kMaxDenseEntries = size_t{1} << 22; ///< Cap of the full transition table, 16 MiB
+} // namespace
+
+/**
+ * @brief The Teddy kernels, one per instruction set, and the automaton walks.
+ *
+ * Width is the number of leading needle bytes the Teddy tables cover. Every vector kernel
+ * handles the positions at the end of the haystack that do not fill a whole block with the
+ * scalar kernel, which computes the same bucket bits one position at a time.
+ */
+struct MultiLiteralKernels {
+    using Hit = MultiLiteralSearcher::Hit;
+    using Kernel = MultiLiteralSearcher::Kernel;
+
+    static bool equal(const MultiLiteralSearcher& s, const char* candidate, const std::string& needle) {
+        if (!s.ignore_case_) {
+            return std::memcmp(candidate, needle.data(), needle.size()) == 0;
+        }
+        for (size_t i = 0; i < needle.size(); ++i) {
+            if (to_lower_ascii(candidate[i]) != needle[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Verifies the needles of the given buckets at one position, preferring the longest.
+     */
+    static std::optional<Hit> verify(const MultiLiteralSearcher& s, const char* haystack, const size_t size,
+                                     const size_t pos, uint32_t buckets) {
+        std::optional<Hit> best;
+        for (; buckets != 0; buckets &= buckets - 1) {
+            for (const uint32_t index : s.buckets_[static_cast<size_t>(std::countr_zero(buckets))]) {
+                const std::string& needle = s.needles_[index];
+                if (needle.size() <= size - pos && (!best.has_value() || needle.size() > best->length) &&
+                    equal(s, haystack + pos, needle)) {
+                    best = Hit{pos, needle.size()};
+                }
+            }
+        }
+        return best;
+    }
+
+    static std::optional<Hit> none(const MultiLiteralSearcher&, const char*, size_t) { return std::nullopt; }
+
+    static std::optional<Hit> empty(const MultiLiteralSearcher&, const char*, size_t) { return Hit{}; }
+
+    template <size_t Width>
+    static std::optional<Hit> teddy_from(const MultiLiteralSearcher& s, const char* haystack, const size_t size,
+                                         size_t from) {
+        for (; from + Width <= size; ++from) {
+            uint32_t buckets = 0xff;
+            for (size_t i = 0; i < Width; ++i) {
+                const auto byte = static_cast<unsigned char>(haystack[from + i]);
+                buckets &= s.low_masks_[i][byte & 0x0f] & s.high_masks_[i][byte >> 4];
+            }
+            if (buckets != 0) {
+                if (auto hit = verify(s, haystack, size, from, buckets); hit.has_value()) {
+                    return hit;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    template <size_t Width>
+    static std::optional<Hit> teddy_scalar(const MultiLiteralSearcher& s, const char* haystack, const size_t size) {
+        return teddy_from<Width>(s, haystack, size, 0);
+    }
+
+#ifdef MB_HAVE_SSSE3
+    template <size_t Width>
+    MB_TARGET_SSSE3 static std::optional<Hit> teddy_ssse3(const MultiLiteralSearcher& s, const char* haystack,
+                                                          const size_t size) {
+        constexpr size_t block = 16;
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        __m128i low[Width];
+        __m128i high[Width];
+        for (size_t i = 0; i < Width; ++i) {
+            low[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(s.low_masks_[i]));
+            high[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(s.high_masks_[i]));
+        }
+        size_t pos = 0;
+        for (; pos + block - 1 + Width <= size; pos += block) {
+            __m128i result = _mm_set1_epi8(-1);
+            for (size_t i = 0; i < Width; ++i) {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + pos + i));
+                const __m128i low_bits = _mm_shuffle_epi8(low[i], _mm_and_si128(bytes, nibble));
+                const __m128i high_bits = _mm_shuffle_epi8(high[i], _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+                result = _mm_and_si128(result, _mm_and_si128(low_bits, high_bits));
+            }
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(result, _mm_setzero_si128()))) ^ 0xffff;
+            if (mask == 0) {
+                continue;
+            }
+            alignas(16) uint8_t buckets[block];
+            _mm_store_si128(reinterpret_cast<__m128i*>(buckets), result);
+            for (; mask != 0; mask &= mask - 1) {
+                const auto lane = static_cast<size_t>(std::countr_zero(mask));
+                if (auto hit = verify(s, haystack, size, pos + lane, buckets[lane]); hit.has_value()) {
+                    return hit;
+                }
+            }
+        }
+        return teddy_from<Width>(s, haystack, size, pos);
+    }
+#endif
+
+#ifdef MB_HAVE_AVX2
+    template <size_t Width>
+    MB_TARGET_AVX2 static std::optional<Hit> teddy_avx2(const MultiLiteralSearcher& s, const char* haystack,
+                                                        const size_t size) {
+        constexpr size_t block = 32;
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        // The byte shuffle works on each 128-bit lane separately, so both lanes get the tables.
+        __m256i low[Width];
+        __m256i high[Width];
+        for (size_t i = 0; i < Width; ++i) {
+            low[i] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(s.low_masks_[i])));
+            high[i] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(s.high_masks_[i])));
+        }
+        size_t pos = 0;
+        for (; pos + block - 1 + Width <= size; pos += block) {
+            __m256i result = _mm256_set1_epi8(-1);
+            for (size_t i = 0; i < Width; ++i) {
+                const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + pos + i));
+                const __m256i low_bits = _mm256_shuffle_epi8(low[i], _mm256_and_si256(bytes, nibble));
+                const __m256i high_bits =
+                    _mm256_shuffle_epi8(high[i], _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+                result = _mm256_and_si256(result, _mm256_and_si256(low_bits, high_bits));
+            }
+            auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(result, _mm256_setzero_si256())));
+            if (mask == 0) {
+                continue;
+            }
+            alignas(32) uint8_t buckets[block];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(buckets), result);
+            for (; mask != 0; mask &= mask - 1) {
+                const auto lane = static_cast<size_t>(std::countr_zero(mask));
+                if (auto hit = verify(s, haystack, size, pos + lane, buckets[lane]); hit.has_value()) {
+                    return hit;
+                }
+            }
+        }
+        return teddy_from<Width>(s, haystack, size, pos);
+    }
+#endif
+
+#ifdef MB_ARCH_NEON
+    template <size_t Width>
+    static std::optional<Hit> teddy_neon(const MultiLiteralSearcher& s, const char* haystack, const size_t size) {
+        constexpr size_t block = 16;
+        const uint8x16_t nibble = vdupq_n_u8(0x0f);
+        uint8x16_t low[Width];
+        uint8x16_t high[Width];
+        for (size_t i = 0; i < Width; ++i) {
+            low[i] = vld1q_u8(s.low_masks_[i]);
+            high[i] = vld1q_u8(s.high_masks_[i]);
+        }
+        size_t pos = 0;
+        for (; pos + block - 1 + Width <= size; pos += block) {
+            uint8x16_t result = vdupq_n_u8(0xff);
+            for (size_t i = 0; i < Width; ++i) {
+                const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(haystack + pos + i));
+                const uint8x16_t low_bits = vqtbl1q_u8(low[i], vandq_u8(bytes, nibble));
+                const uint8x16_t high_bits = vqtbl1q_u8(high[i], vshrq_n_u8(bytes, 4));
+                result = vandq_u8(result, vandq_u8(low_bits, high_bits));
+            }
+            // Narrow every byte of the nonzero test to a nibble, keeping one bit per byte.
+            const uint8x16_t nonzero = vtstq_u8(result, result);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(nonzero), 4)), 0);
+            mask &= 0x8888888888888888ULL;
+            if (mask == 0) {
+                continue;
+            }
+            uint8_t buckets[block];
+            vst1q_u8(buckets, result);
+            for (; mask != 0; mask &= mask - 1) {
+                const size_t lane = static_cast<size_t>(std::countr_zero(mask)) / 4;
+                if (auto hit = verify(s, haystack, size, pos + lane, buckets[lane]); hit.has_value()) {
+                    return hit;
+                }
+            }
+        }
+        return teddy_from<Width>(s, haystack, size, pos);
+    }
+#endif
+
+    template <size_t Width>
+    static Kernel select_teddy() {
+        Kernel kernel = &teddy_scalar<Width>;
+#if defined(MB_HAVE_SSSE3)
+        static const bool has_ssse3 = cpu_has_ssse3();
+        if (has_ssse3) {
+            kernel = &teddy_ssse3<Width>;
+        }
+#elif defined(MB_ARCH_NEON)
+        kernel = &teddy_neon<Width>;
+#endif
+#ifdef MB_HAVE_AVX2
+        static const bool has_avx2 = cpu_has_avx2();
+        if (has_avx2) {
+            kernel = &teddy_avx2<Width>;
+        }
+#endif
+        return kernel;
+    }
+
+    static std::optional<Hit> dense(const MultiLiteralSearcher& s, const char* haystack, const size_t size) {
+        const uint32_t* transitions = s.transitions_.data();
+        uint32_t state = 0;
+        for (size_t pos = 0; pos < size; ++pos) {
+            state = transitions[state + s.byte_class_[static_cast<unsigned char>(haystack[pos])]];
+            if ((state & kMatchBit) != 0) {
+                const uint32_t length = s.match_length_[(state & ~kMatchBit) / s.class_count_];
+                return Hit{pos + 1 - length, length};
+            }
+        }
+        return std::nullopt;
+    }
+
+    static uint32_t step(const MultiLiteralSearcher& s, uint32_t state, const uint32_t byte_class) {
+        for (;;) {
+            const auto first = s.edge_class_.begin() + s.edge_begin_[state];
+            const auto last = s.edge_class_.begin() + s.edge_begin_[state + 1];
+            const auto edge = std::lower_bound(first, last, byte_class);
+            if (edge != last && *edge == byte_class) {
+                return s.edge_target_[static_cast<size_t>(edge - s.edge_class_.begin())];
+            }
+            if (state == 0) {
+                return 0;
+            }
+            state = s.fail_[state];
+        }
+    }
+
+    static std::optional<Hit> sparse(const MultiLiteralSearcher& s, const char* haystack, const size_t size) {
+        uint32_t state = 0;
+        for (size_t pos = 0; pos < size; ++pos) {
+            state = step(s, state, s.byte_class_[static_cast<unsigned char>(haystack[pos])]);
+            if (const uint32_t length = s.match_length_[state]; length != 0) {
+                return Hit{pos + 1 - length, length};
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+MultiLiteralSearcher::MultiLiteralSearcher(std::vector<std::string> needles, const bool ignore_case)
+    : needles_(std::move(needles)), ignore_case_(ignore_case) {
+    if (ignore_case_) {
+        for (auto& needle : needles_) {
+            std::ranges::transform(needle, needle.begin(), to_lower_ascii);
+        }
+    }
+    std::ranges::sort(needles_);
+    needles_.erase(std::unique(needles_.begin(), needles_.end()), needles_.end());
+    if (needles_.empty()) {
+        kernel_ = &MultiLiteralKernels::none;
+        return;
+    }
+    // Sorted, so an empty needle comes first; it occurs at the very start of every haystack.
+    if (needles_.front().empty()) {
+        kernel_ = &MultiLiteralKernels::empty;
+        return;
+    }
+    if (needles_.size() <= kMaxTeddyNeedles) {
+        build_teddy();
+    } else {
+        build_automaton();
+    }
+}
+
+void MultiLiteralSearcher::build_teddy() {
+    teddy_width_ = kMaxTeddyWidth;
+    for (const auto& needle : needles_) {
+        teddy_width_ = std::min(teddy_width_, needle.size());
+    }
+    // Neighbours in sorted order share their leading bytes, which keeps the bucket tables tight.
+    for (size_t i = 0; i < needles_.size(); ++i) {
+        const size_t bucket = i * kBuckets / needles_.size();
+        buckets_[bucket].push_back(static_cast<uint32_t>(i));
+        const auto bit = static_cast<uint8_t>(1u << bucket);
+        for (size_t j = 0; j < teddy_width_; ++j) {
+            const char c = needles_[i][j];
+            for (const char variant : {c, ignore_case_ ? to_upper_ascii(c) : c}) {
+                const auto byte = static_cast<unsigned char>(variant);
+                low_masks_[j][byte & 0x0f] |= bit;
+                high_masks_[j][byte >> 4] |= bit;
+            }
+        }
+    }
+    switch (teddy_width_) {
+    case 1:
+        kernel_ = MultiLiteralKernels::select_teddy<1>();
+        break;
+    case 2:
+        kernel_ = MultiLiteralKernels::select_teddy<2>();
+        break;
+    default:
+        kernel_ = MultiLiteralKernels::select_teddy<3>();
+        break;
+    }
+}
+
+void MultiLiteralSearcher::build_automaton() {
+    // Every byte occurring in a needle has its own class, all the others share class 0.
+    class_count_ = 1;
+    for (const auto& needle : needles_) {
+        for (const char c : needle) {
+            if (auto& byte_class = byte_class_[static_cast<unsigned char>(c)]; byte_class == 0) {
+                byte_class = class_count_++;
+            }
+        }
+    }
+    if (ignore_case_) {
+        for (char c = 'a'; c <= 'z'; ++c) {
+            byte_class_[static_cast<unsigned char>(to_upper_ascii(c))] = byte_class_[static_cast<unsigned char>(c)];
+        }
+    }
+
+    // The trie, with children kept sorted by class.
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> children(1);
+    match_length_.assign(1, 0);
+    for (const auto& needle : needles_) {
+        uint32_t state = 0;
+        for (const char c : needle) {
+            const uint32_t byte_class = byte_class_[static_cast<unsigned char>(c)];
+            auto& edges = children[state];
+            auto edge = std::lower_bound(edges.begin(), edges.end(), std::pair{byte_class, uint32_t{0}});
+            if (edge == edges.end() || edge->first != byte_class) {
+                const auto target = static_cast<uint32_t>(children.size());
+                edge = edges.insert(edge, {byte_class, target});
+                children.emplace_back();
+                match_length_.push_back(0);
+            }
+            state = edge->second;
+        }
+        match_length_[state] = static_cast<uint32_t>(needle.size());
+    }
+    const size_t state_count = children.size();
+    edge_begin_.assign(state_count + 1, 0);
+    for (size_t state = 0; state < state_count; ++state) {
+        edge_begin_[state + 1] = edge_begin_[state] + static_cast<uint32_t>(children[state].size());
+        for (const auto& [byte_class, target] : children[state]) {
+            edge_class_.push_back(byte_class);
+            edge_target_.push_back(target);
+        }
+    }
+
+    // Failure links in breadth-first order, so a state's link is final before its children need it.
+    fail_.assign(state_count, 0);
+    std::vector<uint32_t> order{0};
+    for (size_t i = 0; i < order.size(); ++i) {
+        const uint32_t state = order[i];
+        for (const auto& [byte_class, target] : children[state]) {
+            fail_[target] = state == 0 ? 0 : MultiLiteralKernels::step(*this, fail_[state], byte_class);
+            if (match_length_[target] == 0) {
+                match_length_[target] = match_length_[fail_[target]];
+            }
+            order.push_back(target);
+        }
+    }
+
+    if (state_count * class_count_ > kMaxDenseEntries) {
+        kernel_ = &MultiLiteralKernels::sparse;
+        return;
+    }
+    // Resolve every failure chain up front; a state's link is shallower, so its row is already done.
+    transitions_.assign(state_count * class_count_, 0);
+    for (const uint32_t state : order) {
+        uint32_t* row = transitions_.data() + static_cast<size_t>(state) * class_count_;
+        const uint32_t* fallback = transitions_.data() + static_cast<size_t>(fail_[state]) * class_count_;
+        for (uint32_t byte_class = 0; byte_class < class_count_; ++byte_class) {
+            row[byte_class] = state == 0 ? 0 : fallback[byte_class];
+        }
+        for (const auto& [byte_class, target] : children[state]) {
+            row[byte_class] = target * class_count_ | (match_length_[target] != 0 ? kMatchBit : 0);
+        }
+    }
+    fail_ = {};
+    edge_begin_ = {};
+    edge_class_ = {};
+    edge_target_ = {};
+    kernel_ = &MultiLiteralKernels::dense;
+}
+} // namespace mb
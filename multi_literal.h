@@ -0,0 +1,92 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mb {
+/**
+ * @class MultiLiteralSearcher
+ * @brief Searches for any of many fixed needles in a single pass over the haystack.
+ *
+ * Small needle sets use a Teddy kernel: the needles are spread over eight buckets, and for
+ * the first bytes of every needle a pair of 16-byte tables holds which buckets accept each
+ * low and high nibble. A byte shuffle looks a whole block of haystack bytes up in those
+ * tables at once, so only positions where some bucket accepts every leading byte are
+ * verified against the needles of that bucket.
+ *
+ * Larger sets are compiled into an Aho-Corasick automaton over byte classes, a full
+ * transition table when it fits into its memory cap and a trie with failure links
+ * otherwise. Both look at every haystack byte once, regardless of the number of needles.
+ */
+class MultiLiteralSearcher final {
+public:
+    static constexpr size_t kMaxTeddyNeedles = 32;
+
+    /**
+     * @brief An occurrence of one of the needles.
+     */
+    struct Hit {
+        size_t offset = 0; ///< Offset of the first byte of the occurrence
+        size_t length = 0; ///< Length of the needle found there
+    };
+
+    /**
+     * @brief Prepares the search for the given needles.
+     * @param needles The substrings to look for.
+     * @param ignore_case If true, ASCII letters match regardless of case.
+     */
+    explicit MultiLiteralSearcher(std::vector<std::string> needles, bool ignore_case = false);
+
+    /**
+     * @brief Finds the first occurrence of any needle.
+     *
+     * When needles overlap, the occurrence reported is not necessarily the leftmost one, but
+     * no other occurrence ends before it starts. In particular it always lies on the first
+     * line holding an occurrence.
+     *
+     * @param haystack The text to search.
+     * @return The occurrence, or std::nullopt if no needle occurs.
+     */
+    std::optional<Hit> find(std::string_view haystack) const {
+        return kernel_(*this, haystack.data(), haystack.size());
+    }
+
+    /**
+     * @brief Returns the distinct needles, lowercased for case-insensitive searches.
+     */
+    const std::vector<std::string>& needles() const { return needles_; }
+
+private:
+    using Kernel = std::optional<Hit> (*)(const MultiLiteralSearcher&, const char*, size_t);
+
+    friend struct MultiLiteralKernels;
+
+    static constexpr size_t kBuckets = 8;
+    static constexpr size_t kMaxTeddyWidth = 3;
+
+    void build_teddy();
+    void build_automaton();
+
+    std::vector<std::string> needles_;
+    bool ignore_case_{};
+
+    size_t teddy_width_ = 0;                                  ///< Leading needle bytes the Teddy tables cover
+    alignas(16) uint8_t low_masks_[kMaxTeddyWidth][16]{};     ///< Buckets accepting each low nibble
+    alignas(16) uint8_t high_masks_[kMaxTeddyWidth][16]{};    ///< Buckets accepting each high nibble
+    std::array<std::vector<uint32_t>, kBuckets> buckets_{};   ///< Needle indices of every bucket
+
+    uint32_t byte_class_[256]{};         ///< Maps every (folded) byte onto its class
+    uint32_t class_count_ = 0;
+    std::vector<uint32_t> transitions_;  ///< Dense automaton, premultiplied targets tagged with kMatchBit
+    std::vector<uint32_t> match_length_; ///< Longest needle ending in each state, 0 if none
+    std::vector<uint32_t> fail_;         ///< Failure link of every trie state
+    std::vector<uint32_t> edge_begin_;   ///< First edge of every trie state, state + 1 bounds it
+    std::vector<uint32_t> edge_class_;   ///< Byte class of every trie edge, sorted per state
+    std::vector<uint32_t> edge_target_;  ///< Target state of every trie edge
+    Kernel kernel_ = nullptr;
+};
+} // namespace mb
@@ -0,0 +1,649 @@
+#include "output.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MB_HAVE_WRITEV 1
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+namespace {
+std::atomic<uint64_t> next_output_id{1};
+
+#ifdef MB_HAVE_WRITEV
+#ifdef IOV_MAX
+constexpr size_t kMaxIovecs = IOV_MAX;
+#else
+constexpr size_t kMaxIovecs = 1024;
+#endif
+
+/**
+ * @brief Writes the buffers to a file descriptor, as few writev() calls as possible.
+ *
+ * Gives up on the first error other than an interrupted call, dropping the rest.
+ *
+ * @return false if writing failed.
+ */
+bool write_all(const int fd, std::vector<std::string>& buffers) {
+    std::vector<iovec> iovecs{};
+    iovecs.reserve(buffers.size());
+    for (auto& buffer : buffers) {
+        if (!buffer.empty()) {
+            iovecs.push_back({buffer.data(), buffer.size()});
+        }
+    }
+    for (size_t first = 0; first < iovecs.size();) {
+        const size_t count = std::min(iovecs.size() - first, kMaxIovecs);
+        const ssize_t written = ::writev(fd, iovecs.data() + first, static_cast<int>(count));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // Skip what was written, which may end in the middle of a buffer.
+        for (auto left = static_cast<size_t>(written); left != 0;) {
+            auto& iov = iovecs[first];
+            const size_t step = std::min(left, iov.iov_len);
+            iov.iov_base = static_cast<char*>(iov.iov_base) + step;
+            iov.iov_len -= step;
+            left -= step;
+            if (iov.iov_len == 0) {
+                ++first;
+            }
+        }
+        while (first < iovecs.size() && iovecs[first].iov_len == 0) {
+            ++first;
+        }
+    }
+    return true;
+}
+#else
+bool write_all(int, std::vector<std::string>& buffers) {
+    for (const auto& buffer : buffers) {
+        std::cout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+    return static_cast<bool>(std::cout.flush());
+}
+#endif
+
+/**
+ * @brief The storage of the quoted path of the last file a thread finished, for its next file.
+ */
+thread_local std::string spare_quoted_path{};
+
+/**
+ * @brief Appends an unsigned integer in decimal.
+ */
+void append_number(std::string& out, const uint64_t value) {
+    char digits[20];
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+/**
+ * @brief Writes an unsigned integer as little-endian bytes.
+ */
+template <typename T>
+void store_le(char* const out, const T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+/**
+ * @brief Appends an unsigned integer as little-endian bytes.
+ */
+template <typename T>
+void append_le(std::string& out, const T value) {
+    char bytes[sizeof(T)];
+    store_le(bytes, value);
+    out.append(bytes, sizeof(T));
+}
+
+/**
+ * @brief Returns the length of the valid UTF-8 sequence of two to four bytes at an offset, or 0.
+ *
+ * Overlong forms, surrogates and code points past U+10FFFF are not valid.
+ */
+size_t utf8_sequence_size(const std::string_view text, const size_t pos) {
+    const auto byte = [&](const size_t i) { return static_cast<unsigned char>(text[pos + i]); };
+    const unsigned char lead = byte(0);
+    size_t size = 0;
+    unsigned char low = 0x80;  // Range of the second byte, narrower for some leads
+    unsigned char high = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        size = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        size = 3;
+        low = lead == 0xe0 ? 0xa0 : 0x80;
+        high = lead == 0xed ? 0x9f : 0xbf;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        size = 4;
+        low = lead == 0xf0 ? 0x90 : 0x80;
+        high = lead == 0xf4 ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+    if (text.size() - pos < size || byte(1) < low || byte(1) > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < size; ++i) {
+        if (byte(i) < 0x80 || byte(i) > 0xbf) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Appends a JSON string.
+ *
+ * Bytes that are not part of valid UTF-8 are written as the code point of the same value, as
+ * `\u00XX`, so the output is always valid UTF-8 and the text stays one character per byte
+ * where it is not.
+ */
+void append_json_string(std::string& out, const std::string_view text) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    out += '"';
+    size_t copied = 0; // Bytes before this offset are in out already
+    for (size_t i = 0; i < text.size(); ++i) {
+        const auto c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            continue;
+        }
+        if (c >= 0x80) {
+            if (const size_t size = utf8_sequence_size(text, i); size != 0) {
+                i += size - 1;
+                continue;
+            }
+        }
+        out.append(text.data() + copied, i - copied);
+        copied = i + 1;
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        default:
+            out += "\\u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xf];
+            break;
+        }
+    }
+    out.append(text.data() + copied, text.size() - copied);
+    out += '"';
+}
+
+/**
+ * @brief Spells a path out the way records of a format carry it, into the thread's spare storage.
+ *
+ * Text quotes it the way `std::cout << path` does, JSON as a string, and binary records
+ * prefix it with its size.
+ */
+std::string quote(const std::string_view path, const Output::Format format) {
+    std::string quoted = std::move(spare_quoted_path);
+    quoted.clear();
+    switch (format) {
+    case Output::Format::Text:
+        quoted += '"';
+        for (const char c : path) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        quoted += '"';
+        break;
+    case Output::Format::Json:
+        append_json_string(quoted, path);
+        break;
+    case Output::Format::Binary:
+        append_le(quoted, static_cast<uint32_t>(path.size()));
+        quoted += path;
+        break;
+    }
+    return quoted;
+}
+
+/**
+ * @brief Finds where the last lines of a text start, scanning backwards from its end.
+ *
+ * @param text Whole lines, the last one possibly without its line break.
+ * @param count The lines wanted; fewer are found if the text starts before.
+ * @return The offset of the first of the lines found, and how many were found.
+ */
+std::pair<size_t, size_t> find_last_lines(const std::string_view text, const size_t count) {
+    size_t begin = text.size();
+    size_t found = 0;
+    while (found < count && begin != 0) {
+        // The byte before begin is the line break ending the previous line.
+        const void* line_break = begin < 2 ? nullptr : ::memrchr(text.data(), '\n', begin - 1);
+        begin = line_break == nullptr ? 0 : static_cast<size_t>(static_cast<const char*>(line_break) - text.data()) + 1;
+        ++found;
+    }
+    return {begin, found};
+}
+} // namespace
+
+/**
+ * @brief A thread's buffer for unordered output.
+ */
+struct Output::LocalBuffer {
+    LocalBuffer() { buffer.reserve(kBufferSize); }
+
+    std::string buffer;
+};
+
+Output::FileResults::FileResults(Output& output, const std::string_view path, const uint64_t sequence)
+    : output_(&output), quoted_path_(quote(path, output.format_)), sequence_(sequence),
+      buffer_(output.ordered_ ? &lines_ : &output.local_buffer().buffer) {}
+
+Output::FileResults::FileResults(FileResults&& other) noexcept
+    : output_(std::exchange(other.output_, nullptr)), quoted_path_(std::move(other.quoted_path_)),
+      sequence_(other.sequence_), buffer_(other.buffer_), lines_(std::move(other.lines_)),
+      hand_over_at_(other.hand_over_at_), matches_(other.matches_), text_(other.text_),
+      text_offset_(other.text_offset_), next_text_offset_(other.next_text_offset_), printed_(other.printed_),
+      last_printed_(other.last_printed_), after_until_(other.after_until_), tail_(std::move(other.tail_)),
+      recorded_(other.recorded_) {
+    if (buffer_ == &other.lines_) {
+        buffer_ = &lines_;
+    }
+}
+
+Output::FileResults::~FileResults() {
+    if (output_ != nullptr) {
+        output_->end_file(*this);
+        if (quoted_path_.capacity() > spare_quoted_path.capacity()) {
+            spare_quoted_path = std::move(quoted_path_);
+        }
+    }
+}
+
+bool Output::FileResults::add(const size_t line_num, const std::string_view line) {
+    if (matches_++ == 0 && !output_->matched()) {
+        output_->matched_.store(true, std::memory_order_relaxed);
+    }
+    if (recorded_ != nullptr) {
+        recorded_->emplace_back(line_num, line);
+    }
+    std::string& buffer = *buffer_;
+    switch (output_->report_) {
+    case Report::Lines:
+        if (output_->format_ != Format::Text) {
+            append_record(line_num, line);
+            break;
+        }
+        if (output_->context_.before != 0 || output_->context_.after != 0) {
+            append_after(line_num - 1);
+            append_before(line_num, line);
+            last_printed_ = line_num;
+            printed_ = std::min(line.data() + line.size() + 1, text_.data() + text_.size());
+            after_until_ = line_num + output_->context_.after;
+        }
+        append_line(line_num, line, ':');
+        break;
+    case Report::Files:
+        if (output_->format_ != Format::Text) {
+            append_file_record();
+            break;
+        }
+        buffer += quoted_path_;
+        buffer += '\n';
+        break;
+    case Report::Count:
+    case Report::Quiet:
+        break;
+    }
+    if (buffer.size() >= hand_over_at_) {
+        // An ordered file behind others keeps collecting; it tries again kBufferSize bytes later.
+        hand_over_at_ = output_->hand_over(*this) ? kBufferSize : buffer.size() + kBufferSize;
+    }
+    return remaining() != 0;
+}
+
+size_t Output::FileResults::remaining() const {
+    const bool every_line = output_->report_ == Report::Lines || output_->report_ == Report::Count;
+    const size_t wanted = every_line ? output_->max_count_ : 1;
+    return matches_ < wanted ? wanted - matches_ : 0;
+}
+
+void Output::FileResults::begin_text(const std::string_view text) {
+    text_ = text;
+    text_offset_ = next_text_offset_;
+    next_text_offset_ += text.size();
+    // Context after the last match that did not fit into the previous text continues here.
+    printed_ = after_until_ > last_printed_ ? text.data() : nullptr;
+}
+
+void Output::FileResults::end_text() {
+    const Context& context = output_->context_;
+    if (context.before == 0 && context.after == 0) {
+        return;
+    }
+    append_after(after_until_);
+    if (context.before == 0) {
+        return;
+    }
+    // Keep the last lines for the context of a match early in the next text, together with
+    // lines of earlier texts if this one is shorter.
+    const auto [begin, found] = find_last_lines(text_, context.before);
+    if (begin != 0) {
+        tail_.clear();
+    }
+    tail_.append(text_.substr(begin));
+    if (!tail_.empty() && tail_.back() != '\n') {
+        tail_ += '\n';
+    }
+    if (found < context.before) {
+        tail_.erase(0, find_last_lines(tail_, context.before).first);
+    }
+    text_ = {};
+    printed_ = nullptr;
+}
+
+void Output::FileResults::flush() {
+    if (!buffer_->empty()) {
+        hand_over_at_ = output_->hand_over(*this) ? kBufferSize : buffer_->size() + kBufferSize;
+    }
+}
+
+void Output::FileResults::append_line(const size_t line_num, const std::string_view line, const char mark) {
+    static constexpr std::string_view separator = ", line num: ";
+    char digits[20];
+    const auto end = std::to_chars(digits, digits + sizeof(digits), line_num).ptr;
+    std::string& buffer = *buffer_;
+    buffer += quoted_path_;
+    buffer += separator;
+    buffer.append(digits, end);
+    buffer += mark;
+    buffer += ' ';
+    buffer += line;
+    buffer += '\n';
+}
+
+void Output::FileResults::append_record(const size_t line_num, const std::string_view line) {
+    // The spans of a thread's lines collect in the same storage, which keeps its capacity.
+    static thread_local std::vector<Match> spans{};
+    spans.clear();
+    for (size_t from = 0; from <= line.size();) {
+        const auto span = output_->matcher_->find_in_line(line, from);
+        if (!span.has_value()) {
+            break;
+        }
+        if (span->end != span->begin) {
+            spans.push_back(*span);
+        }
+        from = std::max(span->end, span->begin + 1);
+    }
+    const uint64_t offset =
+        text_offset_ + (text_.data() == nullptr ? 0 : static_cast<uint64_t>(line.data() - text_.data()));
+    std::string& buffer = *buffer_;
+    if (output_->format_ == Format::Json) {
+        buffer += "{\"path\":";
+        buffer += quoted_path_;
+        buffer += ",\"line\":";
+        append_number(buffer, line_num);
+        buffer += ",\"offset\":";
+        append_number(buffer, offset);
+        buffer += ",\"spans\":[";
+        for (size_t i = 0; i < spans.size(); ++i) {
+            buffer += i == 0 ? "[" : ",[";
+            append_number(buffer, spans[i].begin);
+            buffer += ',';
+            append_number(buffer, spans[i].end);
+            buffer += ']';
+        }
+        buffer += "],\"text\":";
+        append_json_string(buffer, line);
+        buffer += "}\n";
+        return;
+    }
+    const size_t start = buffer.size();
+    append_le(buffer, uint32_t{0}); // The size, filled in once the record is complete
+    append_le(buffer, static_cast<uint8_t>(RecordKind::Line));
+    buffer += quoted_path_;
+    append_le(buffer, static_cast<uint64_t>(line_num));
+    append_le(buffer, offset);
+    append_le(buffer, static_cast<uint32_t>(spans.size()));
+    for (const Match& span : spans) {
+        append_le(buffer, static_cast<uint32_t>(span.begin));
+        append_le(buffer, static_cast<uint32_t>(span.end));
+    }
+    append_le(buffer, static_cast<uint32_t>(line.size()));
+    buffer += line;
+    store_le(buffer.data() + start, static_cast<uint32_t>(buffer.size() - start - sizeof(uint32_t)));
+}
+
+void Output::FileResults::append_file_record() {
+    std::string& buffer = *buffer_;
+    const bool count = output_->report_ == Report::Count;
+    if (output_->format_ == Format::Json) {
+        buffer += "{\"path\":";
+        buffer += quoted_path_;
+        if (count) {
+            buffer += ",\"count\":";
+            append_number(buffer, matches_);
+        }
+        buffer += "}\n";
+        return;
+    }
+    const size_t start = buffer.size();
+    append_le(buffer, uint32_t{0});
+    append_le(buffer, static_cast<uint8_t>(count ? RecordKind::Count : RecordKind::File));
+    buffer += quoted_path_;
+    if (count) {
+        append_le(buffer, static_cast<uint64_t>(matches_));
+    }
+    store_le(buffer.data() + start, static_cast<uint32_t>(buffer.size() - start - sizeof(uint32_t)));
+}
+
+void Output::FileResults::append_before(const size_t line_num, const std::string_view line) {
+    // The lines before the match in the text, and those missing from the end of the tail.
+    const size_t wanted = std::min(output_->context_.before, line_num - 1 - last_printed_);
+    const auto offset = static_cast<size_t>(line.data() - text_.data());
+    const auto [begin, found] = find_last_lines(text_.substr(0, offset), wanted);
+    const std::string_view tail{tail_};
+    const auto [from, found_in_tail] = find_last_lines(tail, wanted - found);
+    size_t number = line_num - found - found_in_tail;
+    if (last_printed_ != 0 && number > last_printed_ + 1) {
+        *buffer_ += "--\n";
+    }
+    for (std::string_view lines : {tail.substr(from), text_.substr(begin, offset - begin)}) {
+        while (!lines.empty()) {
+            const size_t end = lines.find('\n');
+            append_line(number++, lines.substr(0, end), '-');
+            lines.remove_prefix(std::min(end + 1, lines.size()));
+        }
+    }
+}
+
+void Output::FileResults::append_after(const size_t last) {
+    const char* const text_end = text_.data() + text_.size();
+    while (printed_ != nullptr && printed_ != text_end && last_printed_ < std::min(last, after_until_)) {
+        const void* line_break = std::memchr(printed_, '\n', static_cast<size_t>(text_end - printed_));
+        const char* const end = line_break == nullptr ? text_end : static_cast<const char*>(line_break);
+        append_line(++last_printed_, {printed_, static_cast<size_t>(end - printed_)}, '-');
+        printed_ = std::min(end + 1, text_end);
+    }
+}
+
+Output::Output(const bool ordered, const Report report, const size_t max_count, const Context context, const int fd,
+               const Format format, const IMatcher* const matcher)
+    : ordered_(ordered), report_(report), max_count_(max_count),
+      context_(report == Report::Lines && format == Format::Text ? context : Context{}), fd_(fd), format_(format),
+      matcher_(matcher), id_(next_output_id.fetch_add(1)) {
+    std::cout.flush(); // Whatever was printed before has to come first
+    if (format_ == Format::Binary) {
+        std::string header{kBinaryMagic, sizeof(kBinaryMagic)};
+        append_le(header, kBinaryVersion);
+        queue_.push_back(std::move(header));
+    }
+    writer_ = std::thread([this] { run(); });
+}
+
+Output::~Output() {
+    {
+        std::lock_guard lock{mutex_};
+        for (auto& local : locals_) {
+            if (!local->buffer.empty()) {
+                queue_.push_back(std::move(local->buffer));
+            }
+        }
+        stop_ = true;
+    }
+    ready_.notify_one();
+    writer_.join();
+}
+
+Output::FileResults Output::begin_file(const std::string_view path, const uint64_t sequence) {
+    return FileResults{*this, path, sequence};
+}
+
+void Output::wait_for_turn(const uint64_t sequence) {
+    if (!ordered_) {
+        return;
+    }
+    std::unique_lock lock{mutex_};
+    turn_.wait(lock, [this, sequence] {
+        return sequence - next_sequence_ < kReorderWindow && reordered_bytes_ < kMaxReordered;
+    });
+}
+
+void Output::end_file(FileResults& results) {
+    const Stats::Scope scope{Stats::Phase::Output};
+    Stats::add(Stats::Counter::Matches, results.matches_);
+    if (report_ == Report::Count && results.matches_ != 0 && format_ != Format::Text) {
+        results.append_file_record();
+    } else if (report_ == Report::Count && results.matches_ != 0) {
+        char digits[20];
+        const auto end = std::to_chars(digits, digits + sizeof(digits), results.matches_).ptr;
+        std::string& buffer = *results.buffer_;
+        buffer += results.quoted_path_;
+        buffer += ", matches: ";
+        buffer.append(digits, end);
+        buffer += '\n';
+    }
+    if (ordered_) {
+        {
+            std::unique_lock lock{mutex_};
+            if (results.sequence_ != next_sequence_) {
+                reordered_bytes_ += results.lines_.size();
+                reorder_.emplace(results.sequence_, std::move(results.lines_));
+                return;
+            }
+            space_.wait(lock, [this] { return queue_.size() < kMaxQueued; });
+            // This file and every finished one right after it can be written now.
+            if (!results.lines_.empty()) {
+                queue_.push_back(std::move(results.lines_));
+            }
+            ++next_sequence_;
+            for (auto it = reorder_.begin(); it != reorder_.end() && it->first == next_sequence_;) {
+                reordered_bytes_ -= it->second.size();
+                if (!it->second.empty()) {
+                    queue_.push_back(std::move(it->second));
+                }
+                it = reorder_.erase(it);
+                ++next_sequence_;
+            }
+        }
+        ready_.notify_one();
+        turn_.notify_all();
+        return;
+    }
+    // Handing over a partly filled buffer only costs a write while the writer has nothing
+    // else to do; while it is busy, the lines keep collecting into a full buffer.
+    if (!results.buffer_->empty() && idle_.load(std::memory_order_relaxed)) {
+        hand_over(results);
+    }
+}
+
+Output::LocalBuffer& Output::local_buffer() {
+    struct Current {
+        uint64_t id = 0;
+        LocalBuffer* buffer = nullptr;
+    };
+    static thread_local Current current{};
+    if (current.id != id_) {
+        auto local = std::make_unique<LocalBuffer>();
+        current = {id_, local.get()};
+        std::lock_guard lock{mutex_};
+        locals_.push_back(std::move(local));
+    }
+    return *current.buffer;
+}
+
+bool Output::hand_over(FileResults& results) {
+    const Stats::Scope scope{Stats::Phase::Output};
+    {
+        std::unique_lock lock{mutex_};
+        if (ordered_ && results.sequence_ != next_sequence_) {
+            return false; // Earlier files are not done yet, so the lines have to wait
+        }
+        space_.wait(lock, [this] { return queue_.size() < kMaxQueued; });
+        std::string& buffer = *results.buffer_;
+        queue_.push_back(std::move(buffer));
+        buffer.clear();
+        if (!spare_.empty()) {
+            buffer = std::move(spare_.back());
+            spare_.pop_back();
+        } else {
+            buffer.reserve(kBufferSize);
+        }
+        idle_.store(false, std::memory_order_relaxed);
+    }
+    ready_.notify_one();
+    return true;
+}
+
+void Output::run() {
+    std::vector<std::string> batch{};
+    std::unique_lock lock{mutex_};
+    while (true) {
+        ready_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return; // Stopped with nothing left to write
+        }
+        batch.swap(queue_);
+        idle_.store(false, std::memory_order_relaxed);
+        lock.unlock();
+        space_.notify_all();
+        {
+            const Stats::Scope scope{Stats::Phase::Output};
+            if (!failed_.load(std::memory_order_relaxed) && !write_all(fd_, batch)) {
+                failed_.store(true, std::memory_order_relaxed);
+            }
+        }
+        lock.lock();
+        for (auto& buffer : batch) {
+            if (buffer.capacity() >= kBufferSize && spare_.size() <= locals_.size()) {
+                buffer.clear();
+                spare_.push_back(std::move(buffer));
+            }
+        }
+        batch.clear();
+        idle_.store(queue_.empty(), std::memory_order_relaxed);
+    }
+}
+} // namespace mb
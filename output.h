@@ -0,0 +1,275 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "matcher.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class Output
+ * @brief Collects the matching lines found by the workers and writes them to stdout.
+ *
+ * Workers format their lines into buffers of their own, so printing a line takes neither a
+ * lock nor a flush. Filled buffers are handed to a single writer thread, which writes every
+ * buffer queued since its last write with one writev() call.
+ *
+ * Unordered, every thread appends to one buffer of its own that is only handed over once it
+ * holds kBufferSize bytes, or at the end of a file while the writer is idle, so output keeps
+ * flowing when there are few matches. Ordered, the lines of every file are collected on
+ * their own and written in the order of the sequence numbers passed to begin_file(), each as
+ * soon as all files before it are done; the file written next streams its lines in buffers
+ * of kBufferSize bytes right away. The files finished ahead of their turn wait in a reorder
+ * buffer, which wait_for_turn() keeps bounded by holding back whoever numbers the files.
+ *
+ * Handing over blocks while kMaxQueued buffers are already waiting, so a slow consumer of
+ * stdout throttles the workers instead of letting the output pile up in memory.
+ *
+ * Instead of the lines, the output may report only which files match or how many lines of
+ * each match. FileResults::add() then tells the search when a file needs no further lines.
+ *
+ * Lines around the matching ones are printed as context without the search ever tracking
+ * them: the search announces the text it scans with FileResults::begin_text(), and add()
+ * finds the lines before a match by scanning backwards from it in that text, and the lines
+ * after the previous match by scanning forwards from where that one ended. Only the last
+ * few lines of a text are copied when it ends, since the file's next chunk replaces it.
+ *
+ * For other programs the lines may be written as records instead, as JSON Lines or in a
+ * length-prefixed binary format, each with the byte offset of the line in the file and the
+ * spans the matcher finds in it. The records are formatted straight into the same buffers.
+ */
+class Output final {
+public:
+    static constexpr size_t kBufferSize = size_t{64} << 10;
+    static constexpr size_t kMaxQueued = 64; ///< Buffers waiting for the writer before handing over blocks
+    static constexpr size_t kReorderWindow = 4096; ///< Files numbered ahead of the one written next
+    static constexpr size_t kMaxReordered = size_t{64} << 20; ///< Bytes finished files may hold waiting
+    static constexpr size_t kUnlimited = std::numeric_limits<size_t>::max();
+
+    /**
+     * @brief What is printed for the matching lines.
+     */
+    enum class Report {
+        Lines, ///< Every matching line with its path and line number
+        Files, ///< The path of every file with a match
+        Count, ///< The path of every file with a match and the number of its matching lines
+        Quiet, ///< Nothing; matched() tells whether anything matched
+    };
+
+    /**
+     * @brief How the matching lines are written.
+     *
+     * Binary output starts with the 8 bytes of kBinaryMagic and a 32-bit version. Then every
+     * record is a 32-bit size of the rest of it, a kind byte and the path as a 32-bit size and
+     * its bytes, followed for a matching line by the 64-bit line number and byte offset, a
+     * 32-bit count of spans, each a 32-bit begin and end within the line, and the line as a
+     * 32-bit size and its bytes; or for a count by the 64-bit count. Integers are little-endian.
+     */
+    enum class Format {
+        Text,   ///< `"path", line num: N: line`, for people
+        Json,   ///< A JSON object per line with the path, line number, offset, spans and line
+        Binary, ///< Length-prefixed records
+    };
+
+    /**
+     * @brief The kind byte of a binary record.
+     */
+    enum class RecordKind : uint8_t {
+        Line = 1,  ///< A matching line
+        File = 2,  ///< A file with a match, with -l
+        Count = 3, ///< A file with a match and its number of matching lines, with -c
+    };
+
+    static constexpr char kBinaryMagic[8] = {'M', 'B', 'G', 'R', 'H', 'I', 'T', '\0'};
+    static constexpr uint32_t kBinaryVersion = 1;
+
+    /**
+     * @brief How many lines around every matching line are printed along with it.
+     */
+    struct Context {
+        size_t before; ///< Lines before a match
+        size_t after;  ///< Lines after a match
+    };
+
+    /**
+     * @brief Receives the matching lines of one file.
+     *
+     * Obtained from begin_file() and used by a single thread; the file is done once it is
+     * destroyed.
+     */
+    class FileResults final {
+    public:
+        FileResults(FileResults&& other) noexcept;
+        FileResults& operator=(FileResults&&) = delete;
+        ~FileResults();
+
+        /**
+         * @brief Adds a matching line.
+         *
+         * @param line_num Line number of the line, starting from 1.
+         * @param line The line without its line break.
+         * @return false if the file needs no further lines: the maximum count is reached, or
+         *         only the matching files are reported and this is the file's first match.
+         */
+        bool add(size_t line_num, std::string_view line);
+        /**
+         * @brief Returns the number of lines add() accepts before it returns false.
+         */
+        size_t remaining() const;
+        /**
+         * @brief Announces the text the lines passed to add() lie in, until end_text().
+         *
+         * The texts of a file have to follow each other without gaps and consist of whole
+         * lines; the context lines are taken from them.
+         */
+        void begin_text(std::string_view text);
+        /**
+         * @brief Prints the context lines still due in the text and keeps the ones the next text may need.
+         */
+        void end_text();
+        /**
+         * @brief Hands the lines collected so far to the writer, for a file whose next text
+         *        may take a while to arrive, like a pipe.
+         *
+         * Ordered, the lines only go out once all files before this one are done.
+         */
+        void flush();
+        /**
+         * @brief Also copies every matching line passed to add() into a list, for --cache.
+         *
+         * @param lines Receives the line numbers and lines; has to outlive the results.
+         */
+        void record(std::vector<std::pair<size_t, std::string>>* lines) { recorded_ = lines; }
+
+    private:
+        friend class Output;
+
+        FileResults(Output& output, std::string_view path, uint64_t sequence);
+
+        void append_line(size_t line_num, std::string_view line, char mark);
+        void append_record(size_t line_num, std::string_view line);
+        void append_file_record();
+        void append_before(size_t line_num, std::string_view line);
+        void append_after(size_t last);
+
+        Output* output_;
+        std::string quoted_path_; ///< The path as the format writes it; in text as `std::cout << path` prints it
+        uint64_t sequence_;
+        std::string* buffer_; ///< The thread's buffer, or lines_ in ordered mode
+        std::string lines_{};
+        size_t hand_over_at_ = kBufferSize; ///< Buffer size at which add() hands the buffer over
+        size_t matches_ = 0;
+        std::string_view text_{};       ///< The text announced by begin_text()
+        uint64_t text_offset_ = 0;      ///< Offset of text_ in the file
+        uint64_t next_text_offset_ = 0; ///< Offset of the text announced next
+        const char* printed_ = nullptr; ///< Where the line after last_printed_ starts, if in text_
+        size_t last_printed_ = 0;       ///< Number of the last line printed, or 0
+        size_t after_until_ = 0;        ///< Last line of the context after the last match
+        std::string tail_{};            ///< Up to Context::before lines preceding text_, each ending in '\n'
+        std::vector<std::pair<size_t, std::string>>* recorded_ = nullptr; ///< Set by record()
+    };
+
+    /**
+     * @brief Starts the writer thread.
+     * @param ordered If true, files are written in the order of their sequence numbers.
+     * @param report What is printed for the matching lines.
+     * @param max_count Matching lines per file after which its search stops.
+     * @param context Lines printed around every matching line; only used when reporting lines
+     *                in text.
+     * @param fd File descriptor the output is written to; stdout where writev() is unavailable.
+     * @param format How the lines are written.
+     * @param matcher Finds the spans of the lines in records; has to outlive the output and
+     *                is only needed for them.
+     */
+    explicit Output(bool ordered, Report report = Report::Lines, size_t max_count = kUnlimited,
+                    Context context = {}, int fd = 1, Format format = Format::Text,
+                    const IMatcher* matcher = nullptr);
+    /**
+     * @brief Writes everything still buffered and stops the writer thread.
+     *
+     * Every FileResults must have been destroyed before.
+     */
+    ~Output();
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    /**
+     * @brief Starts collecting the matches of a file.
+     *
+     * @param path Path of the file, printed quoted in front of every line.
+     * @param sequence Position of the file in ordered mode, counting from 0 without gaps;
+     *                 every number has to be passed exactly once. Ignored unordered.
+     * @return The receiver of the file's matching lines.
+     */
+    FileResults begin_file(std::string_view path, uint64_t sequence = 0);
+    /**
+     * @brief Blocks until a file may be numbered without overfilling the reorder buffer.
+     *
+     * That is once the file is less than kReorderWindow files after the one written next and
+     * the files finished ahead of their turn hold less than kMaxReordered bytes. Holding back
+     * the numbering throttles the workers running ahead while the pool stays busy with the
+     * files already numbered, all of which have to be passed to begin_file() eventually.
+     * Returns at once unordered.
+     *
+     * @param sequence The number the file is about to get.
+     */
+    void wait_for_turn(uint64_t sequence);
+    /**
+     * @brief Checks whether any file had a matching line so far.
+     */
+    bool matched() const { return matched_.load(std::memory_order_relaxed); }
+    /**
+     * @brief Checks whether writing failed, after which the rest of the output is dropped.
+     *
+     * Happens when the reader went away, so the search may as well stop.
+     */
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+private:
+    struct LocalBuffer;
+
+    void end_file(FileResults& results);
+    LocalBuffer& local_buffer();
+    bool hand_over(FileResults& results);
+    void run();
+
+    const bool ordered_;
+    const Report report_;
+    const size_t max_count_;
+    const Context context_;
+    const int fd_;
+    const Format format_;
+    const IMatcher* const matcher_;
+    const uint64_t id_; ///< Identifies the Output to the thread-local buffer lookup
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_; ///< Signalled when the writer takes the queue
+    std::condition_variable turn_;  ///< Signalled when the file written next changes
+    std::vector<std::string> queue_;                ///< Buffers waiting to be written, in order
+    std::vector<std::string> spare_;                ///< Written buffers kept for reuse
+    std::map<uint64_t, std::string> reorder_;       ///< Finished files waiting for earlier ones
+    uint64_t next_sequence_ = 0;                    ///< The file written next in ordered mode
+    size_t reordered_bytes_ = 0;                    ///< Bytes held by reorder_
+    std::vector<std::unique_ptr<LocalBuffer>> locals_;
+    bool stop_ = false;
+    std::atomic_bool idle_{true}; ///< The writer has nothing to write
+    std::atomic_bool matched_{false};
+    std::atomic_bool failed_{false};
+    std::thread writer_;
+};
+} // namespace mb
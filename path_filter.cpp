@@ -0,0 +1,159 @@
+#include "path_filter.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include "stats.h"
+
+namespace mb {
+namespace {
+/**
+ * @brief A file type of --type and the globs of its files, separated by spaces.
+ */
+struct FileType {
+    std::string_view name;
+    std::string_view globs;
+};
+
+constexpr std::array kFileTypes{
+    FileType{"c", "*.c *.h"},
+    FileType{"cpp", "*.cpp *.cc *.cxx *.c++ *.hpp *.hh *.hxx *.h++ *.h *.inl *.ipp"},
+    FileType{"cmake", "CMakeLists.txt *.cmake"},
+    FileType{"css", "*.css *.scss"},
+    FileType{"go", "*.go"},
+    FileType{"html", "*.html *.htm"},
+    FileType{"java", "*.java"},
+    FileType{"js", "*.js *.jsx *.mjs *.cjs"},
+    FileType{"json", "*.json"},
+    FileType{"log", "*.log"},
+    FileType{"make", "Makefile makefile GNUmakefile *.mk *.mak"},
+    FileType{"md", "*.md *.markdown"},
+    FileType{"py", "*.py *.pyi"},
+    FileType{"rust", "*.rs"},
+    FileType{"sh", "*.sh *.bash *.zsh"},
+    FileType{"ts", "*.ts *.tsx"},
+    FileType{"txt", "*.txt"},
+    FileType{"xml", "*.xml"},
+    FileType{"yaml", "*.yaml *.yml"},
+};
+
+/**
+ * @brief Appends the lines of an ignore file to a set, if the file exists.
+ * @return Whether any line held a glob.
+ */
+bool read_ignore_file(const fs::path& path, GlobSet& rules) {
+    std::ifstream file{path, std::ios::binary};
+    bool added = false;
+    for (std::string line; std::getline(file, line);) {
+        added = rules.add(line) || added;
+    }
+    return added;
+}
+
+/**
+ * @brief Returns the last component of a '/'-separated path.
+ */
+std::string_view file_name(const std::string_view relative) {
+    const size_t slash = relative.rfind('/');
+    return slash == std::string_view::npos ? relative : relative.substr(slash + 1);
+}
+} // namespace
+
+PathFilter::PathFilter(Options options)
+    : use_ignore_files_(options.use_ignore_files), file_extension_(std::move(options.file_extension)) {
+    for (const auto& glob : options.globs) {
+        globs_.add(glob);
+    }
+    for (const auto& name : options.types) {
+        const auto* type = std::ranges::find(kFileTypes, std::string_view{name}, &FileType::name);
+        if (type == kFileTypes.end()) {
+            throw std::invalid_argument("unknown file type \"" + name + "\"");
+        }
+        GlobSet& types = types_.has_value() ? *types_ : types_.emplace();
+        for (std::string_view globs = type->globs; !globs.empty();) {
+            const size_t end = std::min(globs.find(' '), globs.size());
+            types.add(globs.substr(0, end));
+            globs.remove_prefix(std::min(end + 1, globs.size()));
+        }
+    }
+}
+
+std::shared_ptr<const PathFilter::Directory> PathFilter::enter(const std::shared_ptr<const Directory>& parent,
+                                                               const fs::path& directory,
+                                                               const std::string_view relative) const {
+    if (!use_ignore_files_) {
+        return parent;
+    }
+    auto rules = std::make_shared<Directory>();
+    // Both files are read into one set, so a rule of .ignore overrides one of .gitignore.
+    const bool gitignore = read_ignore_file(directory / ".gitignore", rules->rules);
+    if (!read_ignore_file(directory / ".ignore", rules->rules) && !gitignore) {
+        return parent;
+    }
+    rules->parent = parent;
+    rules->prefix = relative.empty() ? 0 : relative.size() + 1;
+    return rules;
+}
+
+bool PathFilter::accepts(const Directory* rules, const std::string_view relative, const std::string_view name,
+                         const bool is_directory) const {
+    bool ignored = false;
+    bool included = false; // By a --glob, which overrides the ignore files
+    if (!globs_.empty()) {
+        const GlobSet::Result result = globs_.match(relative, name, is_directory);
+        ignored = result == GlobSet::Result::Negated ||
+                  (result == GlobSet::Result::None && !is_directory && globs_.has_plain());
+        included = result == GlobSet::Result::Matched;
+    }
+    if (!ignored && !included && use_ignore_files_) {
+        ignored = is_directory && name == ".git";
+        for (const Directory* directory = rules; !ignored && directory != nullptr;
+             directory = directory->parent.get()) {
+            const GlobSet::Result result =
+                directory->rules.match(relative.substr(directory->prefix), name, is_directory);
+            if (result != GlobSet::Result::None) {
+                ignored = result == GlobSet::Result::Matched;
+                break;
+            }
+        }
+    }
+    if (ignored) {
+        Stats::add(Stats::Counter::SkippedIgnored, 1);
+        return false;
+    }
+    return is_directory || accepts_type(relative, name);
+}
+
+bool PathFilter::accepts_file(const std::string_view relative) const {
+    const std::string_view name = file_name(relative);
+    if (!globs_.empty()) {
+        const GlobSet::Result result = globs_.match(relative, name, false);
+        if (result == GlobSet::Result::Negated || (result == GlobSet::Result::None && globs_.has_plain())) {
+            Stats::add(Stats::Counter::SkippedIgnored, 1);
+            return false;
+        }
+    }
+    return accepts_type(relative, name);
+}
+
+bool PathFilter::accepts_type(const std::string_view relative, const std::string_view name) const {
+    if (types_.has_value() && types_->match(relative, name, false) != GlobSet::Result::Matched) {
+        Stats::add(Stats::Counter::SkippedIgnored, 1);
+        return false;
+    }
+    if (file_extension_.has_value()) {
+        // Like fs::path::extension(): from the last dot on, but a name starting with its only dot has none.
+        const size_t dot = name.rfind('.');
+        const std::string_view extension =
+            dot == std::string_view::npos || dot == 0 ? std::string_view{} : name.substr(dot);
+        if (extension != *file_extension_) {
+            Stats::add(Stats::Counter::SkippedExtension, 1);
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace mb
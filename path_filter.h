@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "glob_set.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class PathFilter
+ * @brief Decides which entries of a directory tree are searched, before they are opened.
+ *
+ * An entry is checked against, in this order:
+ *  - the `--glob` globs: the last one matching its path decides, a glob starting with `!`
+ *    excludes the entry and any other includes it whatever the ignore files say; once any
+ *    glob without `!` is given, files matching none are skipped;
+ *  - the `.gitignore` and `.ignore` files of the directories from the root down to the entry,
+ *    the deepest one matching deciding, `.ignore` after `.gitignore` in the same directory;
+ *    the `.git` directory itself is skipped too;
+ *  - for files, the `--type` file types and the `--ext` extension.
+ *
+ * A directory rejected by the globs or the ignore files is pruned, so nothing below it is
+ * listed. Every glob is compiled once into a GlobSet, and entries are matched by their path
+ * relative to the root, which the traversal builds in a buffer it reuses, so checking an
+ * entry allocates nothing.
+ */
+class PathFilter final {
+public:
+    /**
+     * @brief What the filter applies.
+     */
+    struct Options {
+        bool use_ignore_files = true;                             ///< Read .gitignore and .ignore files
+        std::vector<std::string> globs{};                         ///< --glob, in the order given
+        std::vector<std::string> types{};                         ///< --type names
+        std::optional<std::string> file_extension = std::nullopt; ///< --ext, with the dot
+    };
+
+    /**
+     * @brief The ignore rules of a directory with an ignore file, chained to those above it.
+     */
+    struct Directory {
+        std::shared_ptr<const Directory> parent; ///< The nearest directory above with rules, or null
+        size_t prefix = 0;                       ///< Length of the directory's relative path with its slash
+        GlobSet rules{};
+    };
+
+    /**
+     * @brief Compiles the globs and file types.
+     * @throws std::invalid_argument If a file type is unknown.
+     */
+    explicit PathFilter(Options options);
+
+    /**
+     * @brief Reads the ignore files of a directory about to be listed.
+     *
+     * @param parent The rules in effect in its parent, or null.
+     * @param directory Path of the directory.
+     * @param relative Its path relative to the root, '/'-separated; empty for the root.
+     * @return The rules in effect in the directory, which are the parent's if it has no ignore file.
+     */
+    std::shared_ptr<const Directory> enter(const std::shared_ptr<const Directory>& parent, const fs::path& directory,
+                                           std::string_view relative) const;
+    /**
+     * @brief Checks whether an entry is searched, or a directory listed.
+     *
+     * Rejected entries are counted in Stats.
+     *
+     * @param rules The rules in effect in the entry's directory, as returned by enter().
+     * @param relative Path of the entry relative to the root, '/'-separated.
+     * @param name The last component of the path.
+     * @param is_directory Whether the entry is a directory.
+     */
+    bool accepts(const Directory* rules, std::string_view relative, std::string_view name, bool is_directory) const;
+    /**
+     * @brief Checks a file against the globs, file types and extension only, ignoring ignore files.
+     *
+     * For files that come from the trigram index rather than a traversal.
+     *
+     * @param relative Path of the file relative to the root, '/'-separated.
+     */
+    bool accepts_file(std::string_view relative) const;
+
+private:
+    bool accepts_type(std::string_view relative, std::string_view name) const;
+
+    bool use_ignore_files_;
+    GlobSet globs_{};
+    std::optional<GlobSet> types_{};
+    std::optional<std::string> file_extension_;
+};
+} // namespace mb
@@ -0,0 +1,240 @@
+#include "prefilter.h"
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+namespace mb {
+namespace {
+constexpr size_t kMaxSetBytes = 4;     ///< Larger byte sets like `\d` are not worth expanding
+constexpr size_t kMaxLiteralSize = 64; ///< Longer literals are not any more selective
+
+/**
+ * @brief What is known about the strings a regex node matches.
+ */
+struct Literals {
+    bool exact = false;               ///< The node matches exactly the strings, nothing else
+    std::vector<std::string> strings; ///< Otherwise every match contains one of them; empty if unknown
+};
+
+void dedupe(std::vector<std::string>& strings) {
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+}
+
+/**
+ * @brief Checks whether searching for the strings can rule anything out.
+ */
+bool useful(const std::vector<std::string>& strings) {
+    return !strings.empty() && strings.size() <= Prefilter::kMaxLiterals &&
+           std::none_of(strings.begin(), strings.end(), [](const std::string& s) { return s.empty(); });
+}
+
+size_t shortest(const std::vector<std::string>& strings) {
+    size_t size = kMaxLiteralSize;
+    for (const auto& s : strings) {
+        size = std::min(size, s.size());
+    }
+    return size;
+}
+
+/**
+ * @brief Checks whether a literal set makes a better prefilter than another one.
+ *
+ * Longer literals occur less often, and among equally long sets fewer literals are faster to
+ * search for.
+ */
+bool better(const std::vector<std::string>& candidate, const std::vector<std::string>& current) {
+    if (!useful(candidate)) {
+        return false;
+    }
+    if (!useful(current)) {
+        return true;
+    }
+    const size_t candidate_size = shortest(candidate);
+    const size_t current_size = shortest(current);
+    if (candidate_size != current_size) {
+        return candidate_size > current_size;
+    }
+    return candidate.size() < current.size();
+}
+
+/**
+ * @brief Concatenates every string of one set with every string of another.
+ * @return The product, or std::nullopt if it would hold too many or too long strings.
+ */
+std::optional<std::vector<std::string>> cross(const std::vector<std::string>& prefixes,
+                                              const std::vector<std::string>& suffixes) {
+    if (prefixes.size() * suffixes.size() > Prefilter::kMaxLiterals) {
+        return std::nullopt;
+    }
+    std::vector<std::string> product;
+    product.reserve(prefixes.size() * suffixes.size());
+    for (const auto& prefix : prefixes) {
+        for (const auto& suffix : suffixes) {
+            if (prefix.size() + suffix.size() > kMaxLiteralSize) {
+                return std::nullopt;
+            }
+            product.push_back(prefix + suffix);
+        }
+    }
+    dedupe(product);
+    return product;
+}
+
+Literals extract(const RegexNode& node, bool ignore_case);
+
+Literals extract_set(const RegexNode& node, const bool ignore_case) {
+    Literals literals{};
+    for (int b = 0; b < 256; ++b) {
+        if (!node.set.test(static_cast<size_t>(b))) {
+            continue;
+        }
+        // Case-insensitive sets hold both cases of a letter; the searcher folds the haystack.
+        const char c = ignore_case ? to_lower_ascii(static_cast<char>(b)) : static_cast<char>(b);
+        if (literals.strings.empty() || literals.strings.back() != std::string(1, c)) {
+            literals.strings.emplace_back(1, c);
+        }
+        if (literals.strings.size() > 2 * kMaxSetBytes) {
+            return {};
+        }
+    }
+    dedupe(literals.strings);
+    if (literals.strings.empty() || literals.strings.size() > kMaxSetBytes) {
+        return {};
+    }
+    literals.exact = true;
+    return literals;
+}
+
+Literals extract_concat(const RegexNode& node, const bool ignore_case) {
+    // Runs of exact children are multiplied out; a run ends at an inexact child or when the
+    // product grows too large, and the best literal set seen anywhere is kept.
+    std::optional<std::vector<std::string>> run = std::vector<std::string>{""};
+    std::vector<std::string> best;
+    bool exact = true;
+    for (const auto& child : node.children) {
+        Literals literals = extract(child, ignore_case);
+        if (literals.exact && run.has_value()) {
+            if (auto product = cross(*run, literals.strings); product.has_value()) {
+                run = std::move(product);
+                continue;
+            }
+        }
+        exact = false;
+        if (run.has_value() && better(*run, best)) {
+            best = std::move(*run);
+        }
+        if (literals.exact) {
+            run = std::move(literals.strings);
+            continue;
+        }
+        run.reset();
+        if (better(literals.strings, best)) {
+            best = std::move(literals.strings);
+        }
+    }
+    if (exact) {
+        return {true, std::move(*run)};
+    }
+    if (run.has_value() && better(*run, best)) {
+        best = std::move(*run);
+    }
+    return {false, std::move(best)};
+}
+
+Literals extract_alternate(const RegexNode& node, const bool ignore_case) {
+    Literals result{true, {}};
+    for (const auto& child : node.children) {
+        Literals literals = extract(child, ignore_case);
+        result.exact = result.exact && literals.exact;
+        // One branch without a required literal lets a match avoid all the others.
+        if (literals.strings.empty()) {
+            return {};
+        }
+        result.strings.insert(result.strings.end(), std::make_move_iterator(literals.strings.begin()),
+                              std::make_move_iterator(literals.strings.end()));
+        if (result.strings.size() > Prefilter::kMaxLiterals) {
+            return {};
+        }
+    }
+    dedupe(result.strings);
+    return result;
+}
+
+Literals extract_repeat(const RegexNode& node, const bool ignore_case) {
+    Literals literals = extract(node.children.front(), ignore_case);
+    if (node.min == 0) {
+        // `x?` matches x or nothing, anything looser may skip the child altogether.
+        if (node.max != 1 || !literals.exact) {
+            return {};
+        }
+        literals.strings.emplace_back();
+        dedupe(literals.strings);
+        return literals;
+    }
+    // At least one repetition is required, but the repeated strings are not spelled out.
+    literals.exact = literals.exact && node.min == 1 && node.max == 1;
+    return literals;
+}
+
+Literals extract(const RegexNode& node, const bool ignore_case) {
+    switch (node.kind) {
+    case RegexNode::Kind::Empty:
+    case RegexNode::Kind::LineBegin:
+    case RegexNode::Kind::LineEnd:
+        return {true, {""}};
+    case RegexNode::Kind::Set:
+        return extract_set(node, ignore_case);
+    case RegexNode::Kind::Concat:
+        return extract_concat(node, ignore_case);
+    case RegexNode::Kind::Alternate:
+        return extract_alternate(node, ignore_case);
+    case RegexNode::Kind::Repeat:
+        return extract_repeat(node, ignore_case);
+    }
+    return {};
+}
+} // namespace
+
+std::vector<std::string> Prefilter::required_literals(const RegexNode& root, const bool ignore_case) {
+    Literals literals = extract(root, ignore_case);
+    if (!useful(literals.strings)) {
+        return {};
+    }
+    return std::move(literals.strings);
+}
+
+std::unique_ptr<Prefilter> Prefilter::create(const RegexNode& root, const bool ignore_case) {
+    auto literals = required_literals(root, ignore_case);
+    if (literals.empty()) {
+        return nullptr;
+    }
+    return std::unique_ptr<Prefilter>(new Prefilter(std::move(literals), ignore_case));
+}
+
+Prefilter::Prefilter(std::vector<std::string> literals, const bool ignore_case) : literals_(std::move(literals)) {
+    searchers_.reserve(literals_.size());
+    for (const auto& literal : literals_) {
+        searchers_.emplace_back(literal, ignore_case);
+    }
+}
+
+Prefilter::Cursor::Cursor(const Prefilter& prefilter, const std::string_view haystack)
+    : prefilter_(prefilter), haystack_(haystack) {}
+
+size_t Prefilter::Cursor::next(const size_t from) {
+    size_t first = std::string_view::npos;
+    for (size_t i = 0; i < prefilter_.searchers_.size(); ++i) {
+        size_t& position = positions_[i];
+        if (position != std::string_view::npos && (!started_ || position < from)) {
+            const size_t found = from <= haystack_.size() ? prefilter_.searchers_[i].find(haystack_.substr(from))
+                                                          : std::string_view::npos;
+            position = found == std::string_view::npos ? found : from + found;
+        }
+        first = std::min(first, position);
+    }
+    started_ = true;
+    return first;
+}
+} // namespace mb
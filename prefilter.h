@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "literal_search.h"
+#include "regex_parser.h"
+
+namespace mb {
+/**
+ * @class Prefilter
+ * @brief Finds candidate positions for a regex from the literals every match must contain.
+ *
+ * At construction time the parsed regex is searched for a set of literal strings such that
+ * any match contains at least one of them, e.g. `timeout` for `ERROR.*timeout` or
+ * {`fox jumps`, `dog jumps`} for `(fox|dog) jumps`. Searching for those literals with the
+ * vectorized LiteralSearcher is much faster than running the regex engine, so the engine
+ * only has to look at the lines the literals occur in.
+ */
+class Prefilter final {
+public:
+    static constexpr size_t kMaxLiterals = 16;
+
+    /**
+     * @brief Extracts the required literals of a regex.
+     *
+     * @param root The parsed regex.
+     * @param ignore_case If true, the literals are searched case-insensitively.
+     * @return The prefilter, or nullptr if the regex has no useful required literal.
+     */
+    static std::unique_ptr<Prefilter> create(const RegexNode& root, bool ignore_case);
+
+    /**
+     * @brief Extracts the literal set every match of a regex contains.
+     *
+     * @param root The parsed regex.
+     * @param ignore_case If true, letters are reported in lowercase.
+     * @return The literals, or an empty vector if nothing useful is required.
+     */
+    static std::vector<std::string> required_literals(const RegexNode& root, bool ignore_case);
+
+    /**
+     * @brief Returns the literals being searched for.
+     */
+    const std::vector<std::string>& literals() const { return literals_; }
+
+    /**
+     * @class Cursor
+     * @brief Walks the candidate positions of one haystack in increasing order.
+     *
+     * The next occurrence of every literal is remembered, so each literal is searched for
+     * at most once per occurrence no matter how many candidates the other literals produce.
+     */
+    class Cursor final {
+    public:
+        Cursor(const Prefilter& prefilter, std::string_view haystack);
+
+        /**
+         * @brief Finds the first occurrence of any literal at or after the given offset.
+         *
+         * @param from Offset into the haystack; must not decrease between calls.
+         * @return Offset of the occurrence, or std::string_view::npos if there is none.
+         */
+        size_t next(size_t from);
+
+    private:
+        const Prefilter& prefilter_;
+        std::string_view haystack_;
+        std::array<size_t, kMaxLiterals> positions_{}; ///< Next known occurrence of each literal
+        bool started_ = false;
+    };
+
+private:
+    explicit Prefilter(std::vector<std::string> literals, bool ignore_case);
+
+    std::vector<std::string> literals_;
+    std::vector<LiteralSearcher> searchers_;
+};
+} // namespace mb
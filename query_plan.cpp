@@ -0,0 +1,99 @@
+#include "query_plan.h"
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+
+#include "regex_parser.h"
+
+namespace mb {
+namespace {
+/**
+ * @brief Appends the string a node matches, if it matches exactly one.
+ * @return false if the node matches more than one string or depends on the position.
+ */
+bool append_literal(const RegexNode& node, std::string& literal) {
+    switch (node.kind) {
+    case RegexNode::Kind::Empty:
+        return true;
+    case RegexNode::Kind::Set:
+        if (node.set.count() != 1) {
+            return false;
+        }
+        for (unsigned c = 0; c < node.set.size(); ++c) {
+            if (node.set.test(c)) {
+                literal += static_cast<char>(c);
+            }
+        }
+        return true;
+    case RegexNode::Kind::Concat:
+        return std::ranges::all_of(node.children, [&literal](const RegexNode& child) {
+            return append_literal(child, literal);
+        });
+    case RegexNode::Kind::Repeat:
+        if (node.min != node.max) {
+            return false;
+        }
+        for (int i = 0; i < node.min; ++i) {
+            if (!append_literal(node.children.front(), literal)) {
+                return false;
+            }
+        }
+        return true;
+    case RegexNode::Kind::Alternate:
+        return node.children.size() == 1 && append_literal(node.children.front(), literal);
+    case RegexNode::Kind::LineBegin:
+    case RegexNode::Kind::LineEnd:
+        return false;
+    }
+    return false;
+}
+
+/**
+ * @brief Collects the literals of a node that is a literal or an alternation of literals.
+ * @return false if it is something else.
+ */
+bool collect_literals(const RegexNode& node, std::vector<std::string>& literals) {
+    if (node.kind == RegexNode::Kind::Alternate && node.children.size() != 1) {
+        return std::ranges::all_of(node.children, [&literals](const RegexNode& child) {
+            return collect_literals(child, literals);
+        });
+    }
+    std::string literal{};
+    if (!append_literal(node, literal)) {
+        return false;
+    }
+    literals.push_back(std::move(literal));
+    return true;
+}
+} // namespace
+
+QueryPlan QueryPlan::create(const std::vector<std::string>& patterns, const bool use_regex) {
+    QueryPlan plan{};
+    if (use_regex) {
+        for (const auto& pattern : patterns) {
+            const std::optional<RegexNode> root = parse_regex(pattern);
+            if (!root.has_value() || !collect_literals(*root, plan.literals)) {
+                return {Kind::Regex, {}};
+            }
+        }
+    } else {
+        plan.literals = patterns;
+    }
+    // The empty literal matches every line, whatever the other literals are.
+    if (std::ranges::find(plan.literals, std::string{}) != plan.literals.end()) {
+        return {Kind::Literal, {std::string{}}};
+    }
+    std::unordered_set<std::string_view> seen{};
+    std::vector<std::string> distinct{};
+    for (const auto& literal : plan.literals) {
+        if (seen.insert(literal).second) {
+            distinct.push_back(literal);
+        }
+    }
+    plan.literals = std::move(distinct);
+    plan.kind = plan.literals.size() == 1 ? Kind::Literal : Kind::Alternation;
+    return plan;
+}
+} // namespace mb
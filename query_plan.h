@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace mb {
+/**
+ * @brief How a query is searched, picked from what its patterns turn out to be.
+ *
+ * A regex that only spells out a literal, like `main\(` or `a{3}`, is searched like a plain
+ * substring by the vectorized kernel, and an alternation of literals, like `foo|bar` or
+ * several such patterns given with -e, by the multi-literal searcher; neither needs an
+ * automaton. Everything else, literals anchored to the start or end of a line included, is a
+ * regex: the automaton handles the anchors at no extra cost and looks for the literals the
+ * match requires first.
+ */
+struct QueryPlan {
+    /**
+     * @brief What the patterns are.
+     */
+    enum class Kind {
+        Literal,     ///< A single literal; literals holds it
+        Alternation, ///< Any of several literals; literals holds them
+        Regex,       ///< Anything else, including literals anchored with `^` or `$`
+    };
+
+    Kind kind = Kind::Regex;
+    std::vector<std::string> literals{}; ///< The literals of Literal and Alternation, without duplicates
+
+    /**
+     * @brief Classifies a query.
+     *
+     * Regex patterns are parsed case-sensitively, since the literal engines fold case themselves.
+     *
+     * @param patterns The patterns, any of which a line has to match.
+     * @param use_regex If true, the patterns are regular expressions; otherwise they are literals.
+     * @return The plan.
+     */
+    static QueryPlan create(const std::vector<std::string>& patterns, bool use_regex);
+};
+} // namespace mb
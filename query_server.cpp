@@ -0,0 +1,310 @@
+#include "query_server.h"
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MB_HAVE_UNIX_SOCKETS 1
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+#ifdef MB_HAVE_UNIX_SOCKETS
+namespace {
+constexpr size_t kMaxQuerySize = size_t{1} << 20; ///< Longer queries are refused
+constexpr size_t kChunkSize = size_t{64} << 10;   ///< Largest chunk of output sent at once
+constexpr size_t kChunkHeaderSize = 4;            ///< The 32-bit size that starts every chunk
+#ifdef SOCK_CLOEXEC
+constexpr int kSocketType = SOCK_STREAM | SOCK_CLOEXEC;
+#else
+constexpr int kSocketType = SOCK_STREAM;
+#endif
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+/**
+ * @brief Closes a file descriptor when it goes out of scope.
+ */
+struct Descriptor {
+    int fd;
+
+    explicit Descriptor(const int fd) : fd(fd) {}
+    ~Descriptor() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    Descriptor(const Descriptor&) = delete;
+    Descriptor& operator=(const Descriptor&) = delete;
+};
+
+sockaddr_un socket_address(const fs::path& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const std::string& name = path.native();
+    if (name.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path " + name + " is too long");
+    }
+    std::memcpy(address.sun_path, name.c_str(), name.size() + 1);
+    return address;
+}
+
+/**
+ * @brief Connects to the socket at a path.
+ * @return The connected socket, or -1.
+ */
+int connect_to(const sockaddr_un& address) {
+    const int fd = ::socket(AF_UNIX, kSocketType, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Writes all of a buffer, retrying after interruptions and short writes.
+ * @return false if writing failed.
+ */
+bool write_all(const int fd, std::string_view data, const bool socket) {
+    while (!data.empty()) {
+        const ssize_t written = socket ? ::send(fd, data.data(), data.size(), kSendFlags)
+                                       : ::write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a chunk header: its size as a 32-bit little-endian integer.
+ */
+void store_chunk_size(char* const out, const size_t size) {
+    for (size_t i = 0; i < kChunkHeaderSize; ++i) {
+        out[i] = static_cast<char>((size >> (8 * i)) & 0xff);
+    }
+}
+
+/**
+ * @brief Reads a chunk header.
+ */
+size_t load_chunk_size(const char* const in) {
+    size_t size = 0;
+    for (size_t i = 0; i < kChunkHeaderSize; ++i) {
+        size |= size_t{static_cast<unsigned char>(in[i])} << (8 * i);
+    }
+    return size;
+}
+
+/**
+ * @brief Sends what is written to a pipe to the client in chunks, until the pipe is closed.
+ *
+ * Once the client is gone the pipe is closed on this end too, so the search fails its next
+ * write and is cancelled instead of blocking on a full pipe.
+ *
+ * @param pipe The read end of the pipe; closed when done.
+ * @param client The client's socket.
+ */
+void relay_output(const int pipe, const int client) {
+    const Descriptor input{pipe};
+    std::string chunk(kChunkHeaderSize + kChunkSize, '\0');
+    while (true) {
+        const ssize_t size = ::read(input.fd, chunk.data() + kChunkHeaderSize, kChunkSize);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            return;
+        }
+        store_chunk_size(chunk.data(), static_cast<size_t>(size));
+        if (!write_all(client, std::string_view{chunk.data(), kChunkHeaderSize + static_cast<size_t>(size)}, true)) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Reads the arguments of a query up to the end of the client's half of the connection.
+ * @return false if reading failed or the query is too long.
+ */
+bool read_query(const int fd, std::vector<std::string>& args) {
+    std::string data{};
+    char buffer[4096];
+    while (true) {
+        const ssize_t size = ::read(fd, buffer, sizeof(buffer));
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 || data.size() + static_cast<size_t>(size) > kMaxQuerySize) {
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+        data.append(buffer, static_cast<size_t>(size));
+    }
+    for (size_t begin = 0; begin < data.size();) {
+        const size_t end = data.find('\0', begin);
+        if (end == std::string::npos) {
+            return false; // The last argument was cut off
+        }
+        args.emplace_back(data, begin, end - begin);
+        begin = end + 1;
+    }
+    return true;
+}
+} // namespace
+
+QueryServer::QueryServer(fs::path socket_path) : socket_path_(std::move(socket_path)) {
+    const sockaddr_un address = socket_address(socket_path_);
+    if (const Descriptor running{connect_to(address)}; running.fd >= 0) {
+        throw std::runtime_error("another server is listening on " + socket_path_.string());
+    }
+    std::error_code error{};
+    fs::remove(socket_path_, error); // Left behind by a server that was killed
+    fd_ = ::socket(AF_UNIX, kSocketType, 0);
+    if (fd_ < 0 || ::bind(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(fd_, SOMAXCONN) != 0) {
+        const std::string reason = std::strerror(errno);
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        throw std::runtime_error("cannot listen on " + socket_path_.string() + ": " + reason);
+    }
+    // A client that goes away mid-query must not take the server with it; the search notices
+    // the failed writes instead.
+    std::signal(SIGPIPE, SIG_IGN);
+}
+
+QueryServer::~QueryServer() {
+    ::close(fd_);
+    std::error_code error{};
+    fs::remove(socket_path_, error);
+}
+
+void QueryServer::run(const Handler& handler) {
+    while (true) {
+        const Descriptor client{::accept(fd_, nullptr, nullptr)};
+        if (client.fd < 0) {
+            continue;
+        }
+        std::vector<std::string> args{};
+        if (!read_query(client.fd, args)) {
+            continue;
+        }
+        // The search writes into a pipe, whose contents are framed on their way to the client.
+        int pipe_fds[2];
+        if (::pipe(pipe_fds) != 0) {
+            continue;
+        }
+        std::thread relay{relay_output, pipe_fds[0], client.fd};
+        Reply reply{};
+        {
+            const Descriptor output{pipe_fds[1]};
+            try {
+                reply = handler(args, output.fd);
+            } catch (const std::exception& ex) {
+                reply = {kErrorStatus, std::string{"Exception: "} + ex.what()};
+            } catch (...) {
+                reply = {kErrorStatus, "Unknown exception!"};
+            }
+        }
+        relay.join();
+        std::string trailer(kChunkHeaderSize, '\0'); // A chunk of size 0 ends the output
+        trailer += static_cast<char>(reply.status);
+        trailer += reply.message;
+        write_all(client.fd, trailer, true);
+    }
+}
+
+int QueryServer::query(const fs::path& socket_path, const std::vector<std::string>& args) {
+    const Descriptor server{connect_to(socket_address(socket_path))};
+    if (server.fd < 0) {
+        throw std::runtime_error("no server is listening on " + socket_path.string() + ", start one with --serve");
+    }
+    std::string request{};
+    for (const auto& arg : args) {
+        request += arg;
+        request += '\0';
+    }
+    if (!write_all(server.fd, request, true) || ::shutdown(server.fd, SHUT_WR) != 0) {
+        throw std::runtime_error("cannot send the query to " + socket_path.string());
+    }
+    // Chunks of output go straight to stdout until the empty one that starts the trailer.
+    std::string pending{}; // Received but not handled yet, starting at a chunk header
+    std::string trailer{};
+    bool in_trailer = false;
+    char buffer[64 << 10];
+    while (true) {
+        const ssize_t size = ::read(server.fd, buffer, sizeof(buffer));
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            break;
+        }
+        if (in_trailer) {
+            trailer.append(buffer, static_cast<size_t>(size));
+            continue;
+        }
+        pending.append(buffer, static_cast<size_t>(size));
+        size_t begin = 0;
+        while (pending.size() - begin >= kChunkHeaderSize) {
+            const size_t chunk_size = load_chunk_size(pending.data() + begin);
+            if (chunk_size == 0) {
+                in_trailer = true;
+                trailer.assign(pending, begin + kChunkHeaderSize);
+                break;
+            }
+            if (pending.size() - begin - kChunkHeaderSize < chunk_size) {
+                break;
+            }
+            write_all(STDOUT_FILENO, std::string_view{pending}.substr(begin + kChunkHeaderSize, chunk_size), false);
+            begin += kChunkHeaderSize + chunk_size;
+        }
+        if (!in_trailer) {
+            pending.erase(0, begin);
+        }
+    }
+    if (trailer.empty()) {
+        throw std::runtime_error("the server closed the connection before the query finished");
+    }
+    if (trailer.size() > 1) {
+        std::cerr << std::string_view{trailer}.substr(1) << std::endl;
+    }
+    return static_cast<unsigned char>(trailer.front());
+}
+#else
+QueryServer::QueryServer(fs::path socket_path) : socket_path_(std::move(socket_path)) {
+    throw std::runtime_error("--serve requires Unix domain sockets");
+}
+
+QueryServer::~QueryServer() = default;
+
+void QueryServer::run(const Handler&) {
+    throw std::runtime_error("--serve requires Unix domain sockets");
+}
+
+int QueryServer::query(const fs::path&, const std::vector<std::string>&) {
+    throw std::runtime_error("--connect requires Unix domain sockets");
+}
+#endif
+} // namespace mb
@@ -0,0 +1,83 @@
+#pragma once
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class QueryServer
+ * @brief Answers search queries sent over a Unix domain socket, for a process that stays up.
+ *
+ * A query is the command line of a search without the program name and the directory; the
+ * client sends every argument followed by a NUL byte and then shuts down its side of the
+ * connection. The server streams the output back as the search produces it, in chunks that
+ * each start with their size as a 32-bit little-endian integer, so the output may hold any
+ * bytes. A chunk of size 0 ends it and is followed by the exit status as one byte and a
+ * message for stderr, if any, up to the end of the connection.
+ *
+ * Queries are handled one at a time, each by the whole thread pool of the process.
+ *
+ * Only available where Unix domain sockets are; elsewhere the constructor and query() throw.
+ */
+class QueryServer final {
+public:
+    static constexpr int kErrorStatus = 2; ///< Exit status of a search that failed, as grep's
+
+    /**
+     * @brief How a query ended.
+     */
+    struct Reply {
+        int status = 0;        ///< Exit status of the client
+        std::string message{}; ///< Printed to the client's stderr unless empty
+    };
+
+    /**
+     * @brief Runs a query, writing its output to the file descriptor.
+     */
+    using Handler = std::function<Reply(const std::vector<std::string>& args, int fd)>;
+
+    /**
+     * @brief Creates the socket and starts listening on it.
+     *
+     * A socket file left behind by a server that is gone is replaced.
+     *
+     * @param socket_path Path of the socket file.
+     * @throws std::runtime_error If the socket cannot be created or another server listens on it.
+     */
+    explicit QueryServer(fs::path socket_path);
+    /**
+     * @brief Closes the socket and removes its file.
+     */
+    ~QueryServer();
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    /**
+     * @brief Answers queries until the process is stopped.
+     *
+     * An exception thrown by the handler is reported to the client the way a search run by
+     * itself reports it.
+     *
+     * @param handler Runs every query.
+     */
+    [[noreturn]] void run(const Handler& handler);
+
+    /**
+     * @brief Sends a query to a server and copies its output to stdout.
+     *
+     * @param socket_path Path of the server's socket file.
+     * @param args The command line of the search, without the program name and the directory.
+     * @return The exit status the server replied with.
+     * @throws std::runtime_error If no server listens on the socket or the connection breaks.
+     */
+    static int query(const fs::path& socket_path, const std::vector<std::string>& args);
+
+private:
+    fs::path socket_path_;
+    int fd_ = -1;
+};
+} // namespace mb
@@ -0,0 +1,415 @@
+#include "regex_parser.h"
+
+#include <cctype>
+#include <utility>
+
+#include "literal_search.h"
+
+namespace mb {
+namespace {
+constexpr int kMaxRepeat = 1000; ///< Larger counted repetitions are left to the fallback engine
+
+/**
+ * @brief Thrown internally when the pattern leaves the supported subset.
+ */
+struct Unsupported {};
+
+ByteSet byte_range(const unsigned char first, const unsigned char last) {
+    ByteSet set{};
+    for (unsigned c = first; c <= last; ++c) {
+        set.set(c);
+    }
+    return set;
+}
+
+ByteSet digit_set() { return byte_range('0', '9'); }
+
+ByteSet word_set() { return byte_range('a', 'z') | byte_range('A', 'Z') | digit_set() | byte_range('_', '_'); }
+
+ByteSet space_set() { return byte_range('\t', '\r') | byte_range(' ', ' '); }
+
+ByteSet single(const unsigned char c) {
+    ByteSet set{};
+    set.set(c);
+    return set;
+}
+
+ByteSet fold_case(ByteSet set) {
+    for (char c = 'a'; c <= 'z'; ++c) {
+        const auto lower = static_cast<unsigned char>(c);
+        const auto upper = static_cast<unsigned char>(to_upper_ascii(c));
+        if (set.test(lower) || set.test(upper)) {
+            set.set(lower);
+            set.set(upper);
+        }
+    }
+    return set;
+}
+
+RegexNode make_node(const RegexNode::Kind kind) {
+    RegexNode node{};
+    node.kind = kind;
+    return node;
+}
+
+int hex_value(const char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief Recursive descent parser over the pattern text.
+ */
+class Parser {
+public:
+    Parser(const std::string_view pattern, const bool ignore_case) : pattern_(pattern), ignore_case_(ignore_case) {}
+
+    RegexNode parse() {
+        RegexNode root = parse_alternation();
+        if (!at_end()) {
+            throw Unsupported{}; // An unbalanced ')'
+        }
+        return root;
+    }
+
+private:
+    bool at_end() const { return pos_ >= pattern_.size(); }
+
+    char peek() const { return pattern_[pos_]; }
+
+    bool consume(const char c) {
+        if (!at_end() && peek() == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    char next() {
+        if (at_end()) {
+            throw Unsupported{};
+        }
+        return pattern_[pos_++];
+    }
+
+    RegexNode parse_alternation() {
+        RegexNode first = parse_concat();
+        if (at_end() || peek() != '|') {
+            return first;
+        }
+        RegexNode node = make_node(RegexNode::Kind::Alternate);
+        node.children.push_back(std::move(first));
+        while (consume('|')) {
+            node.children.push_back(parse_concat());
+        }
+        return node;
+    }
+
+    RegexNode parse_concat() {
+        RegexNode node = make_node(RegexNode::Kind::Concat);
+        while (!at_end() && peek() != '|' && peek() != ')') {
+            node.children.push_back(parse_quantified());
+        }
+        if (node.children.empty()) {
+            return make_node(RegexNode::Kind::Empty);
+        }
+        if (node.children.size() == 1) {
+            return std::move(node.children.front());
+        }
+        return node;
+    }
+
+    RegexNode parse_quantified() {
+        const bool assertion = peek() == '^' || peek() == '$';
+        RegexNode atom = parse_atom();
+        while (!at_end()) {
+            int min = 0;
+            int max = -1;
+            if (consume('*')) {
+            } else if (consume('+')) {
+                min = 1;
+            } else if (consume('?')) {
+                max = 1;
+            } else if (!at_end() && peek() == '{') {
+                parse_braces(min, max);
+            } else {
+                break;
+            }
+            if (assertion) {
+                throw Unsupported{}; // std::regex rejects quantified assertions
+            }
+            consume('?'); // A lazy quantifier accepts the same lines as a greedy one
+            RegexNode repeat = make_node(RegexNode::Kind::Repeat);
+            repeat.min = min;
+            repeat.max = max;
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    int parse_number() {
+        if (at_end() || !std::isdigit(static_cast<unsigned char>(peek()))) {
+            throw Unsupported{};
+        }
+        int value = 0;
+        while (!at_end() && std::isdigit(static_cast<unsigned char>(peek()))) {
+            value = value * 10 + (next() - '0');
+            if (value > kMaxRepeat) {
+                throw Unsupported{};
+            }
+        }
+        return value;
+    }
+
+    void parse_braces(int& min, int& max) {
+        next(); // '{'
+        min = parse_number();
+        max = min;
+        if (consume(',')) {
+            max = !at_end() && peek() == '}' ? -1 : parse_number();
+        }
+        if (!consume('}') || (max >= 0 && max < min)) {
+            throw Unsupported{};
+        }
+    }
+
+    RegexNode parse_atom() {
+        const char c = next();
+        switch (c) {
+        case '(': {
+            if (consume('?')) {
+                if (!consume(':')) {
+                    throw Unsupported{}; // Lookaheads
+                }
+            }
+            RegexNode inner = parse_alternation();
+            if (!consume(')')) {
+                throw Unsupported{};
+            }
+            return inner;
+        }
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            throw Unsupported{};
+        case '^':
+            return make_node(RegexNode::Kind::LineBegin);
+        case '$':
+            return make_node(RegexNode::Kind::LineEnd);
+        case '.':
+            return set_node(~(single('\n') | single('\r')));
+        case '[':
+            return set_node(parse_bracket());
+        case '\\':
+            return set_node(parse_escape(false));
+        default:
+            return set_node(single(static_cast<unsigned char>(c)));
+        }
+    }
+
+    RegexNode set_node(const ByteSet& set) const {
+        RegexNode node = make_node(RegexNode::Kind::Set);
+        node.set = ignore_case_ ? fold_case(set) : set;
+        return node;
+    }
+
+    /**
+     * @brief Parses the part of an escape after the backslash.
+     * @param in_bracket True inside a bracket expression, where `\b` is a backspace.
+     */
+    ByteSet parse_escape(const bool in_bracket) {
+        const char c = next();
+        switch (c) {
+        case 'd':
+            return digit_set();
+        case 'D':
+            return ~digit_set();
+        case 'w':
+            return word_set();
+        case 'W':
+            return ~word_set();
+        case 's':
+            return space_set();
+        case 'S':
+            return ~space_set();
+        case 't':
+            return single('\t');
+        case 'n':
+            return single('\n');
+        case 'v':
+            return single('\v');
+        case 'f':
+            return single('\f');
+        case 'r':
+            return single('\r');
+        case 'b':
+            if (in_bracket) {
+                return single('\b');
+            }
+            throw Unsupported{}; // Word boundaries need the previous byte
+        case '0':
+            if (!at_end() && std::isdigit(static_cast<unsigned char>(peek()))) {
+                throw Unsupported{};
+            }
+            return single('\0');
+        case 'x':
+            return single(parse_hex(2));
+        case 'u':
+            return single(parse_hex(4));
+        default:
+            // Other letters and digits are backreferences, \B, \c and the like.
+            if (std::isalnum(static_cast<unsigned char>(c)) || static_cast<unsigned char>(c) >= 0x80) {
+                throw Unsupported{};
+            }
+            return single(static_cast<unsigned char>(c));
+        }
+    }
+
+    unsigned char parse_hex(const int digits) {
+        int value = 0;
+        for (int i = 0; i < digits; ++i) {
+            const int digit = hex_value(next());
+            if (digit < 0) {
+                throw Unsupported{};
+            }
+            value = value * 16 + digit;
+        }
+        if (value >= 0x80) {
+            throw Unsupported{}; // std::regex narrows these to a signed char
+        }
+        return static_cast<unsigned char>(value);
+    }
+
+    /**
+     * @brief Parses a single bracket item that can be a range endpoint.
+     * @param set Receives a whole class (like `\d` or `[:alpha:]`) if the item is one.
+     * @return The byte, or -1 if the item was a class.
+     */
+    int parse_bracket_atom(ByteSet& set) {
+        const char c = next();
+        if (static_cast<unsigned char>(c) >= 0x80) {
+            throw Unsupported{};
+        }
+        if (c == '[' && !at_end() && peek() == ':') {
+            set = parse_named_class();
+            return -1;
+        }
+        if (c == '[' && !at_end() && (peek() == '.' || peek() == '=')) {
+            throw Unsupported{};
+        }
+        if (c != '\\') {
+            return static_cast<unsigned char>(c);
+        }
+        const ByteSet escaped = parse_escape(true);
+        if (escaped.count() != 1) {
+            set = escaped;
+            return -1;
+        }
+        for (int b = 0; b < 256; ++b) {
+            if (escaped.test(static_cast<size_t>(b))) {
+                return b;
+            }
+        }
+        return -1;
+    }
+
+    ByteSet parse_named_class() {
+        next(); // ':'
+        const size_t end = pattern_.find(":]", pos_);
+        if (end == std::string_view::npos) {
+            throw Unsupported{};
+        }
+        const std::string_view name = pattern_.substr(pos_, end - pos_);
+        pos_ = end + 2;
+        if (name == "w") {
+            return word_set();
+        }
+        struct NamedClass {
+            std::string_view name;
+            int (*predicate)(int);
+        };
+        // The C locale classification, which is what std::regex uses by default.
+        static constexpr NamedClass classes[] = {
+            {"alpha", [](const int b) { return std::isalpha(b); }},
+            {"digit", [](const int b) { return std::isdigit(b); }},
+            {"alnum", [](const int b) { return std::isalnum(b); }},
+            {"space", [](const int b) { return std::isspace(b); }},
+            {"upper", [](const int b) { return std::isupper(b); }},
+            {"lower", [](const int b) { return std::islower(b); }},
+            {"punct", [](const int b) { return std::ispunct(b); }},
+            {"xdigit", [](const int b) { return std::isxdigit(b); }},
+            {"blank", [](const int b) { return std::isblank(b); }},
+            {"cntrl", [](const int b) { return std::iscntrl(b); }},
+            {"print", [](const int b) { return std::isprint(b); }},
+            {"graph", [](const int b) { return std::isgraph(b); }},
+        };
+        for (const auto& [class_name, predicate] : classes) {
+            if (class_name != name) {
+                continue;
+            }
+            ByteSet set{};
+            for (int b = 0; b < 0x80; ++b) {
+                if (predicate(b) != 0) {
+                    set.set(static_cast<size_t>(b));
+                }
+            }
+            return set;
+        }
+        throw Unsupported{};
+    }
+
+    ByteSet parse_bracket() {
+        const bool negated = consume('^');
+        ByteSet set{};
+        while (!consume(']')) {
+            ByteSet item{};
+            const int first = parse_bracket_atom(item);
+            if (first >= 0 && !at_end() && peek() == '-' && pos_ + 1 < pattern_.size() &&
+                pattern_[pos_ + 1] != ']') {
+                next(); // '-'
+                ByteSet ignored{};
+                const int last = parse_bracket_atom(ignored);
+                if (last < first) {
+                    throw Unsupported{}; // Invalid or class-valued range endpoints
+                }
+                set |= byte_range(static_cast<unsigned char>(first), static_cast<unsigned char>(last));
+            } else if (first >= 0) {
+                set.set(static_cast<size_t>(first));
+            } else if (!at_end() && peek() == '-' && pos_ + 1 < pattern_.size() && pattern_[pos_ + 1] != ']') {
+                throw Unsupported{}; // A class cannot start a range
+            } else {
+                set |= item;
+            }
+        }
+        // Both cases join the set before it is negated, which is how std::regex treats [^a] with icase.
+        if (ignore_case_) {
+            set = fold_case(set);
+        }
+        return negated ? ~set : set;
+    }
+
+    std::string_view pattern_;
+    bool ignore_case_;
+    size_t pos_ = 0;
+};
+} // namespace
+
+std::optional<RegexNode> parse_regex(const std::string_view pattern, const bool ignore_case) {
+    try {
+        return Parser{pattern, ignore_case}.parse();
+    } catch (const Unsupported&) {
+        return std::nullopt;
+    }
+}
+} // namespace mb
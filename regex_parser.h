@@ -0,0 +1,52 @@
+#pragma once
+#include <bitset>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace mb {
+/**
+ * @brief A set of byte values.
+ */
+using ByteSet = std::bitset<256>;
+
+/**
+ * @brief Node of a parsed regular expression.
+ *
+ * Literals, `.`, escapes like `\d` and bracket expressions all become a Set node holding the
+ * bytes they accept, so the tree only needs a handful of node kinds. For case-insensitive
+ * patterns the sets already contain both cases of every letter.
+ */
+struct RegexNode {
+    enum class Kind {
+        Empty,     ///< Matches the empty string
+        Set,       ///< Matches one byte contained in set
+        Concat,    ///< Matches the children one after another
+        Alternate, ///< Matches any one of the children
+        Repeat,    ///< Matches the only child between min and max times
+        LineBegin, ///< `^`, matches at the start of a line
+        LineEnd,   ///< `$`, matches at the end of a line
+    };
+
+    Kind kind = Kind::Empty;
+    ByteSet set{};                   ///< Accepted bytes of a Set node
+    int min = 0;                     ///< Minimal repetition count of a Repeat node
+    int max = 0;                     ///< Maximal repetition count of a Repeat node, -1 if unbounded
+    std::vector<RegexNode> children; ///< Operands of Concat, Alternate and Repeat nodes
+};
+
+/**
+ * @brief Parses an ECMAScript regular expression into a RegexNode tree.
+ *
+ * Only the subset that can be matched by a finite automaton is understood: literals, `.`,
+ * character classes, escapes, groups, alternation, the usual quantifiers and the `^`/`$`
+ * anchors. Backreferences, lookaheads, word boundaries and anything malformed are rejected,
+ * so callers can fall back to a backtracking engine that either supports the construct or
+ * reports the syntax error.
+ *
+ * @param pattern The regex pattern.
+ * @param ignore_case If true, ASCII letters match regardless of case.
+ * @return The parsed tree, or std::nullopt if the pattern is outside the supported subset.
+ */
+std::optional<RegexNode> parse_regex(std::string_view pattern, bool ignore_case = false);
+} // namespace mb
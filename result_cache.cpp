@@ -0,0 +1,238 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <unordered_set>
+
+namespace mb {
+namespace {
+constexpr char kMagic[8] = {'M', 'B', 'G', 'R', 'R', 'E', 'S', '\0'};
+constexpr uint32_t kVersion = 1; ///< Also tells apart a cache written with the other byte order
+constexpr auto kRacyPeriod = std::chrono::seconds{1};
+#ifdef _WIN32
+using MtimeUnit = fs::file_time_type::duration;
+#else
+using MtimeUnit = std::chrono::nanoseconds;
+#endif
+
+template <typename T>
+void append(std::string& out, const T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void append_string(std::string& out, const std::string_view text) {
+    append(out, static_cast<uint32_t>(text.size()));
+    out += text;
+}
+
+/**
+ * @brief Reads the values append() wrote, failing at the first one that runs past the end.
+ */
+class Decoder final {
+public:
+    explicit Decoder(const std::string_view bytes) : bytes_(bytes) {}
+
+    template <typename T>
+    bool read(T& value) {
+        if (bytes_.size() - pos_ < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, bytes_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool read_bytes(const size_t size, std::string_view& bytes) {
+        if (bytes_.size() - pos_ < size) {
+            return false;
+        }
+        bytes = bytes_.substr(pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    bool read_string(std::string_view& text) {
+        uint32_t size = 0;
+        return read(size) && read_bytes(size, text);
+    }
+
+    bool done() const { return pos_ == bytes_.size(); }
+
+private:
+    std::string_view bytes_;
+    size_t pos_ = 0;
+};
+
+void encode_entry(std::string& out, const std::string_view path, const FileIdentity& identity,
+                  const ResultCache::Result& result) {
+    append_string(out, path);
+    append(out, identity.size);
+    append(out, identity.mtime);
+    append(out, identity.inode);
+    append(out, identity.device);
+    append(out, static_cast<uint8_t>(result.complete));
+    append(out, static_cast<uint32_t>(result.lines.size()));
+    for (const auto& [line_num, line] : result.lines) {
+        append(out, static_cast<uint64_t>(line_num));
+        append_string(out, line);
+    }
+}
+
+/**
+ * @brief Returns the current time the way FileIdentity::mtime counts it.
+ */
+int64_t now_as_mtime() {
+#ifdef _WIN32
+    return static_cast<int64_t>(fs::file_time_type::clock::now().time_since_epoch().count());
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+} // namespace
+
+ResultCache::ResultCache(fs::path cache_path, std::string query)
+    : cache_path_(std::move(cache_path)), query_(std::move(query)) {
+    racy_after_ = now_as_mtime() - std::chrono::duration_cast<MtimeUnit>(kRacyPeriod).count();
+    std::ifstream in{cache_path_, std::ios::binary};
+    if (!in) {
+        return;
+    }
+    const std::string contents{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+    Decoder file{contents};
+    std::string_view magic{};
+    uint32_t version = 0;
+    uint32_t section_count = 0;
+    if (!file.read_bytes(sizeof(kMagic), magic) || magic != std::string_view{kMagic, sizeof(kMagic)} ||
+        !file.read(version) || version != kVersion || !file.read(section_count)) {
+        return;
+    }
+    std::vector<std::string> others{};
+    std::unordered_map<std::string, Entry> loaded{};
+    for (uint32_t section = 0; section < section_count; ++section) {
+        std::string_view key{};
+        uint64_t payload_size = 0;
+        std::string_view payload{};
+        if (!file.read_string(key) || !file.read(payload_size) || !file.read_bytes(payload_size, payload)) {
+            return;
+        }
+        if (key != query_) {
+            std::string encoded{};
+            append_string(encoded, key);
+            append(encoded, payload_size);
+            encoded += payload;
+            others.push_back(std::move(encoded));
+            continue;
+        }
+        Decoder entries{payload};
+        uint32_t entry_count = 0;
+        if (!entries.read(entry_count)) {
+            return;
+        }
+        for (uint32_t i = 0; i < entry_count; ++i) {
+            std::string_view path{};
+            Entry entry{};
+            uint8_t complete = 0;
+            uint32_t line_count = 0;
+            if (!entries.read_string(path) || !entries.read(entry.identity.size) ||
+                !entries.read(entry.identity.mtime) || !entries.read(entry.identity.inode) ||
+                !entries.read(entry.identity.device) || !entries.read(complete) || !entries.read(line_count)) {
+                return;
+            }
+            entry.result.complete = complete != 0;
+            for (uint32_t line = 0; line < line_count; ++line) {
+                uint64_t line_num = 0;
+                std::string_view text{};
+                if (!entries.read(line_num) || !entries.read_string(text)) {
+                    return;
+                }
+                entry.result.lines.emplace_back(static_cast<size_t>(line_num), text);
+            }
+            loaded.emplace(path, std::move(entry));
+        }
+    }
+    if (file.done()) {
+        loaded_ = std::move(loaded);
+        other_sections_ = std::move(others);
+    }
+}
+
+const ResultCache::Result* ResultCache::find(const std::string& path, const FileIdentity& identity,
+                                             const size_t wanted) {
+    const auto it = loaded_.find(path);
+    if (it == loaded_.end() || it->second.identity != identity) {
+        return nullptr;
+    }
+    const Result& result = it->second.result;
+    if (!result.complete && result.lines.size() < wanted) {
+        return nullptr; // Searched up to a lower maximum count than this one
+    }
+    std::lock_guard lock{mutex_};
+    found_.emplace_back(path, &it->second);
+    return &result;
+}
+
+void ResultCache::store(const std::string& path, const FileIdentity& identity, Result result) {
+    if (identity.mtime >= racy_after_) {
+        return;
+    }
+    std::lock_guard lock{mutex_};
+    stored_.emplace_back(path, Entry{identity, std::move(result)});
+}
+
+void ResultCache::save(const bool everything_seen) {
+    std::lock_guard lock{mutex_};
+    std::string payload{};
+    uint32_t entry_count = 0;
+    std::unordered_set<std::string_view> written{};
+    const auto write = [&](const std::string_view path, const Entry& entry) {
+        if (written.insert(path).second) {
+            encode_entry(payload, path, entry.identity, entry.result);
+            ++entry_count;
+        }
+    };
+    for (const auto& [path, entry] : stored_) {
+        write(path, entry);
+    }
+    for (const auto& [path, entry] : found_) {
+        write(path, *entry);
+    }
+    if (!everything_seen) {
+        for (const auto& [path, entry] : loaded_) {
+            write(path, entry);
+        }
+    }
+
+    std::string contents{kMagic, sizeof(kMagic)};
+    append(contents, kVersion);
+    const size_t sections = std::min(other_sections_.size() + 1, kMaxQueries);
+    append(contents, static_cast<uint32_t>(sections));
+    append_string(contents, query_);
+    append(contents, static_cast<uint64_t>(sizeof(entry_count) + payload.size()));
+    append(contents, entry_count);
+    contents += payload;
+    for (size_t i = 0; i + 1 < sections; ++i) {
+        contents += other_sections_[i];
+    }
+
+    fs::path temporary = cache_path_;
+    temporary += ".tmp";
+    {
+        std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        if (!out.flush()) {
+            throw std::runtime_error("cannot write cache file " + temporary.string());
+        }
+    }
+    fs::rename(temporary, cache_path_);
+}
+} // namespace mb
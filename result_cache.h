@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "file_identity.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class ResultCache
+ * @brief On-disk cache of the matching lines of files, for a query run again and again.
+ *
+ * A search with the cache looks every file up by its path and identity (size, modification
+ * time, inode and device) under the query, and replays the matching lines recorded by an
+ * earlier run instead of reading the file if it has not changed. Files that are not found
+ * are searched and their matching lines recorded for the next run.
+ *
+ * The cache is a single file holding a section per query, the most recent first; a query
+ * is everything the matcher is built from. Only the section of the current query is parsed,
+ * the others are carried over as they are, up to kMaxQueries of them. A damaged or missing
+ * file is an empty cache, as is a file of another version.
+ *
+ * Files modified less than a second before the search started are not recorded, the way git
+ * treats racily clean files: a change in the same timestamp tick would go unnoticed. The
+ * contents are not hashed, since that would read every file the cache is meant to skip.
+ */
+class ResultCache final {
+public:
+    static constexpr size_t kMaxQueries = 32; ///< Queries kept in the file, the least recent dropped
+
+    /**
+     * @brief The matching lines of a file, with their line numbers, in order.
+     */
+    using Lines = std::vector<std::pair<size_t, std::string>>;
+
+    /**
+     * @brief What a search recorded for a file.
+     */
+    struct Result {
+        Lines lines{};
+        bool complete = false; ///< The whole file was searched, not only up to a maximum count
+    };
+
+    /**
+     * @brief Loads the section of a query from the cache file.
+     *
+     * @param cache_path Path of the cache file; it does not have to exist.
+     * @param query Spells out the query, as the key of its section.
+     */
+    ResultCache(fs::path cache_path, std::string query);
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    /**
+     * @brief Looks up the result of a file, keeping it for save() if it is found.
+     *
+     * May be called from any thread.
+     *
+     * @param path The path of the file as printed.
+     * @param identity The identity of the file now.
+     * @param wanted The matching lines the search would stop after.
+     * @return The result, valid as long as the cache, or nullptr if the file changed, is not
+     *         in the cache, or was recorded with fewer lines than wanted.
+     */
+    const Result* find(const std::string& path, const FileIdentity& identity, size_t wanted);
+    /**
+     * @brief Records the result of a file searched.
+     *
+     * May be called from any thread.
+     *
+     * @param path The path of the file as printed.
+     * @param identity The identity of the file taken before it was read.
+     * @param result The matching lines.
+     */
+    void store(const std::string& path, const FileIdentity& identity, Result result);
+    /**
+     * @brief Writes the cache file, replacing it atomically.
+     *
+     * The section of the query holds the files found and stored since the cache was loaded;
+     * files not seen, like deleted ones, are dropped. If the search stopped early, the files
+     * it did not get to are kept instead.
+     *
+     * @param everything_seen Whether the search looked at every file.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void save(bool everything_seen);
+
+private:
+    struct Entry {
+        FileIdentity identity{};
+        Result result{};
+    };
+
+    fs::path cache_path_;
+    std::string query_;
+    int64_t racy_after_ = 0; ///< Files modified at or after this time are not stored
+    std::unordered_map<std::string, Entry> loaded_{}; ///< The query's section, not changed after loading
+    std::vector<std::string> other_sections_{};       ///< The other queries' sections, encoded
+
+    std::mutex mutex_;
+    std::vector<std::pair<std::string, const Entry*>> found_{}; ///< Loaded entries found again
+    std::vector<std::pair<std::string, Entry>> stored_{};
+};
+} // namespace mb
@@ -0,0 +1,39 @@
+#include "simd.h"
+
+namespace mb {
+#ifdef MB_HAVE_SSSE3
+bool cpu_has_ssse3() {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+#else
+    int info[4]{};
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#endif
+}
+#endif
+
+#ifdef MB_HAVE_AVX2
+bool cpu_has_avx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4]{};
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    constexpr int osxsave = 1 << 27;
+    constexpr int avx = 1 << 28;
+    if ((info[2] & (osxsave | avx)) != (osxsave | avx) || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
+} // namespace mb
@@ -0,0 +1,54 @@
+#pragma once
+
+/**
+ * @file simd.h
+ * @brief Instruction set detection shared by the vectorized search kernels.
+ *
+ * MB_ARCH_X86 / MB_ARCH_NEON name the target architecture. MB_HAVE_SSE2 is defined when SSE2
+ * is part of the baseline, MB_HAVE_SSSE3 and MB_HAVE_AVX2 when kernels for those extensions
+ * can be compiled; MB_TARGET_SSSE3 and MB_TARGET_AVX2 enable the extension for a single
+ * function, which must only be called after the matching cpu_has_*() check succeeded.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MB_ARCH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MB_ARCH_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(MB_ARCH_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MB_HAVE_SSE2 1
+#endif
+
+#if defined(MB_ARCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MB_HAVE_SSSE3 1
+#define MB_HAVE_AVX2 1
+#define MB_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define MB_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(MB_ARCH_X86) && defined(_MSC_VER)
+#define MB_HAVE_SSSE3 1
+#define MB_HAVE_AVX2 1
+#define MB_TARGET_SSSE3
+#define MB_TARGET_AVX2
+#endif
+
+namespace mb {
+#ifdef MB_HAVE_SSSE3
+/**
+ * @brief Checks whether the CPU the program runs on supports SSSE3.
+ */
+bool cpu_has_ssse3();
+#endif
+
+#ifdef MB_HAVE_AVX2
+/**
+ * @brief Checks whether the CPU and the operating system support AVX2.
+ */
+bool cpu_has_avx2();
+#endif
+} // namespace mb
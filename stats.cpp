@@ -0,0 +1,232 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mb {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr std::array<const char*, static_cast<size_t>(Stats::Counter::kCount)> kCounterNames{
+    "Files enumerated", "Skipped by extension", "Skipped as binary",  "Bytes read",
+    "Lines scanned",    "Matches",              "Skipped as ignored", "Replayed from cache",
+};
+constexpr std::array<const char*, static_cast<size_t>(Stats::Phase::kCount)> kPhaseNames{
+    "traversal", "io", "matching", "output",
+};
+
+/**
+ * @brief A scope or task as shown in the trace.
+ */
+struct Event {
+    const char* name;
+    Clock::time_point begin;
+    Clock::time_point end;
+};
+
+bool tracing = false;
+Clock::time_point enabled_at{};
+
+double milliseconds(const Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+double microseconds_since_enabled(const Clock::time_point time) {
+    return std::chrono::duration<double, std::micro>(time - enabled_at).count();
+}
+} // namespace
+
+/**
+ * @brief What one thread recorded; written by that thread only.
+ */
+struct Stats::Thread {
+    size_t id = 0;
+    std::array<uint64_t, static_cast<size_t>(Counter::kCount)> counters{};
+    std::array<Clock::duration, static_cast<size_t>(Phase::kCount)> phases{};
+    int phase = -1;            ///< The innermost open scope's phase, or -1
+    Clock::time_point since{}; ///< When the time of that phase was last charged
+
+    int64_t worker = -1; ///< Index in the pool, or -1 for other threads
+    Clock::time_point started{};
+    Clock::time_point finished{};
+    uint64_t tasks = 0;
+    Clock::duration busy{};
+
+    uint64_t submissions = 0;
+    uint64_t depth_sum = 0;
+    size_t depth_peak = 0;
+
+    std::vector<Event> events{};
+};
+
+/**
+ * @brief The records of every thread that recorded anything.
+ */
+struct Stats::Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Thread>> threads;
+};
+
+Stats::Registry& Stats::registry() {
+    static Registry instance{};
+    return instance;
+}
+
+Stats::Thread& Stats::thread() {
+    static thread_local Thread* current = nullptr;
+    if (current == nullptr) {
+        auto record = std::make_unique<Thread>();
+        current = record.get();
+        auto& [mutex, threads] = registry();
+        std::lock_guard lock{mutex};
+        record->id = threads.size();
+        threads.push_back(std::move(record));
+    }
+    return *current;
+}
+
+void Stats::enable(const bool trace) {
+    enabled_ = true;
+    tracing = trace;
+    enabled_at = Clock::now();
+    thread(); // The calling thread comes first in the report and the trace
+}
+
+void Stats::count(const Counter counter, const uint64_t amount) {
+    thread().counters[static_cast<size_t>(counter)] += amount;
+}
+
+void Stats::sample_depth(const size_t depth) {
+    Thread& record = thread();
+    ++record.submissions;
+    record.depth_sum += depth;
+    record.depth_peak = std::max(record.depth_peak, depth);
+}
+
+void Stats::Scope::begin(const Phase phase) {
+    Thread& record = thread();
+    start_ = Clock::now();
+    if (record.phase >= 0) {
+        record.phases[static_cast<size_t>(record.phase)] += start_ - record.since;
+    }
+    previous_ = record.phase;
+    record.phase = static_cast<int>(phase);
+    record.since = start_;
+    started_ = true;
+}
+
+void Stats::Scope::end() {
+    Thread& record = thread();
+    const auto now = Clock::now();
+    const auto phase = static_cast<size_t>(record.phase);
+    record.phases[phase] += now - record.since;
+    record.phase = previous_;
+    record.since = now;
+    if (tracing) {
+        record.events.push_back({kPhaseNames[phase], start_, now});
+    }
+}
+
+void Stats::Task::end() {
+    Thread& record = thread();
+    const auto now = Clock::now();
+    ++record.tasks;
+    record.busy += now - start_;
+    if (tracing) {
+        record.events.push_back({"task", start_, now});
+    }
+}
+
+void Stats::Worker::begin(const size_t index) {
+    Thread& record = thread();
+    record.worker = static_cast<int64_t>(index);
+    record.started = Clock::now();
+}
+
+void Stats::Worker::end() {
+    thread().finished = Clock::now();
+}
+
+void Stats::report(std::ostream& out) {
+    const auto elapsed = Clock::now() - enabled_at;
+    auto& [mutex, threads] = registry();
+    std::lock_guard lock{mutex};
+    std::array<uint64_t, static_cast<size_t>(Counter::kCount)> counters{};
+    std::array<Clock::duration, static_cast<size_t>(Phase::kCount)> phases{};
+    uint64_t submissions = 0;
+    uint64_t depth_sum = 0;
+    size_t depth_peak = 0;
+    for (const auto& record : threads) {
+        for (size_t i = 0; i < counters.size(); ++i) {
+            counters[i] += record->counters[i];
+        }
+        for (size_t i = 0; i < phases.size(); ++i) {
+            phases[i] += record->phases[i];
+        }
+        submissions += record->submissions;
+        depth_sum += record->depth_sum;
+        depth_peak = std::max(depth_peak, record->depth_peak);
+    }
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < counters.size(); ++i) {
+        out << std::left << std::setw(22) << (std::string{kCounterNames[i]} + ":") << counters[i] << '\n';
+    }
+    out << std::left << std::setw(22) << "Elapsed:" << milliseconds(elapsed) << " ms\n";
+    out << "Time summed over threads:\n";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        out << "  " << std::left << std::setw(20) << (std::string{kPhaseNames[i]} + ":") << milliseconds(phases[i])
+            << " ms\n";
+    }
+    out << std::left << std::setw(22) << "Queue depth:" << "mean "
+        << (submissions == 0 ? 0.0 : static_cast<double>(depth_sum) / static_cast<double>(submissions)) << ", peak "
+        << depth_peak << " over " << submissions << " submissions\n";
+    for (const auto& record : threads) {
+        if (record->worker < 0) {
+            continue;
+        }
+        const auto lifetime = record->finished - record->started;
+        out << "  worker " << std::left << std::setw(13) << (std::to_string(record->worker) + ":") << record->tasks
+            << " tasks, busy " << milliseconds(record->busy) << " ms, idle " << milliseconds(lifetime - record->busy)
+            << " ms\n";
+    }
+    out.flush();
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Stats::write_trace(const fs::path& path) {
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error("cannot write trace file " + path.string());
+    }
+    auto& [mutex, threads] = registry();
+    std::lock_guard lock{mutex};
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char* separator = "\n";
+    for (const auto& record : threads) {
+        const std::string name = record->worker >= 0  ? "worker " + std::to_string(record->worker)
+                                 : record->id == 0 ? std::string{"main"}
+                                                   : "thread " + std::to_string(record->id);
+        file << separator << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << record->id
+             << R"(,"args":{"name":")" << name << "\"}}";
+        separator = ",\n";
+        for (const auto& [event, begin, end] : record->events) {
+            file << separator << R"({"name":")" << event << R"(","ph":"X","pid":1,"tid":)" << record->id
+                 << ",\"ts\":" << microseconds_since_enabled(begin) << ",\"dur\":"
+                 << std::chrono::duration<double, std::micro>(end - begin).count() << '}';
+        }
+    }
+    file << "\n]}\n";
+    if (!file) {
+        throw std::runtime_error("cannot write trace file " + path.string());
+    }
+}
+} // namespace mb
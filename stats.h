@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class Stats
+ * @brief Counters and timings of a search, for --stats and --trace.
+ *
+ * Every thread collects into a record of its own, which only that thread writes, so
+ * recording takes neither a lock nor a shared atomic. The records are merged by report()
+ * and write_trace() once the threads that wrote them are gone. While collection is off,
+ * every hook is a single branch.
+ *
+ * Time is split into phases. A Scope charges the time it is open to its phase, minus the
+ * time spent in the scopes opened inside it, so the phases of a thread never overlap: a
+ * file searched by the traversal itself counts as I/O and matching, not as traversal.
+ */
+class Stats final {
+public:
+    /**
+     * @brief What is counted.
+     */
+    enum class Counter {
+        FilesEnumerated,  ///< Files found by the traversal or listed by the index, past the ignore rules
+        SkippedExtension, ///< Files skipped for not having the --ext extension
+        SkippedBinary,    ///< Files skipped as binary
+        BytesRead,        ///< Bytes read from the files
+        LinesScanned,     ///< Line breaks in the text searched
+        Matches,          ///< Matching lines
+        SkippedIgnored,   ///< Entries skipped by --glob, --type or an ignore file
+        Cached,           ///< Files whose matches were replayed from --cache instead of searching them
+        kCount,
+    };
+
+    /**
+     * @brief Where the time goes.
+     */
+    enum class Phase {
+        Traversal, ///< Listing directories
+        Io,        ///< Opening, reading and decompressing files
+        Matching,  ///< Searching the text and formatting the matches
+        Output,    ///< Handing the output over and writing it
+        kCount,
+    };
+
+    /**
+     * @brief Charges the time until its destruction to a phase.
+     */
+    class Scope final {
+    public:
+        explicit Scope(const Phase phase) {
+            if (enabled_) {
+                begin(phase);
+            }
+        }
+        ~Scope() {
+            if (started_) {
+                end();
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        void begin(Phase phase);
+        void end();
+
+        bool started_ = false;
+        int previous_ = -1; ///< The phase open around this one, or -1
+        std::chrono::steady_clock::time_point start_{};
+    };
+
+    /**
+     * @brief Marks a thread pool task, so the worker counts the time until its destruction as busy.
+     */
+    class Task final {
+    public:
+        Task() {
+            if (enabled_) {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        ~Task() {
+            if (enabled_) {
+                end();
+            }
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+    private:
+        void end();
+
+        std::chrono::steady_clock::time_point start_{};
+    };
+
+    /**
+     * @brief Marks a thread as a worker of the pool for its lifetime.
+     */
+    class Worker final {
+    public:
+        explicit Worker(size_t index) {
+            if (enabled_) {
+                begin(index);
+            }
+        }
+        ~Worker() {
+            if (enabled_) {
+                end();
+            }
+        }
+
+        Worker(const Worker&) = delete;
+        Worker& operator=(const Worker&) = delete;
+
+    private:
+        static void begin(size_t index);
+        static void end();
+    };
+
+    /**
+     * @brief Turns collection on; must be called before the threads to observe are started.
+     * @param trace Also record the scopes and tasks for write_trace().
+     */
+    static void enable(bool trace);
+    /**
+     * @brief Checks whether enable() was called.
+     */
+    static bool enabled() { return enabled_; }
+    /**
+     * @brief Adds to a counter of the calling thread.
+     */
+    static void add(const Counter counter, const uint64_t amount) {
+        if (enabled_) {
+            count(counter, amount);
+        }
+    }
+    /**
+     * @brief Records the number of pending tasks a submission to the pool has made.
+     */
+    static void queue_depth(const size_t depth) {
+        if (enabled_) {
+            sample_depth(depth);
+        }
+    }
+    /**
+     * @brief Writes the merged counters, phases and workers.
+     *
+     * Every thread that recorded anything must have finished or be idle for good.
+     */
+    static void report(std::ostream& out);
+    /**
+     * @brief Writes the scopes and tasks recorded since enable(true) as a Chrome trace.
+     *
+     * The file opens in chrome://tracing or Perfetto, one track per thread, where gaps between
+     * the tasks of a worker show it idle. Same preconditions as report().
+     *
+     * @param path The JSON file to write.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    static void write_trace(const fs::path& path);
+
+private:
+    struct Thread;
+    struct Registry;
+
+    static Registry& registry();
+    static Thread& thread();
+    static void count(Counter counter, uint64_t amount);
+    static void sample_depth(size_t depth);
+
+    static inline bool enabled_ = false; ///< Set before any thread starts, read only afterwards
+};
+} // namespace mb
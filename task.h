@@ -0,0 +1,112 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mb {
+/**
+ * @class Task
+ * @brief Move-only type-erased `void()` callable with inline storage.
+ *
+ * Unlike std::function, a Task never copies its callable and keeps callables of up to
+ * kInlineSize bytes inside the object itself, so submitting the usual small lambda to the
+ * ThreadPool costs no allocation for the callable. Larger callables, and callables that might
+ * throw while being moved, are kept on the heap.
+ */
+class Task final {
+public:
+    static constexpr size_t kInlineSize = 64;
+
+    Task() = default;
+
+    /**
+     * @brief Stores a callable; implicit so that lambdas convert as they do to std::function.
+     */
+    template <typename F>
+        requires std::invocable<std::decay_t<F>&> && (!std::same_as<std::decay_t<F>, Task>)
+    Task(F&& callable) {
+        using Callable = std::decay_t<F>;
+        if constexpr (fits_inline<Callable>()) {
+            ::new (static_cast<void*>(storage_)) Callable(std::forward<F>(callable));
+            vtable_ = &kInlineVTable<Callable>;
+        } else {
+            ::new (static_cast<void*>(storage_)) Callable*(new Callable(std::forward<F>(callable)));
+            vtable_ = &kHeapVTable<Callable>;
+        }
+    }
+
+    Task(Task&& other) noexcept { take(other); }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    /**
+     * @brief Invokes the stored callable; the Task must not be empty.
+     */
+    void operator()() { vtable_->invoke(storage_); }
+
+    /**
+     * @brief Checks whether a callable is stored.
+     */
+    explicit operator bool() const { return vtable_ != nullptr; }
+
+private:
+    struct VTable {
+        void (*invoke)(void* storage);
+        void (*move)(void* to, void* from) noexcept; ///< Move-constructs into `to` and destroys `from`
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Callable>
+    static constexpr bool fits_inline() {
+        return sizeof(Callable) <= kInlineSize && alignof(Callable) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<Callable>;
+    }
+
+    template <typename Callable>
+    static constexpr VTable kInlineVTable{
+        [](void* storage) { (*std::launder(static_cast<Callable*>(storage)))(); },
+        [](void* to, void* from) noexcept {
+            auto* callable = std::launder(static_cast<Callable*>(from));
+            ::new (to) Callable(std::move(*callable));
+            callable->~Callable();
+        },
+        [](void* storage) noexcept { std::launder(static_cast<Callable*>(storage))->~Callable(); },
+    };
+
+    template <typename Callable>
+    static constexpr VTable kHeapVTable{
+        [](void* storage) { (**std::launder(static_cast<Callable**>(storage)))(); },
+        [](void* to, void* from) noexcept { ::new (to) Callable*(*std::launder(static_cast<Callable**>(from))); },
+        [](void* storage) noexcept { delete *std::launder(static_cast<Callable**>(storage)); },
+    };
+
+    void take(Task& other) noexcept {
+        if (other.vtable_ != nullptr) {
+            other.vtable_->move(storage_, other.storage_);
+            vtable_ = std::exchange(other.vtable_, nullptr);
+        }
+    }
+
+    void reset() noexcept {
+        if (vtable_ != nullptr) {
+            std::exchange(vtable_, nullptr)->destroy(storage_);
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize]{};
+    const VTable* vtable_ = nullptr;
+};
+} // namespace mb
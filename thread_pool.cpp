@@ -1,41 +1,367 @@
 #include "thread_pool.h"
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+
 namespace mb {
-ThreadPool::ThreadPool(const size_t num_threads) {
+namespace {
+constexpr size_t kInitialDequeCapacity = 256;
+constexpr int kIdleSpins = 64; ///< Rounds an idle worker looks for work before it sleeps
+constexpr size_t kNodeBatch = 256; ///< Nodes a thread moves to or from the shared spares at once
+
+/**
+ * @class WorkDeque
+ * @brief Chase-Lev work-stealing deque of pointers.
+ *
+ * The owning thread pushes and pops at the bottom; any other thread may steal from the top.
+ * The ring buffer grows when full. Retired buffers are kept until the deque is destroyed
+ * because a thief may still be reading from one.
+ */
+template <typename T>
+class WorkDeque final {
+public:
+    WorkDeque() : ring_(new Ring(kInitialDequeCapacity)) { rings_.emplace_back(ring_.load()); }
+
+    void push(T* item) {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        Ring* ring = ring_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(ring->mask)) {
+            ring = grow(ring, top, bottom);
+        }
+        // Release on the slot as well, so thieves also see the task it points to through it.
+        ring->at(bottom).store(item, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    T* pop() {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Ring* ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = ring->at(bottom).load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // The last item; a thief may be taking it at the same time.
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    T* steal() {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        Ring* ring = ring_.load(std::memory_order_acquire);
+        T* item = ring->at(top).load(std::memory_order_acquire);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr; // Lost the race against the owner or another thief
+        }
+        return item;
+    }
+
+private:
+    struct Ring {
+        explicit Ring(const size_t capacity) : mask(capacity - 1), slots(new std::atomic<T*>[capacity]) {}
+
+        std::atomic<T*>& at(const int64_t index) { return slots[static_cast<size_t>(index) & mask]; }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+    };
+
+    Ring* grow(Ring* ring, const int64_t top, const int64_t bottom) {
+        auto* grown = new Ring((ring->mask + 1) * 2);
+        for (int64_t i = top; i < bottom; ++i) {
+            grown->at(i).store(ring->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        rings_.emplace_back(grown);
+        ring_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<Ring*> ring_;
+    std::vector<std::unique_ptr<Ring>> rings_; ///< Every buffer ever used, owned by the deque
+};
+} // namespace
+
+/**
+ * @brief A submitted task, linked into the injection list until a worker takes it.
+ */
+struct ThreadPool::Node {
+    Task task;
+    Node* next = nullptr;
+};
+
+struct ThreadPool::Worker {
+    WorkDeque<Node> deque;
+    std::thread thread;
+    const ThreadPool* pool = nullptr;
+    size_t index = 0;
+    size_t node = 0;     ///< The NUMA node of the placement the worker is pinned to
+    uint64_t random = 0; ///< xorshift state that picks the first victim to steal from
+};
+
+thread_local ThreadPool::Worker* ThreadPool::current_worker_ = nullptr;
+
+ThreadPool::ThreadPool(const size_t num_threads, std::optional<CpuTopology> placement)
+    : placement_(std::move(placement)) {
+    // Worker i takes the node of the i-th of num_threads CPUs picked evenly from all of them.
+    std::vector<size_t> cpu_nodes{};
+    if (placement_.has_value()) {
+        for (size_t node = 0; node < placement_->nodes().size(); ++node) {
+            cpu_nodes.insert(cpu_nodes.end(), placement_->nodes()[node].size(), node);
+        }
+    }
     workers_.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        workers_.emplace_back([this] {
-            while (true) {
-                Task task{};
-                {
-                    std::unique_lock lock{queue_mutex_};
-                    condition_.wait(lock, [this] { return stop_flag_ || !tasks_.empty(); });
-                    if (stop_flag_ && tasks_.empty())
-                        return;
-                    task = std::move(tasks_.front());
-                    tasks_.pop();
-                }
-                task();
+        auto worker = std::make_unique<Worker>();
+        worker->pool = this;
+        worker->index = i;
+        worker->node = cpu_nodes.empty() ? 0 : cpu_nodes[i * cpu_nodes.size() / num_threads];
+        worker->random = 0x9E3779B97F4A7C15ULL * (i + 1);
+        workers_.push_back(std::move(worker));
+    }
+    // Started only once every deque exists, since a worker may steal from any of them.
+    for (auto& worker : workers_) {
+        worker->thread = std::thread([this, &worker = *worker] {
+            if (placement_.has_value()) {
+                placement_->pin_to_node(worker.node);
             }
+            run(worker);
         });
     }
 }
 
 ThreadPool::~ThreadPool() {
+    wait();
     stop_flag_ = true;
-    condition_.notify_all();
+    epoch_.fetch_add(1);
+    epoch_.notify_all();
     for (auto& worker : workers_) {
-        if (worker.joinable()) {
-            worker.join();
+        if (worker->thread.joinable()) {
+            worker->thread.join();
         }
     }
 }
 
 void ThreadPool::submit(Task task) {
+    Node* node = make_node(std::move(task));
+    Stats::queue_depth(outstanding_.fetch_add(1) + 1);
+    if (Worker* worker = current_worker_; worker != nullptr && worker->pool == this) {
+        worker->deque.push(node);
+    } else {
+        node->next = injected_.load(std::memory_order_relaxed);
+        while (!injected_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+        }
+    }
+    // A worker reads the epoch before its last look for work, so it either finds this task or
+    // sees the new epoch and does not go to sleep.
+    epoch_.fetch_add(1);
+    if (sleepers_.load() != 0) {
+        epoch_.notify_one();
+    }
+}
+
+void ThreadPool::wait() {
+    for (size_t outstanding = outstanding_.load(); outstanding != 0; outstanding = outstanding_.load()) {
+        outstanding_.wait(outstanding);
+    }
+}
+
+void ThreadPool::run(Worker& worker) {
+    current_worker_ = &worker;
+    const Stats::Worker stats{worker.index};
+    while (true) {
+        Node* node = nullptr;
+        for (int spin = 0; spin < kIdleSpins && node == nullptr; ++spin) {
+            node = find_task(worker);
+            if (node == nullptr) {
+                std::this_thread::yield();
+            }
+        }
+        if (node == nullptr) {
+            const uint32_t epoch = epoch_.load();
+            node = find_task(worker);
+            if (node == nullptr) {
+                if (stop_flag_) {
+                    return;
+                }
+                sleepers_.fetch_add(1);
+                epoch_.wait(epoch);
+                sleepers_.fetch_sub(1);
+                continue;
+            }
+        }
+        execute(node);
+    }
+}
+
+ThreadPool::Node* ThreadPool::find_task(Worker& worker) {
+    if (Node* node = worker.deque.pop(); node != nullptr) {
+        return node;
+    }
+    if (Node* node = take_injected(worker); node != nullptr) {
+        return node;
+    }
+    return steal(worker);
+}
+
+ThreadPool::Node* ThreadPool::take_injected(Worker& worker) {
+    if (injected_.load(std::memory_order_relaxed) == nullptr) {
+        return nullptr;
+    }
+    // Taking the whole list at once sidesteps the ABA problem of popping single nodes.
+    Node* list = injected_.exchange(nullptr, std::memory_order_acquire);
+    if (list == nullptr) {
+        return nullptr;
+    }
+    // The list is newest first. Reversed, the oldest task runs now and the next oldest ones end
+    // up at the top of the deque where thieves take them.
+    Node* oldest = nullptr;
+    while (list != nullptr) {
+        Node* next = list->next;
+        list->next = oldest;
+        oldest = list;
+        list = next;
+    }
+    for (Node* node = oldest->next; node != nullptr;) {
+        Node* next = std::exchange(node->next, nullptr);
+        worker.deque.push(node);
+        node = next;
+    }
+    oldest->next = nullptr;
+    return oldest;
+}
+
+ThreadPool::Node* ThreadPool::steal(Worker& thief) {
+    const size_t count = workers_.size();
+    if (count < 2) {
+        return nullptr;
+    }
+    uint64_t& random = thief.random;
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    const size_t first = static_cast<size_t>(random % count);
+    // The workers of the thief's own node first; without a placement they are all of them.
+    for (const bool same_node : {true, false}) {
+        for (size_t i = 0; i < count; ++i) {
+            Worker& victim = *workers_[(first + i) % count];
+            if (victim.index == thief.index || (victim.node == thief.node) != same_node) {
+                continue;
+            }
+            if (Node* node = victim.deque.steal(); node != nullptr) {
+                return node;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::execute(Node* node) {
     {
-        std::lock_guard lock{queue_mutex_};
-        tasks_.push(std::move(task));
+        const Stats::Task task{};
+        node->task();
+    }
+    recycle(node);
+    if (outstanding_.fetch_sub(1) == 1) {
+        outstanding_.notify_all();
+    }
+}
+
+namespace {
+/**
+ * @brief The nodes of finished tasks, kept for the next submissions.
+ *
+ * Every thread keeps spares of its own, so a node is normally reused by the thread that ran
+ * its task without any synchronisation. Threads that only submit, like the one listing the
+ * tree in path order, and threads that only run tasks exchange batches of kNodeBatch nodes
+ * through a list shared by all pools, which costs a lock per batch instead of an allocation
+ * per task.
+ */
+template <typename Node>
+struct NodeSpares {
+    ~NodeSpares() {
+        for (Node* node : nodes) {
+            delete node;
+        }
+    }
+
+    std::vector<Node*> nodes;
+};
+
+template <typename Node>
+struct SharedNodeSpares : NodeSpares<Node> {
+    std::mutex mutex;
+};
+
+template <typename Node>
+SharedNodeSpares<Node>& shared_spares() {
+    static SharedNodeSpares<Node> spares{};
+    return spares;
+}
+
+template <typename Node>
+NodeSpares<Node>& local_spares() {
+    static thread_local NodeSpares<Node> spares{};
+    return spares;
+}
+
+/**
+ * @brief Moves the last nodes of one list to the end of another.
+ */
+template <typename Node>
+void move_nodes(std::vector<Node*>& from, std::vector<Node*>& to, const size_t count) {
+    to.insert(to.end(), from.end() - static_cast<ptrdiff_t>(count), from.end());
+    from.resize(from.size() - count);
+}
+} // namespace
+
+ThreadPool::Node* ThreadPool::make_node(Task task) {
+    auto& local = local_spares<Node>().nodes;
+    if (local.empty()) {
+        auto& shared = shared_spares<Node>();
+        std::lock_guard lock{shared.mutex};
+        move_nodes(shared.nodes, local, std::min(shared.nodes.size(), kNodeBatch));
+    }
+    if (local.empty()) {
+        return new Node{std::move(task)};
+    }
+    Node* node = local.back();
+    local.pop_back();
+    node->task = std::move(task);
+    return node;
+}
+
+void ThreadPool::recycle(Node* node) {
+    node->task = Task{}; // Whatever the callable holds is released now, not on reuse
+    node->next = nullptr;
+    auto& local = local_spares<Node>().nodes;
+    local.push_back(node);
+    if (local.size() >= 2 * kNodeBatch) {
+        auto& shared = shared_spares<Node>();
+        std::lock_guard lock{shared.mutex};
+        move_nodes(local, shared.nodes, kNodeBatch);
     }
-    condition_.notify_one();
 }
-} // namespace mb
\ No newline at end of file
+} // namespace mb
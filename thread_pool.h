@@ -1,48 +1,128 @@
 #pragma once
-#include <condition_variable>
-#include <functional>
-#include <mutex>
-#include <queue>
-#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <vector>
 
+#include "task.h"
+#include "topology.h"
+
 namespace mb {
 /**
  * @class ThreadPool
- * @brief A simple thread pool for executing tasks concurrently.
+ * @brief A work-stealing thread pool for executing tasks concurrently.
  *
  * Manages a fixed number of worker threads that execute submitted tasks.
  *
- * This implementation is inspired by concepts presented in Anthony Williams'
- * book *"C++ Concurrency in Action"*, particularly the producer-consumer model
- * using condition variables and task queues.
+ * Every worker owns a lock-free deque. Tasks submitted by a running task go to the bottom of
+ * its worker's deque, where the worker takes them back in LIFO order while idle workers
+ * steal from the top. Tasks submitted from other threads are pushed onto a lock-free
+ * injection list that workers empty into their own deques. Submitting and running tasks
+ * therefore never takes a lock shared by all the workers; idle workers sleep on an atomic
+ * counter that submit() bumps.
+ *
+ * Producers that submit work in bulk, like the directory traversal, check saturated() and run
+ * the work themselves once enough tasks are pending. This backpressure keeps the number of
+ * queued tasks, and the memory they hold on to, bounded however much work there is.
+ *
+ * With a CpuTopology the workers are spread over its NUMA nodes in proportion to their CPUs
+ * and each is pinned to the CPUs of its node. A worker then steals from the workers of its own
+ * node before it looks at the others, so the helpers a task submits, like the ones searching
+ * the pieces of a large file, run next to the buffers it read, and the read buffers every
+ * worker keeps for itself are allocated on its node.
+ *
+ * Cancellation is cooperative: cancel() only raises a flag, and tasks and producers that see
+ * it through cancelled() skip their remaining work. Every submitted task still runs, so tasks
+ * that release resources or complete a protocol need no special handling, and wait() returns
+ * as soon as the pending tasks have returned early.
+ *
+ * The original single-queue design was inspired by concepts presented in Anthony Williams'
+ * book *"C++ Concurrency in Action"*; the deque follows Chase and Lev, "Dynamic Circular
+ * Work-Stealing Deque", and its C11 formulation by Lê et al.
  */
 class ThreadPool final {
-    using Task = std::function<void()>;
-
 public:
+    /**
+     * @brief Pending tasks beyond which saturated() asks producers to hold back.
+     */
+    static constexpr size_t kMaxPending = 4096;
+
     /**
      * @brief Constructs a ThreadPool with the specified number of threads.
      * @param num_threads The number of worker threads to create.
+     * @param placement The NUMA nodes to pin the workers to, if any.
      */
-    explicit ThreadPool(size_t num_threads);
+    explicit ThreadPool(size_t num_threads, std::optional<CpuTopology> placement = std::nullopt);
     /**
      * @brief Destroys the thread pool and joins all threads.
      *
-     * Waits for all active tasks to complete and stops all threads.
+     * Waits for all submitted tasks, including the ones they submit in turn, to complete and
+     * stops all threads.
      */
     ~ThreadPool();
     /**
     * @brief Submits a task to be executed by the thread pool.
+    *
+    * May be called from any thread, including from tasks running on the pool.
+    *
     * @param task The task to be executed.
     */
     void submit(Task task);
+    /**
+     * @brief Blocks until every submitted task has finished.
+     *
+     * Tasks submitted by running tasks are waited for as well. Must not be called from a task.
+     */
+    void wait();
+    /**
+     * @brief Checks whether so many tasks are pending that new work should rather be run by
+     *        the producer itself than submitted.
+     */
+    bool saturated() const { return outstanding_.load(std::memory_order_relaxed) >= kMaxPending; }
+    /**
+     * @brief Returns the number of worker threads.
+     */
+    size_t size() const { return workers_.size(); }
+    /**
+     * @brief Asks the tasks and producers to skip their remaining work, until resume().
+     *
+     * May be called from any thread, including from tasks running on the pool.
+     */
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    /**
+     * @brief Undoes cancel(), so a pool that outlives one search can run the next.
+     *
+     * Only call it once wait() returned, so no task still sees the old flag.
+     */
+    void resume() { cancelled_.store(false, std::memory_order_relaxed); }
+    /**
+     * @brief Checks whether cancel() has been called.
+     */
+    bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
 
 private:
-    std::vector<std::thread> workers_;
-    std::queue<Task> tasks_;
-    std::mutex queue_mutex_;
-    std::condition_variable condition_;
+    struct Node;
+    struct Worker;
+
+    void run(Worker& worker);
+    Node* find_task(Worker& worker);
+    Node* take_injected(Worker& worker);
+    Node* steal(Worker& thief);
+    void execute(Node* node);
+    static Node* make_node(Task task);
+    static void recycle(Node* node);
+
+    static thread_local Worker* current_worker_; ///< The worker running on this thread, if any
+
+    const std::optional<CpuTopology> placement_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<Node*> injected_{nullptr}; ///< Tasks submitted from outside the pool, newest first
+    std::atomic<size_t> outstanding_{0};   ///< Submitted tasks that have not finished yet
+    std::atomic<uint32_t> epoch_{0};       ///< Bumped by every submit(), idle workers wait on it
+    std::atomic<uint32_t> sleepers_{0};    ///< Workers waiting on epoch_
     std::atomic_bool stop_flag_{false};
+    std::atomic_bool cancelled_{false};
 };
-} // namespace mb
\ No newline at end of file
+} // namespace mb
@@ -0,0 +1,141 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#if defined(__linux__)
+#define MB_HAVE_AFFINITY 1
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace mb {
+namespace {
+#ifdef MB_HAVE_AFFINITY
+/**
+ * @brief Parses a kernel CPU list like "0-3,8-11".
+ */
+std::vector<unsigned> parse_cpu_list(const std::string_view list) {
+    std::vector<unsigned> cpus{};
+    const char* it = list.data();
+    const char* const end = list.data() + list.size();
+    while (it != end) {
+        unsigned first = 0;
+        auto result = std::from_chars(it, end, first);
+        if (result.ec != std::errc{}) {
+            break;
+        }
+        unsigned last = first;
+        if (result.ptr != end && *result.ptr == '-') {
+            result = std::from_chars(result.ptr + 1, end, last);
+            if (result.ec != std::errc{}) {
+                break;
+            }
+        }
+        for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        it = result.ptr;
+        while (it != end && (*it == ',' || *it == '\n')) {
+            ++it;
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Returns the node numbers under /sys/devices/system/node, in increasing order.
+ */
+std::vector<unsigned> node_numbers() {
+    std::vector<unsigned> numbers{};
+    std::error_code error{};
+    for (fs::directory_iterator it{"/sys/devices/system/node", error}, end{}; !error && it != end;
+         it.increment(error)) {
+        const std::string name = it->path().filename().string();
+        unsigned number = 0;
+        if (name.starts_with("node") &&
+            std::from_chars(name.data() + 4, name.data() + name.size(), number).ptr == name.data() + name.size()) {
+            numbers.push_back(number);
+        }
+    }
+    std::ranges::sort(numbers);
+    return numbers;
+}
+#endif
+} // namespace
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topology{};
+#ifdef MB_HAVE_AFFINITY
+    cpu_set_t allowed{};
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency() && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+    std::vector<char> seen(CPU_SETSIZE);
+    for (const unsigned number : node_numbers()) {
+        std::ifstream file{"/sys/devices/system/node/node" + std::to_string(number) + "/cpulist"};
+        std::string list{};
+        std::getline(file, list);
+        std::vector<unsigned> cpus{};
+        for (const unsigned cpu : parse_cpu_list(list)) {
+            if (CPU_ISSET(cpu, &allowed) && !seen[cpu]) {
+                seen[cpu] = 1;
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            topology.nodes_.push_back(std::move(cpus));
+        }
+    }
+    // CPUs of no node, as when /sys is not mounted, form a node of their own.
+    std::vector<unsigned> rest{};
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && !seen[cpu]) {
+            rest.push_back(cpu);
+        }
+    }
+    if (!rest.empty()) {
+        topology.nodes_.push_back(std::move(rest));
+    }
+#else
+    std::vector<unsigned> cpus(std::max(1U, std::thread::hardware_concurrency()));
+    for (unsigned cpu = 0; cpu < cpus.size(); ++cpu) {
+        cpus[cpu] = cpu;
+    }
+    topology.nodes_.push_back(std::move(cpus));
+#endif
+    return topology;
+}
+
+size_t CpuTopology::cpu_count() const {
+    size_t count = 0;
+    for (const auto& cpus : nodes_) {
+        count += cpus.size();
+    }
+    return std::max<size_t>(1, count);
+}
+
+#ifdef MB_HAVE_AFFINITY
+void CpuTopology::pin_to_node(const size_t node) const {
+    cpu_set_t set{};
+    CPU_ZERO(&set);
+    for (const unsigned cpu : nodes_[node]) {
+        CPU_SET(cpu, &set);
+    }
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+}
+#else
+void CpuTopology::pin_to_node(size_t) const {}
+#endif
+} // namespace mb
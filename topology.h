@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace mb {
+/**
+ * @class CpuTopology
+ * @brief The CPUs this process may run on, grouped by the NUMA node they belong to.
+ *
+ * On Linux the nodes are read from /sys/devices/system/node and only the CPUs of the
+ * process's affinity mask are kept, so a search started under taskset or in a cgroup-limited
+ * container sees the CPUs it actually has. Elsewhere, or without NUMA information, all CPUs
+ * form a single node.
+ */
+class CpuTopology final {
+public:
+    /**
+     * @brief Reads the topology of the machine.
+     */
+    static CpuTopology detect();
+
+    /**
+     * @brief Returns the CPUs of every node that has any, ordered by node.
+     */
+    const std::vector<std::vector<unsigned>>& nodes() const { return nodes_; }
+    /**
+     * @brief Returns the number of CPUs over all nodes, at least one.
+     */
+    size_t cpu_count() const;
+    /**
+     * @brief Restricts the calling thread to the CPUs of a node.
+     *
+     * Memory a pinned thread touches first is allocated on its node by the kernel's default
+     * policy, so the thread-local buffers of a worker stay local to it. Does nothing where
+     * affinity cannot be set.
+     *
+     * @param node Index into nodes().
+     */
+    void pin_to_node(size_t node) const;
+
+private:
+    std::vector<std::vector<unsigned>> nodes_{};
+};
+} // namespace mb
@@ -0,0 +1,187 @@
+#include "tree_watcher.h"
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include "trigram_index.h"
+
+#if defined(__linux__)
+#define MB_HAVE_INOTIFY 1
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+#ifdef MB_HAVE_INOTIFY
+namespace {
+constexpr uint32_t kEvents =
+    IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF;
+} // namespace
+
+TreeWatcher::TreeWatcher(const std::chrono::milliseconds quiet_period)
+    : quiet_period_(quiet_period), fd_(::inotify_init1(IN_CLOEXEC)) {}
+
+TreeWatcher::~TreeWatcher() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void TreeWatcher::watch(const fs::path& root) {
+    root_ = root;
+    if (fd_ >= 0 && (!add_watches(root_, {}, nullptr) || watched_.empty())) {
+        stop_watching();
+    }
+}
+
+void TreeWatcher::wait() {
+    if (fd_ < 0) {
+        std::this_thread::sleep_for(kPollInterval);
+        return;
+    }
+    // Block until the first change, then until a quiet period passes, but at most until
+    // kPollInterval after the first change so a file written without pause is picked up.
+    std::optional<std::chrono::steady_clock::time_point> deadline{};
+    while (true) {
+        int timeout = -1;
+        if (deadline.has_value()) {
+            const auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::clamp(left, std::chrono::milliseconds{0}, quiet_period_).count());
+        }
+        pollfd poll_fd{fd_, POLLIN, 0};
+        const int ready = ::poll(&poll_fd, 1, timeout);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0) {
+            std::this_thread::sleep_for(kPollInterval);
+            return;
+        }
+        if (ready == 0) {
+            return;
+        }
+        if (drain() && !deadline.has_value()) {
+            deadline = std::chrono::steady_clock::now() + kPollInterval;
+        }
+        if (fd_ < 0) {
+            return; // The watch limit was hit, so the next wait() polls
+        }
+    }
+}
+
+/**
+ * @brief Watches a directory and the subdirectories the filter accepts.
+ *
+ * The directory is watched before it is listed, so a subdirectory created meanwhile is
+ * either listed or reported. Watching a directory again just updates its entry.
+ *
+ * @return false if the watch limit was hit.
+ */
+bool TreeWatcher::add_watches(const fs::path& path, const std::string& relative,
+                              const std::shared_ptr<const PathFilter::Directory>& parent_rules) {
+    const int wd = ::inotify_add_watch(fd_, path.c_str(), kEvents | IN_ONLYDIR);
+    if (wd < 0) {
+        return errno != ENOSPC; // A directory gone already is not watched
+    }
+    auto rules = filter_.enter(parent_rules, path, relative);
+    watched_[wd] = {path, relative, parent_rules, rules};
+    std::string child = relative.empty() ? std::string{} : relative + '/';
+    const size_t base = child.size();
+    std::error_code error{};
+    for (fs::directory_iterator it{path, fs::directory_options::skip_permission_denied, error}, end{};
+         !error && it != end; it.increment(error)) {
+        std::error_code status_error{};
+        if (!it->is_directory(status_error) || it->is_symlink(status_error)) {
+            continue;
+        }
+        const std::string name = it->path().filename().string();
+        child.resize(base);
+        child += name;
+        if (filter_.accepts(rules.get(), child, name, true) && !add_watches(it->path(), child, rules)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the pending events, watching the directories they bring into the tree.
+ * @return true if one of them is about something else than the index file itself.
+ */
+bool TreeWatcher::drain() {
+    alignas(inotify_event) char buffer[16 << 10];
+    const ssize_t size = ::read(fd_, buffer, sizeof(buffer));
+    bool changed = false;
+    bool watching = true;
+    for (ssize_t offset = 0; offset < size && watching;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        const std::string_view name = event->len == 0 ? std::string_view{} : std::string_view{event->name};
+        changed |= event->len == 0 || !name.starts_with(TrigramIndex::kFileName);
+        if ((event->mask & IN_Q_OVERFLOW) != 0) {
+            watching = add_watches(root_, {}, nullptr); // Events were lost, new directories among them
+            continue;
+        }
+        if ((event->mask & IN_IGNORED) != 0) {
+            watched_.erase(event->wd);
+            continue;
+        }
+        const auto it = watched_.find(event->wd);
+        if (it == watched_.end() || name.empty()) {
+            continue;
+        }
+        // add_watches() may overwrite the entry, so what it is passed is copied first.
+        const Watched& directory = it->second;
+        if ((event->mask & IN_ISDIR) != 0 && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+            const std::string relative =
+                directory.relative.empty() ? std::string{name} : directory.relative + '/' + std::string{name};
+            if (filter_.accepts(directory.rules.get(), relative, name, true)) {
+                const auto rules = directory.rules;
+                watching = add_watches(directory.path / name, relative, rules);
+            }
+        } else if (name == ".gitignore" || name == ".ignore") {
+            // The rules changed, so a directory they excluded may have to be watched now.
+            const Watched again = directory;
+            watching = add_watches(again.path, again.relative, again.parent_rules);
+        }
+    }
+    if (!watching) {
+        stop_watching();
+    }
+    return changed;
+}
+
+/**
+ * @brief Gives up on inotify, leaving wait() to poll.
+ */
+void TreeWatcher::stop_watching() {
+    ::close(fd_);
+    fd_ = -1;
+    watched_.clear();
+}
+#else
+TreeWatcher::TreeWatcher(const std::chrono::milliseconds quiet_period) : quiet_period_(quiet_period) {}
+
+TreeWatcher::~TreeWatcher() = default;
+
+void TreeWatcher::watch(const fs::path& root) { root_ = root; }
+
+void TreeWatcher::wait() { std::this_thread::sleep_for(kPollInterval); }
+
+bool TreeWatcher::add_watches(const fs::path&, const std::string&,
+                              const std::shared_ptr<const PathFilter::Directory>&) {
+    return false;
+}
+
+bool TreeWatcher::drain() { return false; }
+
+void TreeWatcher::stop_watching() {}
+#endif
+} // namespace mb
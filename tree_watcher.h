@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "path_filter.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class TreeWatcher
+ * @brief Waits for changes anywhere in a directory tree.
+ *
+ * On Linux the directories of the tree are watched with inotify; elsewhere, or once the
+ * watch limit is hit, wait() just sleeps for kPollInterval and the caller checks the tree
+ * itself. Changes to the trigram index file are not reported.
+ *
+ * Only the directories a search walks by default are watched, those the trigram index and a
+ * server's snapshot hold the files of: `.git` and whatever the ignore files exclude is left
+ * out. The tree is walked once by watch(); after that, directories created in it or moved
+ * into it are watched as their events arrive, and a changed ignore file has its directory
+ * walked again.
+ */
+class TreeWatcher final {
+public:
+    static constexpr auto kPollInterval = std::chrono::seconds{5}; ///< How often the tree is checked without inotify
+
+    /**
+     * @param quiet_period How long a burst of changes has to pause before wait() returns; with
+     *                     zero it returns right at the first change.
+     */
+    explicit TreeWatcher(std::chrono::milliseconds quiet_period);
+    ~TreeWatcher();
+
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    /**
+     * @brief Starts watching the directories of the tree.
+     *
+     * Changes from then on are reported by the next wait(), so a caller that reads the tree
+     * after watch() misses none that happen while it reads.
+     */
+    void watch(const fs::path& root);
+    /**
+     * @brief Blocks until something in the tree changed and no further change followed for
+     *        the quiet period.
+     *
+     * New directories are watched while the events are read; the watches of removed
+     * directories go away by themselves.
+     */
+    void wait();
+
+private:
+    /**
+     * @brief A watched directory.
+     */
+    struct Watched {
+        fs::path path;
+        std::string relative{};                                      ///< Path relative to the root; empty for it
+        std::shared_ptr<const PathFilter::Directory> parent_rules{}; ///< The ignore rules in effect in its parent
+        std::shared_ptr<const PathFilter::Directory> rules{};        ///< The ignore rules in effect in it
+    };
+
+    bool add_watches(const fs::path& path, const std::string& relative,
+                     const std::shared_ptr<const PathFilter::Directory>& parent_rules);
+    bool drain();
+    void stop_watching();
+
+    std::chrono::milliseconds quiet_period_;
+    const PathFilter filter_{PathFilter::Options{}};
+    fs::path root_{};
+    int fd_ = -1;                                 ///< The inotify instance, if any
+    std::unordered_map<int, Watched> watched_{}; ///< By watch descriptor
+};
+} // namespace mb
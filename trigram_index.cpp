@@ -0,0 +1,565 @@
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "decompressor.h"
+#include "file_identity.h"
+#include "file_reader.h"
+#include "literal_search.h"
+#include "path_filter.h"
+#include "tree_watcher.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mb {
+namespace {
+constexpr char kMagic[8] = {'M', 'B', 'G', 'R', 'I', 'D', 'X', '\0'};
+constexpr uint32_t kVersion = 3; ///< Also tells apart an index written with the other byte order
+constexpr size_t kTrigramSpace = size_t{1} << 24;
+constexpr size_t kMinLiteralSize = 3; ///< Shorter literals contain no trigram and rule nothing out
+constexpr auto kQuietPeriod = std::chrono::milliseconds{500}; ///< A burst of changes ends after this long
+
+/**
+ * @brief Flags of an indexed file.
+ */
+enum FileFlags : uint32_t {
+    kBinaryFile = 1,   ///< Skipped by the search, so no trigrams are recorded
+    kUnindexedFile = 2 ///< Converted before it is searched, so it is always a candidate
+};
+
+void append_varint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * @brief Decodes the varint at `pos`, or returns false if it runs past the end.
+ */
+bool read_varint(const std::string_view bytes, size_t& pos, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; pos < bytes.size() && shift < 35; shift += 7) {
+        const auto byte = static_cast<unsigned char>(bytes[pos++]);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Calls on_value for every value of a delta-encoded increasing sequence.
+ */
+template <typename F>
+void for_each_delta(const std::string_view bytes, F&& on_value) {
+    uint32_t value = 0;
+    for (size_t pos = 0; pos < bytes.size();) {
+        uint32_t delta = 0;
+        if (!read_varint(bytes, pos, delta)) {
+            return;
+        }
+        value += delta;
+        on_value(value);
+    }
+}
+
+/**
+ * @class TrigramSet
+ * @brief Collects the distinct trigrams of one file.
+ *
+ * A bitmap over all 2^24 trigrams deduplicates them; only the bits that were set are cleared
+ * again, so the bitmap is allocated once per thread and reused for every file.
+ */
+class TrigramSet final {
+public:
+    TrigramSet() : bits_(kTrigramSpace / 64) {}
+
+    void add(const std::string_view bytes) {
+        for (const char c : bytes) {
+            window_ = (window_ << 8 | static_cast<unsigned char>(to_lower_ascii(c))) & (kTrigramSpace - 1);
+            if (filled_ < 3 && ++filled_ < 3) {
+                continue;
+            }
+            uint64_t& word = bits_[window_ / 64];
+            const uint64_t bit = uint64_t{1} << (window_ % 64);
+            if ((word & bit) == 0) {
+                word |= bit;
+                seen_.push_back(window_);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the trigrams added since the last call, delta-encoded, and starts over.
+     */
+    std::string take() {
+        std::sort(seen_.begin(), seen_.end());
+        std::string encoded{};
+        uint32_t previous = 0;
+        for (const uint32_t trigram : seen_) {
+            append_varint(encoded, trigram - previous);
+            previous = trigram;
+            bits_[trigram / 64] = 0;
+        }
+        seen_.clear();
+        window_ = 0;
+        filled_ = 0;
+        return encoded;
+    }
+
+private:
+    std::vector<uint64_t> bits_;
+    std::vector<uint32_t> seen_{};
+    uint32_t window_ = 0;
+    int filled_ = 0; ///< Bytes in the window, up to 3
+};
+
+/**
+ * @brief A file as seen while building the index.
+ */
+struct IndexedFile {
+    fs::path relative;
+    FileIdentity identity{};
+    uint32_t flags = 0;
+    std::string trigrams{};              ///< Delta-encoded sorted trigrams
+    uint32_t previous_id = UINT32_MAX;   ///< Unchanged file of the previous index whose trigrams are taken over
+};
+
+bool is_index_file(const fs::path& path) {
+    return path.filename().string().starts_with(TrigramIndex::kFileName);
+}
+
+/**
+ * @brief Reads a file and collects its trigrams.
+ *
+ * @param path Path of the file.
+ * @param file Receives the flags and trigrams; its identity must have been taken before
+ *             reading, so a file changing meanwhile is seen as changed later on.
+ */
+void index_file(const fs::path& path, IndexedFile& file) {
+    FileReader reader{path};
+    std::string_view chunk{};
+    if (!reader.is_open() || !reader.next(chunk)) {
+        file.flags = reader.is_open() ? 0 : uint32_t{kUnindexedFile};
+        return;
+    }
+    // Compressed files are decompressed when searched with --search-zip, so they may match anything.
+    if (detect_compression(reader.head()) != Compression::None) {
+        file.flags = kUnindexedFile;
+        return;
+    }
+    switch (detect_encoding(reader.head())) {
+    case Encoding::Binary:
+        file.flags = kBinaryFile;
+        return;
+    case Encoding::Utf16LE:
+    case Encoding::Utf16BE:
+        file.flags = kUnindexedFile;
+        return;
+    case Encoding::Text:
+        break;
+    }
+    static thread_local TrigramSet trigrams{};
+    do {
+        trigrams.add(chunk);
+    } while (reader.next(chunk));
+    file.trigrams = trigrams.take();
+}
+
+/**
+ * @brief Start of the index file; the offsets count from the start of the file.
+ */
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t trigram_count;
+    uint32_t reserved;
+    uint64_t files_offset;
+    uint64_t trigrams_offset;
+    uint64_t postings_offset;
+    uint64_t paths_offset;
+    uint64_t total_size;
+};
+
+struct FileEntry {
+    uint64_t path_offset; ///< Relative to the start of the paths
+    uint32_t path_size;
+    uint32_t flags;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t inode;
+};
+
+struct TrigramEntry {
+    uint32_t trigram;
+    uint32_t count;  ///< Files containing the trigram
+    uint64_t offset; ///< Relative to the start of the postings; they end where the next ones begin
+};
+
+const Header& header_of(const char* data) { return *reinterpret_cast<const Header*>(data); }
+
+const FileEntry& file_entry(const char* data, const uint32_t id) {
+    return reinterpret_cast<const FileEntry*>(data + header_of(data).files_offset)[id];
+}
+
+/**
+ * @brief Returns the path of an indexed file relative to the root, empty if it is damaged.
+ */
+std::string_view file_path(const char* data, const uint32_t id) {
+    const Header& header = header_of(data);
+    const FileEntry& file = file_entry(data, id);
+    const uint64_t paths_size = header.total_size - header.paths_offset;
+    if (file.path_offset > paths_size || file.path_size > paths_size - file.path_offset) {
+        return {};
+    }
+    return {data + header.paths_offset + file.path_offset, file.path_size};
+}
+
+const TrigramEntry* trigram_table(const char* data) {
+    return reinterpret_cast<const TrigramEntry*>(data + header_of(data).trigrams_offset);
+}
+
+/**
+ * @brief Returns the encoded posting list of the trigram at an index of the table.
+ */
+std::string_view posting_bytes(const char* data, const uint32_t index) {
+    const Header& header = header_of(data);
+    const auto* table = trigram_table(data);
+    const uint64_t postings_size = header.paths_offset - header.postings_offset;
+    const uint64_t begin = table[index].offset;
+    const uint64_t end = index + 1 == header.trigram_count ? postings_size : table[index + 1].offset;
+    if (begin > end || end > postings_size) {
+        return {};
+    }
+    return {data + header.postings_offset + begin, end - begin};
+}
+
+/**
+ * @brief Checks whether a file is still the one that was indexed.
+ */
+bool unchanged(const FileEntry& file, const FileIdentity& identity) {
+    return (file.flags & kUnindexedFile) == 0 && identity.size == file.size && identity.mtime == file.mtime &&
+           identity.inode == file.inode;
+}
+
+/**
+ * @brief Posting list of one trigram while the index is built.
+ */
+struct Posting {
+    std::string ids{}; ///< Delta-encoded file ids
+    uint32_t last = 0;
+    uint32_t count = 0;
+};
+/**
+ * @brief Writes the index of the files, sorted by path, and replaces the previous one.
+ */
+void write_index(const fs::path& root, std::vector<IndexedFile>& files) {
+    if (files.size() > UINT32_MAX) {
+        throw std::runtime_error("too many files to index");
+    }
+    // File ids are handed out in path order, so every posting list is increasing.
+    std::unordered_map<uint32_t, Posting> postings{};
+    std::string paths{};
+    std::vector<FileEntry> entries{};
+    entries.reserve(files.size());
+    for (uint32_t id = 0; id < files.size(); ++id) {
+        auto& file = files[id];
+        const std::string path = file.relative.string();
+        entries.push_back({paths.size(), static_cast<uint32_t>(path.size()), file.flags, file.identity.size,
+                           file.identity.mtime, file.identity.inode});
+        paths += path;
+        for_each_delta(file.trigrams, [&postings, id](const uint32_t trigram) {
+            auto& posting = postings[trigram];
+            append_varint(posting.ids, id - posting.last);
+            posting.last = id;
+            ++posting.count;
+        });
+        std::string{}.swap(file.trigrams);
+    }
+    std::vector<uint32_t> trigrams{};
+    trigrams.reserve(postings.size());
+    for (const auto& [trigram, posting] : postings) {
+        trigrams.push_back(trigram);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    std::vector<TrigramEntry> table{};
+    table.reserve(trigrams.size());
+    uint64_t postings_size = 0;
+    for (const uint32_t trigram : trigrams) {
+        const auto& posting = postings[trigram];
+        table.push_back({trigram, posting.count, postings_size});
+        postings_size += posting.ids.size();
+    }
+
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.file_count = static_cast<uint32_t>(entries.size());
+    header.trigram_count = static_cast<uint32_t>(table.size());
+    header.files_offset = sizeof(Header);
+    header.trigrams_offset = header.files_offset + entries.size() * sizeof(FileEntry);
+    header.postings_offset = header.trigrams_offset + table.size() * sizeof(TrigramEntry);
+    header.paths_offset = header.postings_offset + postings_size;
+    header.total_size = header.paths_offset + paths.size();
+
+    const fs::path index_path = root / TrigramIndex::kFileName;
+    fs::path temporary = index_path;
+    temporary += ".tmp";
+    {
+        std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()),
+                  static_cast<std::streamsize>(entries.size() * sizeof(FileEntry)));
+        out.write(reinterpret_cast<const char*>(table.data()),
+                  static_cast<std::streamsize>(table.size() * sizeof(TrigramEntry)));
+        for (const uint32_t trigram : trigrams) {
+            const auto& ids = postings[trigram].ids;
+            out.write(ids.data(), static_cast<std::streamsize>(ids.size()));
+        }
+        out.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+        if (!out.flush()) {
+            throw std::runtime_error("cannot write index file " + temporary.string());
+        }
+    }
+    fs::rename(temporary, index_path);
+}
+} // namespace
+
+TrigramIndex::BuildStats TrigramIndex::build(const fs::path& root, ThreadPool& pool) {
+    std::unique_ptr<TrigramIndex> previous{};
+    try {
+        previous = open(root);
+    } catch (const std::runtime_error&) {
+        // Nothing to take over, every file is read.
+    }
+    std::unordered_map<std::string_view, uint32_t> previous_ids{};
+    std::vector<std::string> previous_trigrams{};
+    if (previous != nullptr) {
+        const Header& header = header_of(previous->data_);
+        previous_ids.reserve(header.file_count);
+        for (uint32_t id = 0; id < header.file_count; ++id) {
+            previous_ids.emplace(file_path(previous->data_, id), id);
+        }
+        // Recovering the trigrams of the unchanged files runs alongside the traversal.
+        pool.submit([&previous, &previous_trigrams] { previous_trigrams = previous->file_trigrams(); });
+    }
+
+    std::mutex files_mutex{};
+    std::vector<IndexedFile> files{};
+    std::atomic<size_t> read{0};
+    // The index holds the files a search walking the tree by default would find.
+    const PathFilter filter{PathFilter::Options{}};
+    const FileCallback on_file = [&](const FilePath& found) {
+        const fs::path path = found.path();
+        if (is_index_file(path)) {
+            return;
+        }
+        const auto index = [&, path] {
+            IndexedFile file{path.lexically_relative(root)};
+            if (!file_identity(path, file.identity)) {
+                file.flags = kUnindexedFile;
+            } else if (const auto it = previous_ids.find(file.relative.string());
+                       it != previous_ids.end() && unchanged(file_entry(previous->data_, it->second), file.identity)) {
+                file.flags = file_entry(previous->data_, it->second).flags;
+                file.previous_id = it->second;
+            } else {
+                index_file(path, file);
+                read.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::lock_guard lock{files_mutex};
+            files.push_back(std::move(file));
+        };
+        if (pool.saturated()) {
+            index();
+        } else {
+            pool.submit(index);
+        }
+    };
+    walk_tree(root, pool, on_file, WalkOrder::Any, &filter);
+    for (auto& file : files) {
+        if (file.previous_id != UINT32_MAX) {
+            file.trigrams = std::move(previous_trigrams[file.previous_id]);
+        }
+    }
+    std::sort(files.begin(), files.end(),
+              [](const IndexedFile& a, const IndexedFile& b) { return a.relative < b.relative; });
+    write_index(root, files);
+    return {files.size(), read.load()};
+}
+
+void TrigramIndex::watch(const fs::path& root, ThreadPool& pool,
+                         const std::function<void(const BuildStats&)>& on_build) {
+    TreeWatcher watcher{kQuietPeriod};
+    watcher.watch(root); // Before the build, so a change during it triggers the next one
+    while (true) {
+        on_build(build(root, pool));
+        watcher.wait();
+    }
+}
+
+std::unique_ptr<TrigramIndex> TrigramIndex::open(const fs::path& root) {
+    const fs::path index_path = root / kFileName;
+    std::unique_ptr<TrigramIndex> index{new TrigramIndex()};
+#ifndef _WIN32
+    if (const int fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+        struct stat st {};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapping = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED) {
+                index->mapping_ = mapping;
+                index->data_ = static_cast<const char*>(mapping);
+                index->size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+    }
+#endif
+    if (index->mapping_ == nullptr) {
+        std::ifstream in{index_path, std::ios::binary};
+        if (!in) {
+            throw std::runtime_error("no index found at " + index_path.string() + ", build one with --index");
+        }
+        index->contents_.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+        index->data_ = index->contents_.data();
+        index->size_ = index->contents_.size();
+    }
+    const auto* header = &header_of(index->data_);
+    const bool valid =
+        index->size_ >= sizeof(Header) && std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+        header->version == kVersion && header->total_size == index->size_ &&
+        header->files_offset == sizeof(Header) &&
+        header->trigrams_offset == header->files_offset + uint64_t{header->file_count} * sizeof(FileEntry) &&
+        header->postings_offset == header->trigrams_offset + uint64_t{header->trigram_count} * sizeof(TrigramEntry) &&
+        header->postings_offset <= header->paths_offset && header->paths_offset <= header->total_size;
+    if (!valid) {
+        throw std::runtime_error("damaged index file " + index_path.string() + ", rebuild it with --index");
+    }
+    return index;
+}
+
+TrigramIndex::~TrigramIndex() {
+#ifndef _WIN32
+    if (mapping_ != nullptr) {
+        ::munmap(mapping_, size_);
+    }
+#endif
+}
+
+std::vector<uint32_t> TrigramIndex::postings(const uint32_t trigram) const {
+    const Header& header = header_of(data_);
+    const auto* table = trigram_table(data_);
+    const auto* entry = std::lower_bound(table, table + header.trigram_count, trigram,
+                                         [](const TrigramEntry& e, const uint32_t t) { return e.trigram < t; });
+    std::vector<uint32_t> ids{};
+    if (entry == table + header.trigram_count || entry->trigram != trigram) {
+        return ids;
+    }
+    ids.reserve(entry->count);
+    for_each_delta(posting_bytes(data_, static_cast<uint32_t>(entry - table)), [&ids, &header](const uint32_t id) {
+        if (id < header.file_count) {
+            ids.push_back(id);
+        }
+    });
+    return ids;
+}
+
+std::vector<std::string> TrigramIndex::file_trigrams() const {
+    const Header& header = header_of(data_);
+    const auto* table = trigram_table(data_);
+    std::vector<std::string> trigrams(header.file_count);
+    std::vector<uint32_t> previous(header.file_count, 0);
+    // The table is sorted by trigram, so every file's trigrams come out in increasing order.
+    for (uint32_t index = 0; index < header.trigram_count; ++index) {
+        const uint32_t trigram = table[index].trigram;
+        for_each_delta(posting_bytes(data_, index), [&](const uint32_t id) {
+            if (id < header.file_count) {
+                append_varint(trigrams[id], trigram - previous[id]);
+                previous[id] = trigram;
+            }
+        });
+    }
+    return trigrams;
+}
+
+void TrigramIndex::mark_candidates(const std::string_view literal, std::vector<char>& candidates) const {
+    std::vector<uint32_t> trigrams{};
+    for (size_t i = 0; i + kMinLiteralSize <= literal.size(); ++i) {
+        trigrams.push_back(static_cast<uint32_t>(static_cast<unsigned char>(to_lower_ascii(literal[i]))) << 16 |
+                           static_cast<uint32_t>(static_cast<unsigned char>(to_lower_ascii(literal[i + 1]))) << 8 |
+                           static_cast<unsigned char>(to_lower_ascii(literal[i + 2])));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    std::vector<std::vector<uint32_t>> lists{};
+    for (const uint32_t trigram : trigrams) {
+        lists.push_back(postings(trigram));
+        if (lists.back().empty()) {
+            return;
+        }
+    }
+    // Intersecting the shortest lists first keeps the intermediate results small.
+    std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
+    std::vector<uint32_t> ids = std::move(lists.front());
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+        std::vector<uint32_t> common{};
+        std::set_intersection(ids.begin(), ids.end(), lists[i].begin(), lists[i].end(), std::back_inserter(common));
+        ids = std::move(common);
+    }
+    for (const uint32_t id : ids) {
+        candidates[id] = 1;
+    }
+}
+
+void TrigramIndex::for_each_candidate(const fs::path& root, const std::optional<std::vector<std::string>>& literals,
+                                      const FileCallback& on_file) const {
+    const Header& header = header_of(data_);
+    const bool everything = !literals.has_value() || std::ranges::any_of(*literals, [](const std::string& literal) {
+                                return literal.size() < kMinLiteralSize;
+                            });
+    std::vector<char> candidates(header.file_count, everything ? 1 : 0);
+    const auto directory = std::make_shared<FilePath::Directory>(root);
+    if (!everything) {
+        for (const auto& literal : *literals) {
+            mark_candidates(literal, candidates);
+        }
+    }
+    for (uint32_t id = 0; id < header.file_count; ++id) {
+        const FileEntry& file = file_entry(data_, id);
+        const auto relative = file_path(data_, id);
+        if (relative.empty()) {
+            continue;
+        }
+        const fs::path path = root / relative;
+        bool candidate = (file.flags & kUnindexedFile) != 0 || ((file.flags & kBinaryFile) == 0 && candidates[id]);
+        if (!candidate) {
+            // The index says nothing about a file that changed since.
+            FileIdentity identity{};
+            candidate = file_identity(path, identity) && !unchanged(file, identity);
+        }
+        if (candidate) {
+            on_file(FilePath{directory, directory->store(relative)});
+        }
+    }
+}
+
+} // namespace mb
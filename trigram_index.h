@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dir_walker.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace mb {
+/**
+ * @class TrigramIndex
+ * @brief On-disk index of the trigrams contained in every file of a directory tree.
+ *
+ * The index lists every file found under the root with its size and modification time, and
+ * for every trigram (three consecutive bytes, ASCII letters folded to lowercase) the files
+ * containing it. A file can only contain a literal if it contains all of the literal's
+ * trigrams, so intersecting their posting lists narrows a search down to a few candidate
+ * files without opening any of the others, in the spirit of Google's codesearch.
+ *
+ * The index is a single file in the root directory, laid out so it can be memory-mapped and
+ * used in place: a header, the file table, the trigram table sorted by trigram, the posting
+ * lists as delta-encoded varints, and the paths relative to the root. Every file is recorded
+ * with its size, modification time and inode, so changed files are recognised without
+ * reading them.
+ */
+class TrigramIndex final {
+public:
+    /**
+     * @brief Name of the index file in the indexed directory.
+     */
+    static constexpr std::string_view kFileName = ".mb_grep.index";
+
+    /**
+     * @brief Counts of a build().
+     */
+    struct BuildStats {
+        size_t files = 0; ///< Files in the index
+        size_t read = 0;  ///< Files that had to be read, the others were taken over
+    };
+
+    /**
+     * @brief Indexes a directory tree and writes the index file into its root.
+     *
+     * If the root already has an index, files whose path, size, modification time and inode
+     * match an entry of it are not read again: their trigrams are recovered from its posting
+     * lists, which runs on the pool alongside the traversal. Refreshing an index therefore
+     * costs a stat() per file plus reading the files that changed. The previous index is
+     * replaced atomically once the new one is complete.
+     *
+     * @param root The directory to index.
+     * @param pool The pool reading the files.
+     * @return What was indexed.
+     * @throws fs::filesystem_error If the root cannot be read.
+     * @throws std::runtime_error If the index file cannot be written.
+     */
+    static BuildStats build(const fs::path& root, ThreadPool& pool);
+    /**
+     * @brief Keeps the index of a directory tree up to date until the process is stopped.
+     *
+     * Builds the index, then waits for changes and refreshes it after each burst of them. On
+     * Linux the directories are watched with inotify; elsewhere the tree is checked again
+     * every few seconds.
+     *
+     * @param root The directory to index.
+     * @param pool The pool reading the files.
+     * @param on_build Called after every build.
+     * @throws fs::filesystem_error If the root cannot be read.
+     * @throws std::runtime_error If the index file cannot be written.
+     */
+    [[noreturn]] static void watch(const fs::path& root, ThreadPool& pool,
+                                   const std::function<void(const BuildStats&)>& on_build);
+    /**
+     * @brief Opens the index of a directory tree.
+     *
+     * @param root The indexed directory.
+     * @return The index.
+     * @throws std::runtime_error If there is no index or it is damaged.
+     */
+    static std::unique_ptr<TrigramIndex> open(const fs::path& root);
+
+    ~TrigramIndex();
+
+    TrigramIndex(const TrigramIndex&) = delete;
+    TrigramIndex& operator=(const TrigramIndex&) = delete;
+
+    /**
+     * @brief Reports the indexed files that may contain one of the literals.
+     *
+     * Files whose size or modification time no longer match the index are reported as well,
+     * since their contents are unknown; files that have been deleted are not. Files created
+     * after the index was built are not seen.
+     *
+     * @param root The indexed directory as given by the user, prefixed to the reported paths.
+     * @param literals Every match contains one of these, or std::nullopt if nothing is known.
+     * @param on_file Called on the calling thread for every candidate, in path order.
+     */
+    void for_each_candidate(const fs::path& root, const std::optional<std::vector<std::string>>& literals,
+                            const FileCallback& on_file) const;
+
+private:
+    TrigramIndex() = default;
+
+    std::vector<uint32_t> postings(uint32_t trigram) const;
+    std::vector<std::string> file_trigrams() const;
+    void mark_candidates(std::string_view literal, std::vector<char>& candidates) const;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    void* mapping_ = nullptr; ///< The mapped index file, if it could be mapped
+    std::string contents_{};  ///< The index file read into memory otherwise
+};
+} // namespace mb
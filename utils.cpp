@@ -1,26 +1,65 @@
 #include "utils.h"
 
-#include <fstream>
-#include <regex>
-#include <thread>
+#include <algorithm>
+#include <cstdint>
+
+#include "topology.h"
 
 namespace mb {
-bool is_binary_file(const fs::path& path) {
-    std::ifstream file(path, std::ios::binary);
-    char buffer[512];
-    file.read(buffer, sizeof(buffer));
-    const auto bytesRead = file.gcount();
-    return std::any_of(buffer, buffer + bytesRead, [](const char c) { return c == '\0'; });
+Encoding detect_encoding(const std::string_view head) {
+    if (head.starts_with("\xFF\xFE")) {
+        return Encoding::Utf16LE;
+    }
+    if (head.starts_with("\xFE\xFF")) {
+        return Encoding::Utf16BE;
+    }
+    constexpr size_t sniffSize = 512;
+    const auto sniffed = head.substr(0, sniffSize);
+    return std::ranges::find(sniffed, '\0') != sniffed.end() ? Encoding::Binary : Encoding::Text;
+}
+
+std::string utf16_to_utf8(const std::string_view text, const bool big_endian) {
+    const auto unit = [text, big_endian](const size_t i) {
+        const auto first = static_cast<unsigned char>(text[2 * i]);
+        const auto second = static_cast<unsigned char>(text[2 * i + 1]);
+        return static_cast<uint32_t>(big_endian ? first << 8 | second : second << 8 | first);
+    };
+    const size_t units = text.size() / 2;
+    std::string utf8;
+    utf8.reserve(units);
+    for (size_t i = 0; i < units; ++i) {
+        uint32_t code = unit(i);
+        if (code >= 0xD800 && code <= 0xDBFF && i + 1 < units && unit(i + 1) >= 0xDC00 && unit(i + 1) <= 0xDFFF) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (unit(++i) - 0xDC00);
+        } else if (code >= 0xD800 && code <= 0xDFFF) {
+            code = 0xFFFD;
+        }
+        if (code < 0x80) {
+            utf8 += static_cast<char>(code);
+        } else if (code < 0x800) {
+            utf8 += static_cast<char>(0xC0 | code >> 6);
+            utf8 += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            utf8 += static_cast<char>(0xE0 | code >> 12);
+            utf8 += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            utf8 += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            utf8 += static_cast<char>(0xF0 | code >> 18);
+            utf8 += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+            utf8 += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+            utf8 += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+    return utf8;
 }
 
 bool contains_regex_chars(const std::string& query) {
-    static const std::regex likely_regex_pattern(R"([.^$*+?{}\[\]\\|()])");
-    return std::regex_search(query, likely_regex_pattern);
+    return query.find_first_of(R"(.^$*+?{}[]\|())") != std::string::npos;
 }
 
-size_t get_threads_number() {
-    constexpr size_t reservedThreads = 2;
-    auto num_threads = static_cast<size_t>(std::thread::hardware_concurrency());
+size_t get_threads_number(const Workload workload) {
+    const size_t reservedThreads = workload == Workload::Compute ? 2 : 0;
+    auto num_threads = CpuTopology::detect().cpu_count();
     num_threads = std::max<size_t>(1, num_threads > reservedThreads ? num_threads - reservedThreads : 1);
     return num_threads;
 }
@@ -1,17 +1,42 @@
 #pragma once
 #include <filesystem>
+#include <string>
+#include <string_view>
 
 namespace fs = std::filesystem;
 
 namespace mb {
 /**
- * @brief Determines whether a file is binary.
+ * @brief How the contents of a file are encoded.
+ */
+enum class Encoding {
+    Text,    ///< ASCII or UTF-8 text, searched as is
+    Utf16LE, ///< Little-endian UTF-16 text starting with a byte order mark
+    Utf16BE, ///< Big-endian UTF-16 text starting with a byte order mark
+    Binary,  ///< Not text, skipped by the search
+};
+
+/**
+ * @brief Determines the encoding of a file from its first bytes.
+ *
+ * A UTF-16 byte order mark at the very start marks UTF-16 text. Otherwise a NUL byte within
+ * the first 512 bytes marks the file as binary.
+ *
+ * @param head The first bytes of the file.
+ * @return The encoding.
+ */
+Encoding detect_encoding(std::string_view head);
+
+/**
+ * @brief Converts UTF-16 text to UTF-8.
+ *
+ * Unpaired surrogates become U+FFFD and a trailing odd byte is dropped.
  *
- * @param path The path to the file to check.
- * @return true If the file appears to be binary.
- * @return false If the file appears to be text.
+ * @param text The UTF-16 code units, without the byte order mark.
+ * @param big_endian If true, the code units are big-endian.
+ * @return The UTF-8 text.
  */
-bool is_binary_file(const fs::path& path);
+std::string utf16_to_utf8(std::string_view text, bool big_endian);
 
 /**
  * @brief Checks whether a string contains characters typically used in regular expressions.
@@ -25,14 +50,25 @@ bool is_binary_file(const fs::path& path);
  */
 bool contains_regex_chars(const std::string& query);
 
+/**
+ * @brief What the worker threads of a pool spend their time on.
+ */
+enum class Workload {
+    Reading, ///< The workers read the files themselves and block while the disk catches up
+    Compute, ///< The files are read for the workers, which only ever wait for the CPU
+};
+
 /**
  * @brief Determines the number of worker threads to use.
  *
- * This function returns the number of available hardware threads,
- * minus a reserved number (e.g., 2) to leave system resources available
- * for other processes. Ensures at least one thread is used.
+ * Starts from the CPUs the process may run on, which is fewer than the machine has under
+ * taskset or a container's CPU limit. Workers that read the files themselves leave their CPU
+ * idle while they wait for a read, so they get one CPU each. Workers that only compute keep
+ * two CPUs free for the thread reading for them and for other processes. Ensures at least
+ * one thread is used.
  *
+ * @param workload What the workers do.
  * @return size_t The number of threads to be used by the thread pool.
  */
-size_t get_threads_number();
+size_t get_threads_number(Workload workload);
 } // namespace mb